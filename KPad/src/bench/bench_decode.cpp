@@ -0,0 +1,69 @@
+// Decode suite: encoding detection and UTF-8 decoding as done on load,
+// against QTextStream::readAll() over the same bytes. Throughput is file
+// bytes per second.
+
+#include "kpad_bench.h"
+#include "kpad_encoding.h"
+
+#include <QBuffer>
+
+static void report(qint64 sizeMB, const char *stage, const char *text, qint64 ns, qint64 bytes) {
+    const double seconds = ns / 1e9;
+    const double gbPerSecond = seconds > 0 ? bytes / seconds / 1e9 : 0.0;
+    kpadBenchOut() << QString("%1 MB  %2  %3  %4 ms  %5 GB/s")
+                          .arg(sizeMB, 5)
+                          .arg(QLatin1String(stage), -16)
+                          .arg(QLatin1String(text), -5)
+                          .arg(ns / 1e6, 10, 'f', 2)
+                          .arg(gbPerSecond, 7, 'f', 2)
+                   << Qt::endl;
+    kpadBenchRecord("decode", QString("%1 %2").arg(QLatin1String(stage), QLatin1String(text)),
+                    sizeMB * 1000 * 1000, ns, {{"bytes", double(bytes)}});
+}
+
+void runDecodeBenchmark(const KpadBenchOptions &options) {
+    kpadBenchOut() << "== decode" << Qt::endl;
+
+    for (qint64 sizeMB : options.sizesMB) {
+        const qint64 chars = sizeMB * 1000 * 1000;
+        QString corpus = kpadBenchCorpus(chars);
+
+        // "ascii" is the plain corpus; "mixed" turns every planted word
+        // into a non-ASCII one so the validator leaves its fast path
+        for (const char *text : {"ascii", "mixed"}) {
+            if (qstrcmp(text, "mixed") == 0)
+                corpus.replace(QLatin1String("quixotic"), QString::fromUtf8("quíxotic"));
+            const QByteArray bytes = corpus.toUtf8();
+
+            bool valid = false;
+            qint64 ns = kpadBenchBestOf(options.repeats, [&]() {
+                valid = KpadEncoding::isValidUtf8(bytes.constData(), bytes.size());
+            });
+            report(sizeMB, valid ? "validate" : "validate:bad", text, ns, bytes.size());
+
+            qint64 decoded = 0;
+            ns = kpadBenchBestOf(options.repeats, [&]() {
+                const KpadTextFormat format = KpadEncoding::detect(bytes.constData(), bytes.size());
+                KpadTextDecoder decoder(format.encoding);
+                decoded = 0;
+                for (qint64 offset = 0; offset < bytes.size(); offset += 1024 * 1024) {
+                    const qint64 length = qMin<qint64>(1024 * 1024, bytes.size() - offset);
+                    decoded += decoder.decode(bytes.constData() + offset, length).size();
+                }
+            });
+            report(sizeMB, "detect+decode", text, ns, bytes.size());
+
+            // Baseline: what open() used to do
+            if (sizeMB > options.documentLimitMB)
+                continue;
+            ns = kpadBenchBestOf(1, [&]() {
+                QBuffer buffer;
+                buffer.setData(bytes);
+                buffer.open(QIODevice::ReadOnly | QIODevice::Text);
+                QTextStream in(&buffer);
+                decoded = in.readAll().size();
+            });
+            report(sizeMB, "QTextStream", text, ns, bytes.size());
+        }
+    }
+}
@@ -0,0 +1,178 @@
+// Editor suite: a real (offscreen) Kpad window doing what the user does,
+// through the same private slots the UI calls: open a generated file, save
+// it, type a find pattern, count words, change the font size, indent and
+// make a list of the whole document. Each step waits for the background
+// work it starts (streaming load, save, search), so a time covers the
+// whole operation. Files past the viewer threshold only time open(); so do
+// corpora above --document-limit.
+
+#include "kpad_bench.h"
+#include "kpad.h"
+#include "kpad_largeview.h"
+#include "kpad_saver.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <functional>
+
+// The corpus as an ASCII file, generated in slices so a 1 GB one never
+// sits in memory whole
+static bool writeCorpusFile(const QString &path, qint64 chars) {
+    static const qint64 kSliceChars = 16 * 1000 * 1000;
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    quint32 seed = 1;
+    for (qint64 done = 0; done < chars; done += kSliceChars) {
+        const QString text = kpadBenchCorpus(qMin(kSliceChars, chars - done), seed++);
+        if (file.write(text.toLatin1()) < 0)
+            return false;
+    }
+    return true;
+}
+
+static void waitUntil(const std::function<bool()> &done) {
+    while (!done())
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 20);
+}
+
+struct KpadEditorBench
+{
+    static void report(const char *name, qint64 sizeMB, qint64 ns, const QString &note = QString(),
+                       const QJsonObject &extra = QJsonObject()) {
+        kpadBenchOut() << QString("%1 MB  %2  %3 ms  %4")
+                              .arg(sizeMB, 5)
+                              .arg(QLatin1String(name), -14)
+                              .arg(ns / 1e6, 10, 'f', 2)
+                              .arg(note)
+                       << Qt::endl;
+        kpadBenchRecord("editor", QLatin1String(name), sizeMB * 1000 * 1000, ns, extra);
+    }
+
+    static void selectAll(Kpad &kpad) {
+        QTextCursor cursor(kpad.textEdit->document());
+        cursor.select(QTextCursor::Document);
+        kpad.textEdit->setTextCursor(cursor);
+    }
+
+    static void clearSelection(Kpad &kpad) {
+        QTextCursor cursor = kpad.textEdit->textCursor();
+        cursor.clearSelection();
+        kpad.textEdit->setTextCursor(cursor);
+    }
+
+    static void runSize(qint64 sizeMB, const QString &dir, const KpadBenchOptions &options) {
+        const qint64 chars = sizeMB * 1000 * 1000;
+        const QString path = QDir(dir).filePath(QString("corpus-%1MB.txt").arg(sizeMB));
+        if (!writeCorpusFile(path, chars)) {
+            kpadBenchOut() << QString("%1 MB  cannot write the corpus to %2").arg(sizeMB, 5).arg(dir) << Qt::endl;
+            return;
+        }
+
+        Kpad kpad;
+        kpad.resize(1000, 700);
+        kpad.show();
+        QCoreApplication::processEvents();
+
+        // open: until the text is in the editor, or the viewer has indexed it
+        QElapsedTimer timer;
+        timer.start();
+        kpad.loadFile(path);
+        waitUntil([&]() { return !kpad.fileLoader && !kpad.htmlLoader && !kpad.largeView->isIndexing(); });
+        const qint64 openNs = timer.nsecsElapsed();
+        const bool viewer = kpad.largeView->isOpen();
+        report("open", sizeMB, openNs, viewer ? "large-file viewer" : "editor",
+               {{"viewer", viewer}});
+
+        if (viewer || sizeMB > options.documentLimitMB) {
+            kpadBenchOut() << QString("%1 MB  editing steps skipped (%2)")
+                                  .arg(sizeMB, 5)
+                                  .arg(viewer ? QString("read-only viewer")
+                                              : QString("--document-limit %1").arg(options.documentLimitMB))
+                           << Qt::endl;
+            QFile::remove(path);
+            return;
+        }
+
+        // save: snapshot, encode and write in the background
+        const QString savePath = QDir(dir).filePath("saved.txt");
+        qint64 ns = kpadBenchBestOf(options.repeats, [&]() {
+            kpad.writeDocument(savePath);
+            kpad.fileSaver->waitForFinished();
+            QCoreApplication::processEvents();
+        });
+        report("save", sizeMB, ns);
+
+        // find: the find box's search, up to the matches being in the index
+        const QString pattern = options.pattern.isEmpty() ? QStringLiteral("quixotic") : options.pattern;
+        ns = kpadBenchBestOf(options.repeats, [&]() {
+            kpad.highlightMatches(QString());
+            bool done = false;
+            const QMetaObject::Connection connection = QObject::connect(
+                kpad.findWatcher, &QFutureWatcher<QVector<KpadMatch>>::finished, [&]() { done = true; });
+            kpad.highlightMatches(pattern);
+            waitUntil([&]() { return done || !kpad.findWatcher->isRunning(); });
+            QObject::disconnect(connection);
+            QCoreApplication::processEvents();
+        });
+        const int matches = kpad.findMatches.size();
+        report("find", sizeMB, ns, QString("%1 matches").arg(matches), {{"matches", matches}});
+        kpad.highlightMatches(QString());
+
+        // count: the status bar, for the whole document and for a selection
+        ns = kpadBenchBestOf(options.repeats, [&]() { kpad.updateCounts(); });
+        report("count", sizeMB, ns, QString("%1 words").arg(kpad.wordTally->words),
+               {{"words", double(kpad.wordTally->words)}});
+        selectAll(kpad);
+        ns = kpadBenchBestOf(options.repeats, [&]() { kpad.updateCounts(); });
+        report("count:select", sizeMB, ns);
+
+        // format: font size +1 / -1 on the whole document
+        int delta = 1;
+        ns = kpadBenchBestOf(options.repeats, [&]() {
+            kpad.changeFontSizeDelta(delta);
+            delta = -delta;
+        });
+        report("font size", sizeMB, ns);
+
+        // indent: Tab then Shift+Tab over every line
+        selectAll(kpad);
+        ns = kpadBenchBestOf(options.repeats, [&]() {
+            kpad.indentBlocks(false);
+            kpad.indentBlocks(true);
+        });
+        report("indent", sizeMB, ns, "indent + outdent");
+
+        // list: once; it cannot be repeated on the same text
+        selectAll(kpad);
+        ns = kpadBenchBestOf(1, [&]() { kpad.insertBulletList("*"); });
+        report("bullet list", sizeMB, ns);
+
+        clearSelection(kpad);
+        kpad.textEdit->document()->setModified(false);
+        QFile::remove(path);
+        QFile::remove(savePath);
+    }
+};
+
+void runEditorBenchmark(const KpadBenchOptions &options) {
+    kpadBenchOut() << "== editor: Kpad code paths on generated files" << Qt::endl;
+
+    // Keep the window's session, journal and tab snapshots away from the
+    // user's, and start each run without anything to restore
+    QStandardPaths::setTestModeEnabled(true);
+    const QString appData = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    QDir(appData).removeRecursively();
+
+    QTemporaryDir dir;
+    if (!dir.isValid()) {
+        kpadBenchOut() << "Cannot create a temporary directory" << Qt::endl;
+        return;
+    }
+    for (qint64 sizeMB : options.sizesMB) {
+        runSize(sizeMB, dir.path(), options);
+        QDir(appData).removeRecursively();
+    }
+}
@@ -0,0 +1,78 @@
+// Find suite: literal search over a UTF-16 snapshot with every kernel the
+// CPU supports, against QTextDocument::find() walking the same text.
+// Throughput is corpus characters per second, in Gchar/s (one character
+// per byte of the equivalent ASCII file; two bytes of the UTF-16 snapshot).
+
+#include "kpad_bench.h"
+#include "kpad_search.h"
+
+#include <QTextDocument>
+#include <QTextCursor>
+
+static void report(qint64 sizeMB, const char *engine, const char *mode, qint64 ns, qint64 chars, int matches) {
+    const double seconds = ns / 1e9;
+    const double gcharsPerSecond = seconds > 0 ? chars / seconds / 1e9 : 0.0;
+    kpadBenchOut() << QString("%1 MB  %2  %3  %4 ms  %5 Gchar/s  %6 matches")
+                          .arg(sizeMB, 5)
+                          .arg(QLatin1String(engine), -16)
+                          .arg(QLatin1String(mode), -4)
+                          .arg(ns / 1e6, 10, 'f', 2)
+                          .arg(gcharsPerSecond, 7, 'f', 2)
+                          .arg(matches)
+                   << Qt::endl;
+    kpadBenchRecord("find", QString("%1 %2").arg(QLatin1String(engine), QLatin1String(mode)), chars, ns,
+                    {{"matches", matches}});
+}
+
+void runFindBenchmark(const KpadBenchOptions &options) {
+    using KpadSearch::Kernel;
+    const QString pattern = options.pattern.isEmpty() ? QStringLiteral("quixotic") : options.pattern;
+
+    kpadBenchOut() << "== find: \"" << pattern << "\" (best kernel: "
+                   << KpadSearch::kernelName(Kernel::Auto) << ")" << Qt::endl;
+
+    for (qint64 sizeMB : options.sizesMB) {
+        const qint64 chars = sizeMB * 1000 * 1000;
+        const KpadTextSnapshot snapshot = KpadTextSnapshot::fromString(kpadBenchCorpus(chars));
+
+        for (Kernel kernel : {Kernel::Scalar, Kernel::Sse2, Kernel::Avx2}) {
+            if (!KpadSearch::isSupported(kernel))
+                continue;
+            for (Qt::CaseSensitivity cs : {Qt::CaseSensitive, Qt::CaseInsensitive}) {
+                int matches = 0;
+                const qint64 ns = kpadBenchBestOf(options.repeats, [&]() {
+                    matches = KpadSearch::findLiteral(snapshot, pattern, cs, nullptr, kernel).size();
+                });
+                report(sizeMB, KpadSearch::kernelName(kernel), cs == Qt::CaseSensitive ? "cs" : "ci",
+                       ns, chars, matches);
+            }
+        }
+
+        // Baseline: what the find box used to do
+        if (sizeMB > options.documentLimitMB) {
+            kpadBenchOut() << QString("%1 MB  QTextDocument::find skipped (--document-limit %2)")
+                                  .arg(sizeMB, 5).arg(options.documentLimitMB)
+                           << Qt::endl;
+            continue;
+        }
+
+        QTextDocument doc;
+        doc.setPlainText(snapshot.toString());
+        for (Qt::CaseSensitivity cs : {Qt::CaseSensitive, Qt::CaseInsensitive}) {
+            const QTextDocument::FindFlags flags = cs == Qt::CaseSensitive ? QTextDocument::FindCaseSensitively
+                                                                           : QTextDocument::FindFlags();
+            int matches = 0;
+            const qint64 ns = kpadBenchBestOf(1, [&]() {
+                matches = 0;
+                QTextCursor cursor(&doc);
+                for (;;) {
+                    cursor = doc.find(pattern, cursor, flags);
+                    if (cursor.isNull())
+                        break;
+                    ++matches;
+                }
+            });
+            report(sizeMB, "QTextDocument", cs == Qt::CaseSensitive ? "cs" : "ci", ns, chars, matches);
+        }
+    }
+}
@@ -0,0 +1,83 @@
+// Format suite: "+" font size on a whole-document selection, run-based
+// (kpadScaleFontSize) against the old per-character merge loop. The first
+// table keeps the text size fixed and grows the number of format runs, the
+// second keeps the runs fixed and grows the text: time should follow runs,
+// not characters.
+
+#include "kpad_bench.h"
+#include "kpad_format.h"
+
+#include <QTextCursor>
+#include <QTextDocument>
+#include <algorithm>
+
+// chars characters split into runs alternating plain/bold format runs
+static void buildDocument(QTextDocument &doc, qint64 chars, int runs) {
+    const QString text = kpadBenchCorpus(chars);
+    QTextCharFormat plain;
+    QTextCharFormat bold;
+    bold.setFontWeight(QFont::Bold);
+
+    doc.clear();
+    QTextCursor cursor(&doc);
+    cursor.beginEditBlock();
+    const qint64 runLength = qMax<qint64>(1, chars / runs);
+    for (qint64 offset = 0, i = 0; offset < chars; offset += runLength, ++i)
+        cursor.insertText(text.mid(offset, runLength), i % 2 ? bold : plain);
+    cursor.endEditBlock();
+}
+
+// The loop changeFontSizeDelta() used to run
+static void perCharacterScale(QTextDocument &doc, int delta) {
+    QTextCursor cursor(&doc);
+    const int end = doc.characterCount() - 1;
+    cursor.beginEditBlock();
+    while (cursor.position() < end) {
+        cursor.movePosition(QTextCursor::NextCharacter, QTextCursor::KeepAnchor);
+        QTextCharFormat fmt = cursor.charFormat();
+        int size = fmt.fontPointSize();
+        if (size <= 0)
+            size = 14;
+        fmt.setFontPointSize(std::max(1, size + delta));
+        cursor.mergeCharFormat(fmt);
+        cursor.clearSelection();
+    }
+    cursor.endEditBlock();
+}
+
+static void runCase(qint64 chars, int runs, const KpadBenchOptions &options) {
+    QTextDocument doc;
+    buildDocument(doc, chars, runs);
+    const int end = doc.characterCount() - 1;
+
+    int ranges = 0;
+    int delta = 1;
+    const qint64 ns = kpadBenchBestOf(options.repeats, [&]() {
+        ranges = kpadScaleFontSize(&doc, 0, end, delta, 14);
+        delta = -delta;  // keep sizes from drifting between repeats
+    });
+
+    QString line = QString("%1 chars  %2 runs  run-based %3 ms  %4 us/run  %5 ranges")
+                       .arg(chars, 9)
+                       .arg(runs, 7)
+                       .arg(ns / 1e6, 9, 'f', 2)
+                       .arg(ns / 1e3 / runs, 7, 'f', 2)
+                       .arg(ranges, 7);
+
+    // The old loop is far too slow beyond small documents
+    if (chars <= 100 * 1000) {
+        const qint64 oldNs = kpadBenchBestOf(1, [&]() { perCharacterScale(doc, 1); });
+        line += QString("  per-char %1 ms").arg(oldNs / 1e6, 9, 'f', 2);
+    }
+    kpadBenchOut() << line << Qt::endl;
+    kpadBenchRecord("format", QString("font size +1, %1 runs").arg(runs), chars, ns, {{"ranges", ranges}});
+}
+
+void runFormatBenchmark(const KpadBenchOptions &options) {
+    kpadBenchOut() << "== format: font size +1 on the whole document" << Qt::endl;
+
+    for (int runs : {100, 1000, 10000, 100000})
+        runCase(1000 * 1000, runs, options);
+    for (qint64 chars : {100 * 1000, 1000 * 1000, 10 * 1000 * 1000})
+        runCase(chars, 1000, options);
+}
@@ -0,0 +1,83 @@
+// HTML suite: "Save as HTML" through QTextDocument::toHtml() (the whole
+// page built as one QString, then encoded and written) against the
+// streaming KpadHtmlExporter. Both write to a temporary file. The
+// documents cycle a handful of character formats over many short runs, as
+// pasted or hand-formatted text does, so toHtml() repeats the same inline
+// style= on every run while the exporter shares one class per format.
+
+#include "kpad_bench.h"
+#include "kpad_html.h"
+
+#include <QTemporaryFile>
+#include <QTextCursor>
+#include <QTextDocument>
+
+// chars characters, a new format every runLength of them, a new paragraph
+// at every line break of the corpus
+static void buildDocument(QTextDocument &doc, qint64 chars, int runLength) {
+    QVector<QTextCharFormat> formats(6);
+    formats[1].setFontWeight(QFont::Bold);
+    formats[2].setFontItalic(true);
+    formats[3].setForeground(QColor(0xb0, 0x30, 0x30));
+    formats[4].setFontPointSize(16);
+    formats[5].setFontUnderline(true);
+    formats[5].setForeground(QColor(0x20, 0x50, 0xa0));
+
+    const QString text = kpadBenchCorpus(chars);
+    doc.clear();
+    QTextCursor cursor(&doc);
+    cursor.beginEditBlock();
+    for (qint64 offset = 0, i = 0; offset < chars; offset += runLength, ++i)
+        cursor.insertText(text.mid(offset, runLength), formats[i % formats.size()]);
+    cursor.endEditBlock();
+}
+
+static void runCase(qint64 chars, int runLength, const KpadBenchOptions &options) {
+    QTextDocument doc;
+    buildDocument(doc, chars, runLength);
+
+    qint64 qtBytes = 0;
+    qint64 qtStringBytes = 0;
+    const qint64 qtNs = kpadBenchBestOf(options.repeats, [&]() {
+        QTemporaryFile file;
+        file.open();
+        const QString html = doc.toHtml();
+        qtStringBytes = html.size() * qint64(sizeof(QChar));
+        qtBytes = file.write(html.toUtf8());
+    });
+
+    KpadHtmlExportResult result;
+    const qint64 streamNs = kpadBenchBestOf(options.repeats, [&]() {
+        QTemporaryFile file;
+        file.open();
+        result = KpadHtmlExporter::write(&doc, &file);
+    });
+
+    kpadBenchOut() << QString("%1 chars  run %2  toHtml %3 ms %4 MB (%5 MB string)"
+                              "  stream %6 ms %7 MB %8 classes  %9x smaller %10x faster")
+                          .arg(chars, 9)
+                          .arg(runLength, 4)
+                          .arg(qtNs / 1e6, 9, 'f', 1)
+                          .arg(qtBytes / 1048576.0, 7, 'f', 2)
+                          .arg(qtStringBytes / 1048576.0, 7, 'f', 2)
+                          .arg(streamNs / 1e6, 9, 'f', 1)
+                          .arg(result.bytes / 1048576.0, 7, 'f', 2)
+                          .arg(result.classes, 3)
+                          .arg(double(qtBytes) / qMax<qint64>(result.bytes, 1), 5, 'f', 2)
+                          .arg(double(qtNs) / qMax<qint64>(streamNs, 1), 5, 'f', 2)
+                   << Qt::endl;
+    kpadBenchRecord("html", QString("toHtml, run %1").arg(runLength), chars, qtNs, {{"bytes", double(qtBytes)}});
+    kpadBenchRecord("html", QString("stream, run %1").arg(runLength), chars, streamNs,
+                    {{"bytes", double(result.bytes)}, {"classes", result.classes}});
+}
+
+void runHtmlBenchmark(const KpadBenchOptions &options) {
+    kpadBenchOut() << "== html: save as HTML, toHtml() vs streaming export" << Qt::endl;
+
+    for (int runLength : {8, 40, 400})
+        runCase(1000 * 1000, runLength, options);
+    for (qint64 chars : {100 * 1000, 1000 * 1000, 5 * 1000 * 1000}) {
+        if (chars <= options.documentLimitMB * 1000 * 1000)
+            runCase(chars, 40, options);
+    }
+}
@@ -0,0 +1,98 @@
+// Theme suite: switching an (offscreen) Kpad window between light and
+// dark, through the same slot as View > Toggle Theme, with a 1M-character
+// document in the editor. A time covers the switch and one synchronous
+// repaint of the window. Baseline: the application-wide style sheet the
+// dark theme used to be, set and cleared the same way.
+
+#include "kpad_bench.h"
+#include "kpad.h"
+
+#include <QApplication>
+#include <QCoreApplication>
+#include <QDir>
+#include <QStandardPaths>
+
+static const qint64 kThemeChars = 1000 * 1000;
+
+static const char *const kBaselineStyleSheet = R"(
+    QMainWindow, QWidget { background-color: #2b2b2b; color: #ffffff; }
+    QMenuBar { background-color: #353535; color: #ffffff; }
+    QMenuBar::item:selected { background: #3e3e3e; }
+    QMenu { background-color: #2b2b2b; color: #ffffff; }
+    QMenu::item:selected { background: #3e3e3e; }
+    QTextEdit { background-color: #1e1e1e; color: #ffffff; selection-background-color: #0078d7; }
+    QLineEdit, QComboBox, QSpinBox { background-color: #3c3c3c; color: #ffffff; border: 1px solid #555; }
+    QPushButton { background-color: #3c3c3c; color: #ffffff; border: 1px solid #555; padding: 4px; }
+    QPushButton:hover { background-color: #444444; }
+    QMessageBox { background-color: #2b2b2b; color: #ffffff; }
+    QStatusBar { background-color: #353535; color: #ffffff; }
+)";
+
+struct KpadThemeBench
+{
+    static void report(const char *name, qint64 ns, const QString &note = QString()) {
+        kpadBenchOut() << QString("%1  %2 ms  %3")
+                              .arg(QLatin1String(name), -18)
+                              .arg(ns / 1e6, 10, 'f', 2)
+                              .arg(note)
+                       << Qt::endl;
+        kpadBenchRecord("theme", QLatin1String(name), kThemeChars, ns);
+    }
+
+    static void run(const KpadBenchOptions &options) {
+        Kpad kpad;
+        kpad.resize(1000, 700);
+        kpad.show();
+        const QString text = kpadBenchCorpus(kThemeChars);
+        kpad.pieceTableSyncBlocked = true;
+        kpad.textEdit->setPlainText(text);
+        kpad.pieceTableSyncBlocked = false;
+        kpad.resetPieceTable(text, true);
+        kpad.textEdit->document()->setModified(false);
+        QCoreApplication::processEvents();
+
+        // prepare: palettes and inverted icons, built once per window
+        KpadTheme fresh;
+        fresh.addActions(kpad.findChildren<QAction *>());
+        qint64 ns = kpadBenchBestOf(1, [&]() { fresh.prepare(); });
+        report("prepare", ns, "palettes + dark icons");
+
+        // switch: the first one to dark also settles the style, so it is timed apart
+        auto toggle = [&]() {
+            kpad.toggleTheme();
+            QCoreApplication::processEvents();
+            kpad.repaint();
+        };
+        ns = kpadBenchBestOf(1, toggle);
+        report("switch:first", ns, "to dark");
+        toggle();
+
+        ns = kpadBenchBestOf(options.repeats, [&]() {
+            toggle();       // to dark
+            toggle();       // and back
+        });
+        report("switch", ns / 2, "per switch, dark and back");
+
+        // baseline: the style sheet, which re-polishes every widget
+        ns = kpadBenchBestOf(options.repeats, [&]() {
+            qApp->setStyleSheet(QLatin1String(kBaselineStyleSheet));
+            QCoreApplication::processEvents();
+            kpad.repaint();
+            qApp->setStyleSheet(QString());
+            QCoreApplication::processEvents();
+            kpad.repaint();
+        });
+        report("stylesheet", ns / 2, "per switch, baseline");
+    }
+};
+
+void runThemeBenchmark(const KpadBenchOptions &options) {
+    kpadBenchOut() << "== theme: light/dark switch on a 1M-character document" << Qt::endl;
+
+    // As the editor suite: no session or journal of the user's is touched
+    QStandardPaths::setTestModeEnabled(true);
+    const QString appData = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    QDir(appData).removeRecursively();
+    KpadThemeBench::run(options);
+    QDir(appData).removeRecursively();
+}
@@ -0,0 +1,160 @@
+// kpad_bench: micro-benchmarks for KPad's editor internals.
+//
+//   kpad_bench [--suite find|decode|format|html|editor|theme] [--sizes 10,100,1000] [--document-limit 100]
+//              [--json results.json [--label <commit>]]
+//
+// Runs on Qt's offscreen platform unless QT_QPA_PLATFORM says otherwise.
+// --json writes every result as well, for comparing runs across commits.
+
+#include "kpad_bench.h"
+
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QRandomGenerator>
+#include <QSaveFile>
+#include <QSysInfo>
+
+QTextStream &kpadBenchOut() {
+    static QTextStream out(stdout);
+    return out;
+}
+
+static QJsonArray &benchResults() {
+    static QJsonArray results;
+    return results;
+}
+
+void kpadBenchRecord(const QString &suite, const QString &name, qint64 chars, qint64 ns,
+                     const QJsonObject &extra) {
+    QJsonObject result = extra;
+    result.insert("suite", suite);
+    result.insert("name", name);
+    result.insert("chars", double(chars));
+    result.insert("ms", ns / 1e6);
+    benchResults().append(result);
+}
+
+static bool writeReport(const QString &path, const QString &label, QString *errorString) {
+    QJsonObject root;
+    root.insert("label", label);
+    root.insert("date", QDateTime::currentDateTimeUtc().toString(Qt::ISODate));
+    root.insert("qt", QLatin1String(qVersion()));
+    root.insert("os", QSysInfo::prettyProductName());
+    root.insert("cpu", QSysInfo::currentCpuArchitecture());
+    root.insert("results", benchResults());
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        *errorString = file.errorString();
+        return false;
+    }
+    file.write(QJsonDocument(root).toJson());
+    if (!file.commit()) {
+        *errorString = file.errorString();
+        return false;
+    }
+    return true;
+}
+
+QString kpadBenchCorpus(qint64 chars, quint32 seed) {
+    static const char *const words[] = {
+        "the", "editor", "file", "line", "of", "text", "and", "a", "buffer", "to",
+        "search", "in", "window", "format", "with", "document", "cursor", "block",
+        "for", "is", "page", "font", "on", "save", "open", "it", "word", "count",
+        "layout", "by", "paragraph", "style", "as", "at", "view", "list"
+    };
+    const int wordCount = int(sizeof(words) / sizeof(words[0]));
+
+    QRandomGenerator random(seed);
+    QString text;
+    text.reserve(chars);
+
+    int column = 0;
+    qint64 nextPlant = 64 * 1024;
+    while (text.size() < chars) {
+        const char *word = text.size() >= nextPlant ? "quixotic" : words[random.bounded(wordCount)];
+        if (text.size() >= nextPlant)
+            nextPlant += 64 * 1024;
+
+        text.append(QLatin1String(word));
+        column += int(qstrlen(word)) + 1;
+        if (column >= 80) {
+            text.append(QLatin1Char('\n'));
+            column = 0;
+        } else {
+            text.append(QLatin1Char(' '));
+        }
+    }
+    text.truncate(chars);
+    return text;
+}
+
+static QList<qint64> parseSizes(const QString &value) {
+    QList<qint64> sizes;
+    const QStringList parts = value.split(',', Qt::SkipEmptyParts);
+    for (const QString &part : parts) {
+        bool ok = false;
+        const qint64 size = part.trimmed().toLongLong(&ok);
+        if (ok && size > 0)
+            sizes.append(size);
+    }
+    return sizes;
+}
+
+int main(int argc, char *argv[]) {
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QApplication app(argc, argv);
+    QApplication::setApplicationName("kpad_bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("KPad editor benchmarks");
+    parser.addHelpOption();
+    QCommandLineOption suiteOption("suite", "Suite to run: find, decode, format, html, editor, theme, or all.", "name", "all");
+    QCommandLineOption sizesOption("sizes", "Corpus sizes in MB (millions of characters).", "list", "10,100,1000");
+    QCommandLineOption limitOption("document-limit", "Largest corpus (MB) run through the Qt baselines.", "MB", "100");
+    QCommandLineOption patternOption("pattern", "Find pattern.", "text");
+    QCommandLineOption repeatsOption("repeats", "Best-of-N timing.", "N", "3");
+    QCommandLineOption jsonOption("json", "Also write the results as JSON to this file.", "file");
+    QCommandLineOption labelOption("label", "Label stored in the JSON report (a commit hash, say).", "text");
+    parser.addOptions({suiteOption, sizesOption, limitOption, patternOption, repeatsOption,
+                       jsonOption, labelOption});
+    parser.process(app);
+
+    KpadBenchOptions options;
+    options.sizesMB = parseSizes(parser.value(sizesOption));
+    options.documentLimitMB = parser.value(limitOption).toLongLong();
+    options.pattern = parser.value(patternOption);
+    options.repeats = qMax(1, parser.value(repeatsOption).toInt());
+
+    const QString suite = parser.value(suiteOption);
+    if (suite == "find" || suite == "all")
+        runFindBenchmark(options);
+    if (suite == "decode" || suite == "all")
+        runDecodeBenchmark(options);
+    if (suite == "format" || suite == "all")
+        runFormatBenchmark(options);
+    if (suite == "html" || suite == "all")
+        runHtmlBenchmark(options);
+    if (suite == "editor" || suite == "all")
+        runEditorBenchmark(options);
+    if (suite == "theme" || suite == "all")
+        runThemeBenchmark(options);
+
+    if (parser.isSet(jsonOption)) {
+        QString errorString;
+        if (!writeReport(parser.value(jsonOption), parser.value(labelOption), &errorString)) {
+            kpadBenchOut() << "Cannot write " << parser.value(jsonOption) << ": " << errorString << Qt::endl;
+            return 1;
+        }
+        kpadBenchOut() << "Wrote " << benchResults().size() << " results to " << parser.value(jsonOption)
+                       << Qt::endl;
+    }
+
+    kpadBenchOut().flush();
+    return 0;
+}
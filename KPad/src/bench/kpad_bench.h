@@ -0,0 +1,54 @@
+#ifndef KPAD_BENCH_H
+#define KPAD_BENCH_H
+
+#include <QString>
+#include <QList>
+#include <QTextStream>
+#include <QElapsedTimer>
+#include <QJsonObject>
+
+// Settings shared by all benchmark suites
+struct KpadBenchOptions
+{
+    QList<qint64> sizesMB;          // corpus sizes, in millions of characters
+    qint64 documentLimitMB = 100;   // largest corpus run through the Qt baselines
+    QString pattern;                // find pattern (empty = suite default)
+    int repeats = 3;                // best-of-N timing
+};
+
+// Deterministic prose-like text: words, spaces and ~80-column lines.
+// The word "quixotic" is planted about every 64K characters so searches
+// have a steady, rare hit rate.
+QString kpadBenchCorpus(qint64 chars, quint32 seed = 1);
+
+// Best wall time of repeats runs, in nanoseconds
+template <typename Fn>
+qint64 kpadBenchBestOf(int repeats, Fn &&run) {
+    qint64 best = -1;
+    for (int i = 0; i < repeats; ++i) {
+        QElapsedTimer timer;
+        timer.start();
+        run();
+        const qint64 ns = timer.nsecsElapsed();
+        if (best < 0 || ns < best)
+            best = ns;
+    }
+    return best;
+}
+
+QTextStream &kpadBenchOut();
+
+// Adds one result to the report written with --json. chars is the corpus
+// size; extra carries suite-specific numbers (matches, bytes, ...).
+void kpadBenchRecord(const QString &suite, const QString &name, qint64 chars, qint64 ns,
+                     const QJsonObject &extra = QJsonObject());
+
+// Suites
+void runFindBenchmark(const KpadBenchOptions &options);
+void runDecodeBenchmark(const KpadBenchOptions &options);
+void runFormatBenchmark(const KpadBenchOptions &options);
+void runHtmlBenchmark(const KpadBenchOptions &options);
+void runEditorBenchmark(const KpadBenchOptions &options);
+void runThemeBenchmark(const KpadBenchOptions &options);
+
+#endif // KPAD_BENCH_H
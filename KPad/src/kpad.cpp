@@ -1,5 +1,17 @@
 #include "kpad.h"
 #include "ui_kpad.h"
+#include "kpad_highlight.h"
+#include "kpad_loader.h"
+#include "kpad_saver.h"
+#include "kpad_largeview.h"
+#include "kpad_journal.h"
+#include "kpad_tab.h"
+#include "kpad_metrics.h"
+
+#include <utility>
+
+// How long closing the window waits for a cancelled search to stop
+static const int kFindExitWaitMsecs = 1000;
 
 Kpad::Kpad(QWidget *parent)
     : QMainWindow(parent)
@@ -10,20 +22,67 @@ Kpad::Kpad(QWidget *parent)
     setWindowIcon(QIcon(":/icons/KpadIcon.ico"));
     resize(770, 700);
     setWindowTitle("KPad+");
-    setCentralWidget(textEdit);
+    // Huge files are shown in a read-only viewer in place of the editor
+    largeView = new KpadLargeFileView(this);
+    centralStack = new QStackedWidget(this);
+    centralStack->addWidget(textEdit);
+    centralStack->addWidget(largeView);
+    // Open documents are tabs above the editor
+    tabBar = new QTabBar(this);
+    tabBar->setDocumentMode(true);
+    tabBar->setTabsClosable(true);
+    tabBar->setExpanding(false);
+    QWidget *central = new QWidget(this);
+    QVBoxLayout *centralLayout = new QVBoxLayout(central);
+    centralLayout->setContentsMargins(0, 0, 0, 0);
+    centralLayout->setSpacing(0);
+    centralLayout->addWidget(tabBar);
+    centralLayout->addWidget(centralStack);
+    setCentralWidget(central);
 
     // (for Dark mode):
-    // Store all original icons ONCE at startup
-    QList<QAction*> allActions = findChildren<QAction*>();
-    for (QAction *action : allActions) {
-        if (!action->icon().isNull()) {
-            originalIcons[action] = action->icon(); // Save the original
-        }
-    }
+    // The original icons are the light set; the dark one is built once,
+    // when the event loop is first idle
+    theme.addActions(findChildren<QAction*>());
+    QTimer::singleShot(0, this, [=]() { theme.prepare(); });
 
     textEdit->installEventFilter(this);
     textEdit->viewport()->installEventFilter(this);
     textEdit->setTabChangesFocus(false);
+    // Documents belong to their tabs, not to the editor
+    textEdit->setDocument(createDocument());
+    highlighter = new KpadHighlighter(textEdit);
+
+    // Saves run in the background
+    fileSaver = new KpadFileSaver(this);
+    connect(fileSaver, &KpadFileSaver::finished, this, &Kpad::saveFinished);
+
+    // Keep the piece table, word counts and find matches in step with every edit
+    connectDocument(textEdit->document());
+
+    // Edits are journaled as they happen; a crash loses at most a second of typing
+    journal = new KpadJournal(this);
+    journalTimer = new QTimer(this);
+    journalTimer->setSingleShot(true);
+    journalTimer->setInterval(1000);
+    connect(journalTimer, &QTimer::timeout, this, &Kpad::flushJournal);
+
+    // The first tab is the document the editor starts with
+    KpadTab *firstTab = new KpadTab;
+    firstTab->document = textEdit->document();
+    firstTab->journal = journal;
+    tabs.append(firstTab);
+    tabBar->addTab("Untitled");
+    activeTab = 0;
+    connect(tabBar, &QTabBar::currentChanged, this, &Kpad::switchTab);
+    connect(tabBar, &QTabBar::tabCloseRequested, this, &Kpad::closeTab);
+    connect(this, &QWidget::windowTitleChanged, this, &Kpad::updateTabTitle);
+    tabIdleTimer = new QTimer(this);
+    tabIdleTimer->setInterval(60 * 1000);
+    connect(tabIdleTimer, &QTimer::timeout, this, &Kpad::unloadIdleTabs);
+    tabIdleTimer->start();
+    startJournal(false);
+    QTimer::singleShot(0, this, &Kpad::recoverJournal);
 
     // ----------------  Font Size ComboBox ----------------
     fontSizeBox = new QComboBox(this);
@@ -86,7 +145,8 @@ Kpad::Kpad(QWidget *parent)
 
     // ----- Connect Actions -----
     // File menu
-    // connect(ui->actionCode, &QAction::triggered, this, &Kpad::switchToCodeEditor);
+    ui->actionCode->setCheckable(true);
+    connect(ui->actionCode, &QAction::triggered, this, &Kpad::switchToCodeEditor);
     connect(ui->actionNewDocument, &QAction::triggered, this, &Kpad::newDocument);
     connect(ui->actionOpen, &QAction::triggered, this, &Kpad::open);
     connect(ui->actionSave, &QAction::triggered, this, &Kpad::save);
@@ -98,9 +158,25 @@ Kpad::Kpad(QWidget *parent)
     // Edit actions
     connect(ui->actionCut, &QAction::triggered, textEdit, &QTextEdit::cut);
     connect(ui->actionCopy, &QAction::triggered, textEdit, &QTextEdit::copy);
-    connect(ui->actionPaste, &QAction::triggered, textEdit, &QTextEdit::paste);
-    connect(ui->actionUndo, &QAction::triggered, textEdit, &QTextEdit::undo);
-    connect(ui->actionRedo, &QAction::triggered, textEdit, &QTextEdit::redo);
+    connect(ui->actionPaste, &QAction::triggered, this, [=]() {
+        useFormatUndoFor(QApplication::clipboard()->mimeData());
+        textEdit->paste();
+    });
+    connect(ui->actionUndo, &QAction::triggered, this, &Kpad::undo);
+    connect(ui->actionRedo, &QAction::triggered, this, &Kpad::redo);
+    QAction *undoLimitAction = ui->menuEdit->addAction("Undo Memory Limit...");
+    connect(undoLimitAction, &QAction::triggered, this, &Kpad::setUndoLimit);
+
+    // Go to line (editor and large-file viewer)
+    QAction *goToLineAction = ui->menuEdit->addAction("Go to Line...");
+    goToLineAction->setShortcut(QKeySequence("Ctrl+G"));
+    connect(goToLineAction, &QAction::triggered, this, &Kpad::goToLine);
+
+    // Find in Files (a dock, hidden until asked for)
+    createFindInFiles();
+    QAction *findFilesAction = ui->menuEdit->addAction("Find in Files...");
+    findFilesAction->setShortcut(QKeySequence("Ctrl+Shift+F"));
+    connect(findFilesAction, &QAction::triggered, this, &Kpad::showFindInFiles);
 
     // Formatting
     connect(ui->actionIncrease_Font, &QAction::triggered, this, &Kpad::increaseFontSize);
@@ -148,6 +224,7 @@ Kpad::Kpad(QWidget *parent)
 
     // Font size and family ComboBox changes
     auto applyFont = [=](const QFont &f) {
+        useFormatUndo();
         QTextCursor cursor = textEdit->textCursor();
         QTextCharFormat format = cursor.charFormat();
         format.setFont(f);
@@ -169,6 +246,7 @@ Kpad::Kpad(QWidget *parent)
 
     // Font family change
     connect(fontFamilyBox, &QFontComboBox::currentFontChanged, this, [=](const QFont &font) {
+        useFormatUndo();
         QTextCursor cursor = textEdit->textCursor();
         QTextCharFormat format;
 
@@ -195,9 +273,36 @@ Kpad::Kpad(QWidget *parent)
     charCountLabel = new QLabel(this);
     statusBar()->addPermanentWidget(wordCountLabel);
     statusBar()->addPermanentWidget(charCountLabel);
-    updateCounts();
-    connect(textEdit, &QTextEdit::textChanged, this, &Kpad::updateCounts);
+    encodingLabel = new QLabel(fileFormat.name(), this);
+    statusBar()->addPermanentWidget(encodingLabel);
+    // Counts are kept per block and only the edited blocks are recounted
+    wordTally = std::make_shared<KpadWordTally>();
     connect(textEdit, &QTextEdit::cursorPositionChanged, this, &Kpad::updateCounts);
+    connect(textEdit, &QTextEdit::selectionChanged, this, &Kpad::updateCounts);
+    updateCounts();
+
+    // ----- Load Progress (large files) -----
+    loadProgress = new QProgressBar(this);
+    loadProgress->setRange(0, 1000);
+    loadProgress->setMaximumWidth(150);
+    loadProgress->setTextVisible(false);
+    loadProgress->hide();
+    cancelLoadButton = new QPushButton("Cancel", this);
+    cancelLoadButton->setFlat(true);
+    cancelLoadButton->setToolTip("Stop loading the file");
+    cancelLoadButton->hide();
+    statusBar()->addPermanentWidget(loadProgress);
+    statusBar()->addPermanentWidget(cancelLoadButton);
+    connect(cancelLoadButton, &QPushButton::clicked, this, &Kpad::cancelStreamingLoad);
+
+    // Indexing progress of the large-file viewer
+    connect(largeView, &KpadLargeFileView::indexProgress, this, [=](qint64 done, qint64 total) {
+        if (total > 0)
+            loadProgress->setValue(int(done * 1000 / total));
+        updateCounts();
+    });
+    connect(largeView, &KpadLargeFileView::indexFinished, this, &Kpad::largeFileIndexed);
+    connect(largeView, &KpadLargeFileView::findFinished, this, &Kpad::largeFindFinished);
 
     // ----- Find Box -----
     findBox = new QLineEdit(this);
@@ -205,11 +310,95 @@ Kpad::Kpad(QWidget *parent)
     findBox->setMaximumWidth(150);
     statusBar()->addPermanentWidget(findBox);
 
+    // Match navigation
+    findCountLabel = new QLabel(this);
+    findPrevButton = new QPushButton(QString(QChar(0x25B2)), this);
+    findPrevButton->setFlat(true);
+    findPrevButton->setToolTip("Previous match (Shift+F3)");
+    findPrevButton->setMaximumWidth(30);
+    findNextButton = new QPushButton(QString(QChar(0x25BC)), this);
+    findNextButton->setFlat(true);
+    findNextButton->setToolTip("Next match (F3)");
+    findNextButton->setMaximumWidth(30);
+    statusBar()->addPermanentWidget(findCountLabel);
+    statusBar()->addPermanentWidget(findPrevButton);
+    statusBar()->addPermanentWidget(findNextButton);
+    connect(findPrevButton, &QPushButton::clicked, this, &Kpad::findPrevious);
+    connect(findNextButton, &QPushButton::clicked, this, &Kpad::findNext);
+    connect(findBox, &QLineEdit::returnPressed, this, &Kpad::findNext);
+
+    // Regex mode toggle
+    regexButton = new QPushButton(".*", this);
+    regexButton->setFlat(true);
+    regexButton->setCheckable(true);
+    regexButton->setToolTip("Regular expression");
+    regexButton->setMaximumWidth(30);
+    statusBar()->addPermanentWidget(regexButton);
+
+    // ----- Replace -----
+    replaceBox = new QLineEdit(this);
+    replaceBox->setPlaceholderText("Replace...");
+    replaceBox->setMaximumWidth(150);
+    replaceButton = new QPushButton("Replace", this);
+    replaceButton->setFlat(true);
+    replaceButton->setToolTip("Replace this match and find the next");
+    replaceAllButton = new QPushButton("All", this);
+    replaceAllButton->setFlat(true);
+    replaceAllButton->setToolTip("Replace every match (one undo step)");
+    statusBar()->addPermanentWidget(replaceBox);
+    statusBar()->addPermanentWidget(replaceButton);
+    statusBar()->addPermanentWidget(replaceAllButton);
+    connect(replaceButton, &QPushButton::clicked, this, &Kpad::replaceNext);
+    connect(replaceAllButton, &QPushButton::clicked, this, &Kpad::replaceAll);
+    connect(replaceBox, &QLineEdit::returnPressed, this, &Kpad::replaceNext);
+    QAction *replaceAction = ui->menuEdit->addAction("Replace...");
+    replaceAction->setShortcut(QKeySequence("Ctrl+H"));
+    connect(replaceAction, &QAction::triggered, this, [=]() {
+        replaceBox->setFocus();
+        replaceBox->selectAll();
+    });
+
     // ----- Highlight format -----
     highlightFormat.setBackground(Qt::gray);
     highlightFormat.setForeground(Qt::black);
     connect(findBox, &QLineEdit::textChanged, this, &Kpad::highlightMatches);
 
+    // Matches are searched in the background and painted as an overlay.
+    // Searches get their own pool so an abandoned regex can't hold up
+    // anything queued on the global one. It is not a child of the window:
+    // ~Kpad must not wait on a search that is slow to notice its cancel.
+    findPool = new QThreadPool;
+    findPool->setMaxThreadCount(2);
+    connect(regexButton, &QPushButton::toggled, this, &Kpad::startFind);
+    findWatcher = new QFutureWatcher<QVector<KpadMatch>>(this);
+    connect(findWatcher, &QFutureWatcher<QVector<KpadMatch>>::finished, this, &Kpad::findFinished);
+    findTimer = new QTimer(this);
+    findTimer->setSingleShot(true);
+    findTimer->setInterval(200);
+    connect(findTimer, &QTimer::timeout, this, &Kpad::startFind);
+    connect(textEdit, &QTextEdit::cursorPositionChanged, this, &Kpad::updateFindStatus);
+    connect(textEdit->verticalScrollBar(), &QScrollBar::valueChanged, this, &Kpad::paintVisibleMatches);
+    connect(textEdit->horizontalScrollBar(), &QScrollBar::valueChanged, this, &Kpad::paintVisibleMatches);
+
+    // ----- Latency Overlay -----
+    // Handler latencies are only timed while the overlay is shown, or for
+    // the whole run with KPAD_METRICS=<file>, which gets the report on exit
+    metricsLabel = new QLabel(this);
+    metricsLabel->setToolTip("95th percentile latency per handler\n"
+                             "View > Save Latency Report... has the full histograms");
+    metricsLabel->hide();
+    statusBar()->addPermanentWidget(metricsLabel);
+    metricsTimer = new QTimer(this);
+    metricsTimer->setInterval(500);
+    connect(metricsTimer, &QTimer::timeout, this, &Kpad::updateMetricsOverlay);
+    QAction *metricsAction = ui->menuView->addAction("Latency Overlay");
+    metricsAction->setCheckable(true);
+    connect(metricsAction, &QAction::toggled, this, &Kpad::toggleMetricsOverlay);
+    QAction *metricsReportAction = ui->menuView->addAction("Save Latency Report...");
+    connect(metricsReportAction, &QAction::triggered, this, &Kpad::saveMetricsReport);
+    metricsReportPath = qEnvironmentVariable("KPAD_METRICS");
+    KpadMetrics::setEnabled(!metricsReportPath.isEmpty());
+
     // ----- Lock Window Size -----
     // Create lock button for status bar
     lockButton = new QPushButton(this);
@@ -222,8 +411,26 @@ Kpad::Kpad(QWidget *parent)
     // Connect the button
     connect(lockButton, &QPushButton::toggled, this, &Kpad::toggleWindowLock);
 
+    // Bring back the document that was open when KPad+ last closed
+    restoreSession();
 }
 
 Kpad::~Kpad() {
+    if (findCancel)
+        findCancel->storeRelaxed(1);
+    if (replaceCancel)
+        replaceCancel->storeRelaxed(1);
+    // A search still running past this only holds its own copies; it is
+    // left to the process exit
+    if (findPool->waitForDone(kFindExitWaitMsecs))
+        delete findPool;
+    delete fileLoader;  // waits for the loader thread
+    delete htmlLoader;
+    for (const KpadTab *tab : std::as_const(tabs)) {
+        delete tab->fileLoader;
+        delete tab->htmlLoader;
+    }
+    delete fileSaver;   // lets a running save finish
+    qDeleteAll(tabs);   // their documents and journals are children of this window
     delete ui;
 }
@@ -30,8 +30,39 @@
 #include <QDebug>
 #include <QProcess>
 #include <QCloseEvent>
+#include <QContextMenuEvent>
 #include <QColorDialog>
 #include <QMap>
+#include <QProgressBar>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QTimer>
+#include <QThreadPool>
+#include <QScrollBar>
+#include <QStackedWidget>
+#include <QTabBar>
+#include <QVBoxLayout>
+#include <QDockWidget>
+#include <QListView>
+#include <QCheckBox>
+#include <QMimeData>
+#include <memory>
+
+#include "kpad_piecetable.h"
+#include "kpad_counter.h"
+#include "kpad_search.h"
+#include "kpad_encoding.h"
+#include "kpad_filesearch.h"
+#include "kpad_theme.h"
+
+class KpadFileLoader;
+class KpadHtmlLoader;
+class KpadFileSaver;
+class KpadLargeFileView;
+class KpadJournal;
+class KpadHighlighter;
+struct KpadTab;
+struct KpadSaveResult;
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class Kpad; }
@@ -40,6 +71,8 @@ QT_END_NAMESPACE
 class Kpad : public QMainWindow
 {
     Q_OBJECT
+    friend struct KpadEditorBench;  // bench/bench_editor.cpp drives the private code paths
+    friend struct KpadThemeBench;   // bench/bench_theme.cpp
 
 public:
     explicit Kpad(QWidget *parent = nullptr);
@@ -54,6 +87,16 @@ private slots:
     void saveAsHTML();
     void exit();
     bool saveFile(const QString &filePath, QTextEdit *editor);
+    void cancelStreamingLoad();                     // Cancel button on the load progress bar
+    void switchToCodeEditor();                      // Toggles code mode
+    void goToLine();
+    void undo();                                    // Edit > Undo; see KpadUndoStack
+    void redo();
+    void setUndoLimit();
+    void undoHistoryTrimmed();                      // Qt's undo stack went past the limit
+    void showEditorMenu(QContextMenuEvent *event);  // the editor's context menu
+    void useFormatUndo();                           // before a format change
+    void useFormatUndoFor(const QMimeData *mime);   // before a paste or drop
 
     // About Dialog
     void showAbout();
@@ -80,7 +123,6 @@ private slots:
     void highlightMatches(const QString &pattern);  // Find Text Box
     void toggleWindowLock(bool locked);
     void toggleTheme();
-    void updateIconColors();                        // for icon color changes in dark mode
 
 
 protected:
@@ -104,15 +146,143 @@ private:
     QLineEdit *findLineEdit;
     QPushButton *findNextButton;
     QPushButton *findPrevButton;
-    QTextCursor lastCursor;         // remember last match for navigation
+    QLabel *findCountLabel;         // "i of N" next to the find box
     QString lastBulletChar = "";    // For automatic bullet points
     QToolButton *lockSizeButton;    // For Window Size Lock
     QSize lockedSize;
     QPushButton *lockButton;
-    QMap<QAction*, QIcon> originalIcons; // Store original icons
+    KpadTheme theme;                // Light and dark palettes and icon sets
+    KpadFileLoader *fileLoader = nullptr; // Active tab's streaming load (large files)
+    KpadHtmlLoader *htmlLoader = nullptr; // Active tab's HTML import (large HTML files)
+    QProgressBar *loadProgress;     // Load progress in the status bar
+    QPushButton *cancelLoadButton;
+    QElapsedTimer loadTimer;
+    KpadPieceTable pieceTable;      // Plain-text mirror of the document
+    bool pieceTableActive = true;   // false for rich (HTML) documents
+    bool pieceTableSyncBlocked = false;
+    KpadFileSaver *fileSaver;       // Background, atomic save pipeline
+    QString savingFile;             // Target of the newest save still running
+    std::shared_ptr<KpadWordTally> wordTally;   // Word total of the current document
+    QString findPattern;            // Current find box text
+    QVector<KpadMatch> findMatches; // Sorted match index for the find box
+    QFutureWatcher<QVector<KpadMatch>> *findWatcher;
+    std::shared_ptr<QAtomicInt> findCancel;     // Cancels the running search
+    QTimer *findTimer;              // Re-search after edits (debounced)
+    QThreadPool *findPool;          // Worker threads for find
+    QPushButton *regexButton;       // Regex mode toggle next to the find box
+    QRegularExpression findRegex;   // Compiled once per pattern
+    QLineEdit *replaceBox;          // Replacement for the find box's matches
+    QPushButton *replaceButton;
+    QPushButton *replaceAllButton;
+    std::shared_ptr<QAtomicInt> replaceCancel;  // Cancels the running Replace All search
+    bool replacingAll = false;      // Replace All's edits are going in; the index waits
+    QStackedWidget *centralStack;   // Editor, or the viewer for huge files
+    KpadLargeFileView *largeView;   // Read-only viewer for huge files
+    KpadTextFormat fileFormat = KpadTextFormat::platformDefault();  // Encoding, BOM and line endings of currentFile
+    QLabel *encodingLabel;          // Shows fileFormat
+    KpadJournal *journal;           // Autosave journal of the current document
+    QTimer *journalTimer;           // Flushes the journal while typing
+    QTabBar *tabBar;                // One tab per open document
+    QVector<KpadTab *> tabs;        // In tab bar order
+    int activeTab = -1;             // Its state lives in the members above
+    QTimer *tabIdleTimer;           // Unloads tabs left alone for a while
+    KpadHighlighter *highlighter;   // Syntax colouring in code mode
+    bool codeMode = false;
+    QLabel *metricsLabel;           // Latency overlay in the status bar
+    QTimer *metricsTimer;           // Refreshes it while it is shown
+    QString metricsReportPath;      // KPAD_METRICS=<file>: report written on exit
+    QElapsedTimer saveTimer;        // writeDocument() to saveFinished()
+    bool tracingPaint = false;      // editor paint event is being re-delivered
+    QDockWidget *findFilesDock;     // Find in Files panel
+    QLineEdit *findFilesFolder;
+    QLineEdit *findFilesPattern;
+    QLineEdit *findFilesFilter;     // file name patterns, e.g. "*.txt *.md"
+    QCheckBox *findFilesRegex;
+    QCheckBox *findFilesCase;
+    QPushButton *findFilesButton;   // Search, or Stop while searching
+    QLabel *findFilesStatus;
+    QListView *findFilesList;
+    KpadFileSearch *fileSearch;
+    KpadFileHitModel *fileHits;
+    KpadFileHit pendingJump;        // hit to show once its file has loaded
 
     bool maybeSave();               // Helper function to handle save logic
     bool hasUnsavedChanges();       // Check if document has unsaved changes
+    void loadFile(const QString &fileName);
+    void startStreamingLoad(const QString &fileName);
+    void appendLoadedChunk(const QString &text);
+    void finishStreamingLoad(bool ok, const QString &errorString);
+    void startHtmlLoad(const QString &fileName);
+    void finishHtmlLoad(bool ok, const QString &errorString);
+    void finishBackgroundLoad(KpadTab *tab, bool ok, const QString &errorString);
+    void restoreLoadCursor();
+    void clearFailedLoad();
+    void setLoadingState(bool loading);
+    void openLargeFile(const QString &fileName);
+    void closeLargeFile();
+    void setViewerMode(bool viewing);
+    void setFileFormat(const KpadTextFormat &format);
+    void startJournal(bool matchesFile);
+    void flushJournal();
+    void recoverJournal();
+    void saveSession();
+    void restoreSession();
+    bool restoreSnapshot(const QString &path);
+    QTextDocument *createDocument();
+    void connectDocument(QTextDocument *doc);
+    void replaceDocument(QTextDocument *doc, std::shared_ptr<KpadWordTally> tally);
+    void updateCodeGrammar();
+    KpadTab *newTab();
+    void setActiveTab(int index);
+    void switchTab(int index);
+    void stashTab(KpadTab *tab);
+    void activateTab(KpadTab *tab);
+    void loadTab(KpadTab *tab);
+    void closeTab(int index);
+    void removeTab(int index);
+    bool isBlankTab() const;
+    KpadTab *tabForDocument(const QTextDocument *doc) const;
+    KpadTab *tabForLoader(const QObject *loader) const;
+    void updateTabTitle();
+    void unloadTab(KpadTab *tab);
+    void unloadIdleTabs();
+    void indentBlocks(bool outdent);
+    void largeFileIndexed(qint64 lines);
+    void largeFindFinished(bool found, qint64 line);
+    void resetPieceTable(const QString &text, bool active);
+    void syncPieceTable(int position, int charsRemoved, int charsAdded);
+    KpadTextSnapshot documentSnapshot() const;
+    QString documentText(int pos, int length) const;
+    void writeDocument(const QString &fileName);
+    void saveFinished(const KpadSaveResult &result);
+    void countChangedBlocks(int position, int charsRemoved, int charsAdded);
+    void countBlocks(QTextDocument *doc, const std::shared_ptr<KpadWordTally> &tally, int position, int length);
+    int blockWords(QTextBlock block);
+    void startFind();
+    bool compileFindRegex();
+    void setFindBoxError(const QString &error);
+    void findFinished();
+    void shiftMatches(int position, int charsRemoved, int charsAdded);
+    void paintVisibleMatches();
+    void findNext();
+    void findPrevious();
+    void replaceNext();
+    void replaceAll();
+    void applyReplaceAll(const KpadTextSnapshot &snapshot, const QVector<KpadMatch> &matches,
+                         const QRegularExpression &regex, const QString &replacement, bool expand,
+                         const QElapsedTimer &timer);
+    void selectMatch(const KpadMatch &match);
+    void updateFindStatus();
+    void toggleMetricsOverlay(bool shown);
+    void updateMetricsOverlay();
+    void saveMetricsReport();
+    void openPath(const QString &fileName);
+    void createFindInFiles();
+    void showFindInFiles();
+    void startFileSearch();
+    void fileSearchFinished(qint64 files, qint64 hits, bool truncated, qint64 msecs);
+    void openFileHit(const QModelIndex &index);
+    void applyPendingJump();
     bool darkMode = false;
     bool lastAutoBullet = false;    // For automatic bullet points
     bool isWindowLocked;
@@ -0,0 +1,240 @@
+#include "kpad_batch.h"
+#include "kpad_counter.h"
+#include "kpad_html.h"
+#include "kpad_piecetable.h"
+#include "kpad_search.h"
+
+#include <QCommandLineParser>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QSet>
+#include <QTextStream>
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrent>
+#include <functional>
+#include <numeric>
+
+// --------------------
+// One file
+// --------------------
+KpadBatchResult KpadBatch::processFile(const QString &filePath, const QString &htmlPath,
+                                       const KpadBatchOptions &options, const QRegularExpression &re) {
+    KpadBatchResult result;
+    result.filePath = filePath;
+    QElapsedTimer timer;
+    timer.start();
+
+    // Load: mapped, detected and decoded as the editor does it
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        result.errorString = file.errorString();
+        return result;
+    }
+    result.bytes = file.size();
+    if (result.bytes > kMaxFileBytes) {
+        result.errorString = QString("Larger than %1 MB").arg(kMaxFileBytes >> 20);
+        return result;
+    }
+    QString text;
+    if (result.bytes > 0) {
+        const uchar *mapped = file.map(0, result.bytes);
+        QByteArray bytes;
+        if (!mapped)
+            bytes = file.readAll();
+        const char *data = mapped ? reinterpret_cast<const char *>(mapped) : bytes.constData();
+        result.format = KpadEncoding::detect(data, result.bytes);
+        const int bomSize = result.format.bomBytes().size();
+        KpadTextDecoder decoder(result.format.encoding);
+        text = decoder.decode(data + bomSize, result.bytes - bomSize);
+        text += decoder.flush();
+        if (mapped)
+            file.unmap(const_cast<uchar *>(mapped));
+    } else {
+        result.format = KpadTextFormat::platformDefault();
+    }
+    file.close();
+    text.replace(QLatin1String("\r\n"), QLatin1String("\n"));
+
+    // Count: the status bar's numbers for the whole document
+    if (options.count) {
+        result.chars = text.size();
+        result.words = kpadCountWords(text.constData(), text.size());
+        result.lines = text.count(QLatin1Char('\n')) + 1;
+    }
+
+    // Find: the find box's search
+    if (!options.findPattern.isEmpty()) {
+        const KpadTextSnapshot snapshot = KpadTextSnapshot::fromString(text);
+        result.matches = options.findRegex
+            ? KpadSearch::findRegex(snapshot, re).size()
+            : KpadSearch::findLiteral(snapshot, options.findPattern, options.findCase).size();
+    }
+
+    // Export: what Save as HTML writes for a plain document
+    if (!options.htmlDir.isEmpty()) {
+        result.htmlPath = htmlPath;
+        const KpadHtmlExportResult html = KpadHtmlExporter::writePlainText(text, QFileInfo(filePath).fileName(),
+                                                                           result.htmlPath);
+        if (!html.ok) {
+            result.errorString = "Cannot write " + result.htmlPath + ": " + html.errorString;
+            return result;
+        }
+    }
+
+    result.ok = true;
+    result.msecs = timer.elapsed();
+    return result;
+}
+
+// --------------------
+// Command line
+// --------------------
+static QString resultLine(const KpadBatchResult &r, const KpadBatchOptions &options) {
+    QStringList fields;
+    fields << r.filePath;
+    if (!r.ok) {
+        fields << "error" << r.errorString;
+        return fields.join('\t');
+    }
+    fields << r.format.name();
+    if (options.count)
+        fields << QString::number(r.words) << QString::number(r.chars) << QString::number(r.lines);
+    if (!options.findPattern.isEmpty())
+        fields << QString::number(r.matches);
+    if (!options.htmlDir.isEmpty())
+        fields << r.htmlPath;
+    fields << QString::number(r.msecs);
+    return fields.join('\t');
+}
+
+// One output file per input: <file name>.html, so a.txt and a.md do not
+// collide, and " (2)", " (3)", ... for the same name from another folder.
+// Compared without case, as some file systems do.
+static QStringList htmlPaths(const QStringList &files, const QString &htmlDir) {
+    QStringList paths;
+    QSet<QString> taken;
+    const QDir dir(htmlDir);
+    for (const QString &file : files) {
+        const QString name = QFileInfo(file).fileName();
+        QString candidate = name + ".html";
+        for (int n = 2; taken.contains(candidate.toLower()); ++n)
+            candidate = QString("%1 (%2).html").arg(name).arg(n);
+        taken.insert(candidate.toLower());
+        paths << dir.filePath(candidate);
+    }
+    return paths;
+}
+
+static QString headerLine(const KpadBatchOptions &options) {
+    QStringList fields;
+    fields << "file" << "encoding";
+    if (options.count)
+        fields << "words" << "chars" << "lines";
+    if (!options.findPattern.isEmpty())
+        fields << "matches";
+    if (!options.htmlDir.isEmpty())
+        fields << "html";
+    fields << "ms";
+    return "# " + fields.join('\t');
+}
+
+int KpadBatch::run(const QStringList &arguments) {
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("KPad+ batch mode: count, search and convert text files without a window.");
+    parser.addHelpOption();
+    parser.addOption({"batch", "Run without a window (required)."});
+    parser.addOption({"count", "Count words, characters and lines."});
+    parser.addOption({"find", "Count matches of <pattern>.", "pattern"});
+    parser.addOption({"regex", "Treat the find pattern as a regular expression."});
+    parser.addOption({"match-case", "Case-sensitive find (the find box ignores case)."});
+    parser.addOption({"html", "Convert each file to HTML in <dir>.", "dir"});
+    parser.addOption({"jobs", "Files processed at once (default: one per core).", "n"});
+    parser.addPositionalArgument("files", "Text files to process.", "<file>...");
+    parser.process(arguments);
+
+    KpadBatchOptions options;
+    options.count = parser.isSet("count");
+    options.findPattern = parser.value("find");
+    options.findRegex = parser.isSet("regex");
+    options.findCase = parser.isSet("match-case") ? Qt::CaseSensitive : Qt::CaseInsensitive;
+    options.htmlDir = parser.value("html");
+    options.jobs = parser.value("jobs").toInt();
+    const QStringList files = parser.positionalArguments();
+
+    if (files.isEmpty() || (!options.count && options.findPattern.isEmpty() && options.htmlDir.isEmpty())) {
+        err << "Nothing to do: give files and at least one of --count, --find, --html" << Qt::endl;
+        return 2;
+    }
+
+    // Compiled once; matching with one QRegularExpression is thread-safe
+    QRegularExpression re;
+    if (options.findRegex) {
+        re = QRegularExpression(options.findPattern, options.findCase == Qt::CaseInsensitive
+                                                         ? QRegularExpression::CaseInsensitiveOption
+                                                         : QRegularExpression::NoPatternOption);
+        if (!re.isValid()) {
+            err << "Invalid regular expression: " << re.errorString() << Qt::endl;
+            return 2;
+        }
+        re.optimize();
+    }
+    if (!options.htmlDir.isEmpty() && !QDir().mkpath(options.htmlDir)) {
+        err << "Cannot create " << options.htmlDir << Qt::endl;
+        return 2;
+    }
+
+    // Output names are settled before any job starts
+    const QStringList html = options.htmlDir.isEmpty() ? QStringList() : htmlPaths(files, options.htmlDir);
+
+    // Each file is one task on the pool; results are printed in order as
+    // they complete, so output streams while later files are still running
+    const int jobs = options.jobs > 0 ? options.jobs : QThread::idealThreadCount();
+    QThreadPool::globalInstance()->setMaxThreadCount(jobs);
+    QVector<int> indexes(files.size());
+    std::iota(indexes.begin(), indexes.end(), 0);
+    std::function<KpadBatchResult(const int &)> process = [&](const int &i) {
+        return processFile(files[i], html.value(i), options, re);
+    };
+
+    QElapsedTimer timer;
+    timer.start();
+    QFuture<KpadBatchResult> future = QtConcurrent::mapped(indexes, process);
+
+    out << headerLine(options) << Qt::endl;
+    int failed = 0;
+    qint64 bytes = 0;
+    qint64 words = 0;
+    qint64 matches = 0;
+    for (int i = 0; i < files.size(); ++i) {
+        const KpadBatchResult result = future.resultAt(i);
+        out << resultLine(result, options) << Qt::endl;
+        if (!result.ok) {
+            ++failed;
+            continue;
+        }
+        bytes += result.bytes;
+        words += result.words;
+        matches += qMax<qint64>(result.matches, 0);
+    }
+
+    const qint64 msecs = qMax<qint64>(timer.elapsed(), 1);
+    QString summary = QString("%1 files (%2 failed), %3 MB in %4 ms on %5 threads, %6 MB/s")
+                          .arg(files.size())
+                          .arg(failed)
+                          .arg(bytes / (1024.0 * 1024.0), 0, 'f', 1)
+                          .arg(msecs)
+                          .arg(jobs)
+                          .arg(bytes / (1024.0 * 1024.0) / (msecs / 1000.0), 0, 'f', 1);
+    if (options.count)
+        summary += QString(", %1 words").arg(words);
+    if (!options.findPattern.isEmpty())
+        summary += QString(", %1 matches").arg(matches);
+    err << summary << Qt::endl;
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,57 @@
+#ifndef KPAD_BATCH_H
+#define KPAD_BATCH_H
+
+#include <QRegularExpression>
+#include <QString>
+#include <QStringList>
+
+#include "kpad_encoding.h"
+
+// What to do with every file of a batch run
+struct KpadBatchOptions
+{
+    bool count = false;             // words, characters and lines
+    QString findPattern;            // count matches of this, if set
+    bool findRegex = false;
+    Qt::CaseSensitivity findCase = Qt::CaseInsensitive;  // as the find box
+    QString htmlDir;                // write <file name>.html here, if set
+    int jobs = 0;                   // worker threads; 0 = one per core
+};
+
+struct KpadBatchResult
+{
+    QString filePath;
+    bool ok = false;
+    QString errorString;
+    KpadTextFormat format;          // as detected on load
+    qint64 bytes = 0;               // file size
+    qint64 chars = 0;
+    qint64 words = 0;
+    qint64 lines = 0;
+    qint64 matches = -1;            // -1 when not searched
+    QString htmlPath;
+    qint64 msecs = 0;
+};
+
+// kpad --batch: the editor's load, count, find and HTML export code, run
+// over many files on a thread pool without creating a single widget.
+// Files are decoded the way the editor loads plain text (encoding
+// detection, CRLF folded to LF), so the numbers match its status bar.
+// One tab-separated line per file goes to stdout, in argument order, as
+// soon as that file and all before it are done; a summary goes to stderr.
+class KpadBatch
+{
+public:
+    // arguments as from QCoreApplication::arguments(); returns the exit
+    // code: 0 if every file was processed, 1 if any failed, 2 on bad usage
+    static int run(const QStringList &arguments);
+
+    // Thread-safe; re must be valid when options.findRegex is set, and
+    // htmlPath (in options.htmlDir) is written when that is set
+    static KpadBatchResult processFile(const QString &filePath, const QString &htmlPath,
+                                       const KpadBatchOptions &options, const QRegularExpression &re);
+
+    static constexpr qint64 kMaxFileBytes = qint64(1) << 30;  // document offsets are ints
+};
+
+#endif // KPAD_BATCH_H
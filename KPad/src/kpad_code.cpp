@@ -0,0 +1,46 @@
+#include "kpad.h"
+#include "ui_kpad.h"
+#include "kpad_highlight.h"
+
+// --------------------
+// Code Mode
+// --------------------
+// Syntax colouring picked by the file's suffix (see KpadGrammarRegistry).
+// The colours are layout formats, not char formats: they are never saved,
+// exported or undone, and turning code mode off takes them away again.
+void Kpad::switchToCodeEditor() {
+    codeMode = !codeMode;
+    ui->actionCode->setChecked(codeMode);
+    textEdit->setLineWrapMode(codeMode ? QTextEdit::NoWrap : QTextEdit::WidgetWidth);
+
+    if (!codeMode) {
+        highlighter->setGrammar(nullptr);
+        statusBar()->showMessage("Code mode off", 3000);
+        return;
+    }
+    updateCodeGrammar();
+    const std::shared_ptr<const KpadGrammar> grammar = highlighter->grammar();
+    if (grammar) {
+        statusBar()->showMessage("Code mode: " + grammar->name(), 3000);
+    } else {
+        const QString suffix = QFileInfo(currentFile).suffix();
+        statusBar()->showMessage(suffix.isEmpty() ? QString("Code mode: no grammar for untitled documents")
+                                                  : "Code mode: no grammar for ." + suffix + " files", 3000);
+    }
+
+    const QStringList errors = KpadGrammarRegistry::loadErrors();
+    if (!errors.isEmpty())
+        QMessageBox::warning(this, "Warning", "Some grammar files were skipped:\n" + errors.join('\n'));
+}
+
+// Follows the document in the editor and its file name
+void Kpad::updateCodeGrammar() {
+    if (!codeMode)
+        return;
+
+    const std::shared_ptr<const KpadGrammar> grammar = KpadGrammarRegistry::forFile(currentFile);
+    if (grammar != highlighter->grammar())
+        highlighter->setGrammar(grammar);
+    else
+        highlighter->documentReplaced();
+}
@@ -0,0 +1,27 @@
+#include "kpad_counter.h"
+
+KpadBlockData::KpadBlockData(std::shared_ptr<KpadWordTally> tally)
+    : tally(std::move(tally))
+{
+}
+
+KpadBlockData::~KpadBlockData() {
+    tally->words -= wordCount;
+}
+
+void KpadBlockData::setWords(int count) {
+    tally->words += count - wordCount;
+    wordCount = count;
+}
+
+int kpadCountWords(const QChar *data, int length) {
+    int words = 0;
+    bool inWord = false;
+    for (int i = 0; i < length; ++i) {
+        const bool space = data[i].isSpace();
+        if (!space && !inWord)
+            ++words;
+        inWord = !space;
+    }
+    return words;
+}
@@ -0,0 +1,37 @@
+#ifndef KPAD_COUNTER_H
+#define KPAD_COUNTER_H
+
+#include <QTextBlockUserData>
+#include <QChar>
+#include <memory>
+
+// Running word total of one document
+struct KpadWordTally
+{
+    qint64 words = 0;
+};
+
+// Per-block word count, cached as the block's user data.
+// When Qt deletes a block (merge, cut, clear) its data goes with it and the
+// destructor takes the block's words back out of the document total, so the
+// total never needs a full rescan.
+class KpadBlockData : public QTextBlockUserData
+{
+public:
+    explicit KpadBlockData(std::shared_ptr<KpadWordTally> tally);
+    ~KpadBlockData() override;
+
+    void setWords(int count);       // Updates the tally by the difference
+    int words() const { return wordCount; }
+
+private:
+    std::shared_ptr<KpadWordTally> tally;
+    int wordCount = 0;
+};
+
+// Number of runs of characters that are not QChar::isSpace(). That is any
+// Unicode space (U+00A0, U+2000-U+200A, U+3000, ...), so it can count more
+// words than split("\\s+", SkipEmptyParts), whose \s is ASCII whitespace.
+int kpadCountWords(const QChar *data, int length);
+
+#endif // KPAD_COUNTER_H
@@ -0,0 +1,181 @@
+#include "kpad.h"
+#include "ui_kpad.h"
+#include "kpad_journal.h"
+#include "kpad_undo.h"
+
+#include <QApplication>
+#include <QInputDialog>
+#include <QMenu>
+
+// --------------------
+// Piece Table Mirror (plain-text documents)
+// --------------------
+// Plain-text files keep a piece table in step with the QTextDocument.
+// Save, count and search read snapshots of it instead of calling
+// toPlainText(), which would copy the whole document every time.
+
+// Plain text of document characters [pos, pos + length)
+QString Kpad::documentText(int pos, int length) const {
+    QTextCursor cursor(textEdit->document());
+    cursor.setPosition(pos);
+    cursor.setPosition(pos + length, QTextCursor::KeepAnchor);
+    QString text = cursor.selectedText();
+    KpadPieceTable::normalize(text);
+    return text;
+}
+
+void Kpad::resetPieceTable(const QString &text, bool active) {
+    pieceTableActive = active;
+    // Plain documents keep their undo history in KpadUndoStack until they
+    // are first formatted (see useFormatUndo()), rich ones in
+    // QTextDocument's own stack
+    QTextDocument *doc = textEdit->document();
+    doc->setUndoRedoEnabled(!active);
+    KpadUndoStack::of(doc)->clear();
+    if (!active) {
+        pieceTable.reset(QString());
+        return;
+    }
+
+    QString plain = text;
+    KpadPieceTable::normalize(plain);
+    pieceTable.reset(plain);
+}
+
+void Kpad::syncPieceTable(int position, int charsRemoved, int charsAdded) {
+    if (!pieceTableActive || pieceTableSyncBlocked)
+        return;
+
+    QTextDocument *doc = textEdit->document();
+    const int docLength = doc->characterCount() - 1;  // without the final separator
+
+    // contentsChange can report the final paragraph separator as well
+    const int removed = qMax(0, qMin(charsRemoved, pieceTable.length() - position));
+    const int added = qMax(0, qMin(charsAdded, docLength - position));
+    QString text = added > 0 ? documentText(position, added) : QString();
+
+    // Format-only changes report the same range as removed and added
+    const QString removedText = removed > 0 ? pieceTable.snapshot().mid(position, removed) : QString();
+    if (removed == added && removed > 0 && removedText == text)
+        return;
+
+    pieceTable.remove(position, removed);
+    pieceTable.insert(position, text);
+    KpadUndoStack::of(doc)->record(position, removedText, text);
+
+    // The same edit goes to the autosave journal
+    journal->recordEdit(position, removed, text);
+    if (!journalTimer->isActive())
+        journalTimer->start();
+
+    // Should the mirror ever drift from the document, rebuild it
+    if (pieceTable.length() != docLength) {
+        resetPieceTable(textEdit->toPlainText(), true);
+        startJournal(false);
+    }
+}
+
+KpadTextSnapshot Kpad::documentSnapshot() const {
+    if (pieceTableActive)
+        return pieceTable.snapshot();
+    return KpadTextSnapshot::fromString(textEdit->toPlainText());
+}
+
+// --------------------
+// Undo
+// --------------------
+// Plain documents undo through their KpadUndoStack, rich ones through
+// QTextDocument's stack. A plain document that has been formatted uses
+// Qt's stack for everything since, and its KpadUndoStack for what came
+// before.
+void Kpad::undo() {
+    QTextDocument *doc = textEdit->document();
+    if (textEdit->isReadOnly())
+        return;
+    if (!pieceTableActive || doc->isUndoAvailable()) {
+        textEdit->undo();
+        return;
+    }
+    const int position = KpadUndoStack::of(doc)->undo();
+    if (position >= 0) {
+        QTextCursor cursor = textEdit->textCursor();
+        cursor.setPosition(position);
+        textEdit->setTextCursor(cursor);
+        textEdit->ensureCursorVisible();
+    }
+}
+
+void Kpad::redo() {
+    QTextDocument *doc = textEdit->document();
+    if (textEdit->isReadOnly())
+        return;
+    if (!pieceTableActive || doc->isRedoAvailable()) {
+        textEdit->redo();
+        return;
+    }
+    const int position = KpadUndoStack::of(doc)->redo();
+    if (position >= 0) {
+        QTextCursor cursor = textEdit->textCursor();
+        cursor.setPosition(position);
+        textEdit->setTextCursor(cursor);
+        textEdit->ensureCursorVisible();
+    }
+}
+
+void Kpad::undoHistoryTrimmed() {
+    statusBar()->showMessage("Undo history cleared: it went past the undo memory limit", 4000);
+}
+
+// QTextEdit's own menu, with Undo and Redo going through Kpad as the keys
+// do: its actions only see QTextDocument's stack, which a plain document
+// has switched off. Paste gets the same check as Ctrl+V.
+void Kpad::showEditorMenu(QContextMenuEvent *event) {
+    QTextDocument *doc = textEdit->document();
+    const QPoint offset(textEdit->horizontalScrollBar()->value(), textEdit->verticalScrollBar()->value());
+    QMenu *menu = textEdit->createStandardContextMenu(event->pos() + offset);
+    const bool editable = !textEdit->isReadOnly();
+    KpadUndoStack *stack = KpadUndoStack::of(doc);
+    for (QAction *action : menu->actions()) {
+        const QString name = action->objectName();
+        if (name == QLatin1String("edit-undo")) {
+            disconnect(action, &QAction::triggered, nullptr, nullptr);
+            connect(action, &QAction::triggered, this, &Kpad::undo);
+            action->setEnabled(editable && (doc->isUndoAvailable() || (pieceTableActive && stack->undoCount() > 0)));
+        } else if (name == QLatin1String("edit-redo")) {
+            disconnect(action, &QAction::triggered, nullptr, nullptr);
+            connect(action, &QAction::triggered, this, &Kpad::redo);
+            action->setEnabled(editable && (doc->isRedoAvailable() || (pieceTableActive && stack->redoCount() > 0)));
+        } else if (name == QLatin1String("edit-paste")) {
+            disconnect(action, &QAction::triggered, nullptr, nullptr);
+            connect(action, &QAction::triggered, this, [this]() {
+                useFormatUndoFor(QApplication::clipboard()->mimeData());
+                textEdit->paste();
+            });
+        }
+    }
+    menu->exec(event->globalPos());
+    delete menu;
+}
+
+// Called before anything that formats the document: KpadUndoStack keeps
+// text only, so from here on QTextDocument's stack records the edits
+void Kpad::useFormatUndo() {
+    if (pieceTableActive && !textEdit->isReadOnly())
+        KpadUndoStack::of(textEdit->document())->retire();
+}
+
+// Pasted or dropped HTML brings formatting in with it
+void Kpad::useFormatUndoFor(const QMimeData *mime) {
+    if (mime && mime->hasHtml() && textEdit->acceptRichText())
+        useFormatUndo();
+}
+
+void Kpad::setUndoLimit() {
+    bool ok = false;
+    const int megabytes = QInputDialog::getInt(this, "Undo Memory Limit",
+                                               "Undo history kept in memory per document (MB);\n"
+                                               "older history is compressed to a temporary file:",
+                                               int(KpadUndoStack::memoryBudget() >> 20), 1, 4096, 1, &ok);
+    if (ok)
+        KpadUndoStack::setMemoryBudget(qint64(megabytes) << 20);
+}
@@ -1,5 +1,6 @@
 #include "kpad.h"
 #include "ui_kpad.h"
+#include "kpad_format.h"
 #include <climits>
 
 // --------------------
@@ -12,6 +13,7 @@ void Kpad::applyFont(const QString &font) {
 }
 
 void Kpad::changeFontSizeDelta(int delta) {
+    useFormatUndo();
     QTextCursor cursor = textEdit->textCursor();
     if (!cursor.hasSelection()) {
         QTextCharFormat format;
@@ -25,28 +27,9 @@ void Kpad::changeFontSizeDelta(int delta) {
         return;
     }
 
-    int start = cursor.selectionStart();
-    int end = cursor.selectionEnd();
-    QTextCursor tempCursor = textEdit->textCursor();
-
-    tempCursor.beginEditBlock();
-    tempCursor.setPosition(start);
-
-    while (tempCursor.position() < end) {
-        tempCursor.movePosition(QTextCursor::NextCharacter, QTextCursor::KeepAnchor);
-        QTextCharFormat fmt = tempCursor.charFormat();
-
-        int size = fmt.fontPointSize();
-        if (size <= 0)
-            size = textEdit->font().pointSize();
-
-        fmt.setFontPointSize(std::max(1, size + delta));
-        tempCursor.mergeCharFormat(fmt);
-
-        tempCursor.clearSelection();
-    }
-
-    tempCursor.endEditBlock();
+    // One merge per run of equal size, not per character
+    kpadScaleFontSize(textEdit->document(), cursor.selectionStart(), cursor.selectionEnd(),
+                      delta, textEdit->font().pointSize());
 
     int displaySize = textEdit->currentCharFormat().fontPointSize();
     if (displaySize <= 0)
@@ -88,6 +71,7 @@ void Kpad::setUnderline() {
 
 // Apply formatting to current selection or typing position
 void Kpad::applyFormatToSelection(const QTextCharFormat &format) {
+    useFormatUndo();
     QTextCursor cursor = textEdit->textCursor();
     if (cursor.hasSelection()) {
         cursor.mergeCharFormat(format);
@@ -99,6 +83,7 @@ void Kpad::applyFormatToSelection(const QTextCharFormat &format) {
 // Highlight text with color picker:
 void Kpad::toggleHighlight(bool enabled)
 {
+    useFormatUndo();
     QTextCursor cursor = textEdit->textCursor();
 
     // -----------------------------
@@ -166,6 +151,7 @@ void Kpad::toggleHighlight(bool enabled)
 // Change font color with color picker:
 void Kpad::toggleTextColor(bool enabled)
 {
+    useFormatUndo();
     QTextCursor cursor = textEdit->textCursor();
 
     // -----------------------------
@@ -231,12 +217,13 @@ void Kpad::toggleTextColor(bool enabled)
 }
 
 // Alignment functions
-void Kpad::alignLeft()   { textEdit->setAlignment(Qt::AlignLeft); }
-void Kpad::alignCenter() { textEdit->setAlignment(Qt::AlignCenter); }
-void Kpad::alignRight()  { textEdit->setAlignment(Qt::AlignRight); }
+void Kpad::alignLeft()   { useFormatUndo(); textEdit->setAlignment(Qt::AlignLeft); }
+void Kpad::alignCenter() { useFormatUndo(); textEdit->setAlignment(Qt::AlignCenter); }
+void Kpad::alignRight()  { useFormatUndo(); textEdit->setAlignment(Qt::AlignRight); }
 
 // Insert bullet or numbered list
 void Kpad::insertBulletList(const QString &style) {
+    useFormatUndo();
     QTextCursor cursor = textEdit->textCursor();
     QTextListFormat listFormat;
 
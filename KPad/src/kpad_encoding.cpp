@@ -0,0 +1,358 @@
+#include "kpad_encoding.h"
+
+#include <QtAlgorithms>
+#include <cstring>
+
+// SSE2 is part of x86-64; elsewhere the scalar loops are used
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define KPAD_ENCODING_SSE2 1
+#  include <emmintrin.h>
+#endif
+
+// Line endings are judged within this many bytes of the start
+static const qint64 kLineEndingScanBytes = 1024 * 1024;
+
+// --------------------
+// Text Format
+// --------------------
+KpadTextFormat KpadTextFormat::platformDefault() {
+    KpadTextFormat format;
+#ifdef Q_OS_WIN
+    format.crlf = true;
+#endif
+    return format;
+}
+
+QByteArray KpadTextFormat::bomBytes() const {
+    if (!bom)
+        return QByteArray();
+    switch (encoding) {
+    case Utf8:    return QByteArray("\xEF\xBB\xBF", 3);
+    case Utf16LE: return QByteArray("\xFF\xFE", 2);
+    case Utf16BE: return QByteArray("\xFE\xFF", 2);
+    case Latin1:  break;
+    }
+    return QByteArray();
+}
+
+QString KpadTextFormat::name() const {
+    QString text;
+    switch (encoding) {
+    case Utf8:    text = bom ? "UTF-8 BOM" : "UTF-8"; break;
+    case Utf16LE: text = "UTF-16 LE"; break;
+    case Utf16BE: text = "UTF-16 BE"; break;
+    case Latin1:  text = "Latin-1"; break;
+    }
+    return text + (crlf ? " (CRLF)" : " (LF)");
+}
+
+// --------------------
+// Detection
+// --------------------
+namespace KpadEncoding {
+
+qint64 asciiPrefix(const char *data, qint64 size) {
+    qint64 i = 0;
+#ifdef KPAD_ENCODING_SSE2
+    // 64 bytes per step while everything is ASCII, then find the byte
+    for (; i + 64 <= size; i += 64) {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + 16));
+        const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + 32));
+        const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + 48));
+        if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d))))
+            break;
+    }
+    for (; i + 16 <= size; i += 16) {
+        const int mask = _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i)));
+        if (mask)
+            return i + qCountTrailingZeroBits(uint(mask));
+    }
+#endif
+    for (; i < size; ++i) {
+        if (uchar(data[i]) >= 0x80)
+            return i;
+    }
+    return size;
+}
+
+bool isValidUtf8(const char *data, qint64 size, bool complete) {
+    const uchar *p = reinterpret_cast<const uchar *>(data);
+    const uchar *end = p + size;
+
+    while (p < end) {
+        p += asciiPrefix(reinterpret_cast<const char *>(p), end - p);
+        if (p == end)
+            break;
+
+        const uchar lead = *p;
+        int trail = 0;
+        uint codePoint = 0;
+        uint minimum = 0;
+        if (lead < 0xC2) {
+            return false;  // stray continuation byte, or an overlong 2-byte lead
+        } else if (lead < 0xE0) {
+            trail = 1; codePoint = lead & 0x1F; minimum = 0x80;
+        } else if (lead < 0xF0) {
+            trail = 2; codePoint = lead & 0x0F; minimum = 0x800;
+        } else if (lead < 0xF5) {
+            trail = 3; codePoint = lead & 0x07; minimum = 0x10000;
+        } else {
+            return false;
+        }
+
+        if (end - p - 1 < trail) {
+            // Cut off by the end of the buffer
+            for (const uchar *q = p + 1; q < end; ++q) {
+                if ((*q & 0xC0) != 0x80)
+                    return false;
+            }
+            return !complete;
+        }
+
+        for (int i = 1; i <= trail; ++i) {
+            if ((p[i] & 0xC0) != 0x80)
+                return false;
+            codePoint = (codePoint << 6) | (p[i] & 0x3F);
+        }
+        if (codePoint < minimum || codePoint > 0x10FFFF || (codePoint >= 0xD800 && codePoint <= 0xDFFF))
+            return false;
+        p += trail + 1;
+    }
+    return true;
+}
+
+KpadTextFormat detect(const char *data, qint64 size, bool complete) {
+    const uchar *bytes = reinterpret_cast<const uchar *>(data);
+    KpadTextFormat format;
+
+    if (size >= 3 && bytes[0] == 0xEF && bytes[1] == 0xBB && bytes[2] == 0xBF) {
+        format.bom = true;
+    } else if (size >= 2 && bytes[0] == 0xFF && bytes[1] == 0xFE) {
+        format.encoding = KpadTextFormat::Utf16LE;
+        format.bom = true;
+    } else if (size >= 2 && bytes[0] == 0xFE && bytes[1] == 0xFF) {
+        format.encoding = KpadTextFormat::Utf16BE;
+        format.bom = true;
+    } else {
+        // Mostly-ASCII UTF-16 has a NUL in every other byte
+        const qint64 sample = qMin<qint64>(size, 4096) & ~qint64(1);
+        qint64 evenZeros = 0;
+        qint64 oddZeros = 0;
+        for (qint64 i = 0; i < sample; ++i) {
+            if (!bytes[i])
+                ++(i & 1 ? oddZeros : evenZeros);
+        }
+        if (sample >= 4 && oddZeros > sample / 8 && evenZeros == 0)
+            format.encoding = KpadTextFormat::Utf16LE;
+        else if (sample >= 4 && evenZeros > sample / 8 && oddZeros == 0)
+            format.encoding = KpadTextFormat::Utf16BE;
+        else if (!isValidUtf8(data, size, complete))
+            format.encoding = KpadTextFormat::Latin1;
+    }
+
+    // The first line break decides the line endings
+    const bool wide = format.encoding == KpadTextFormat::Utf16LE || format.encoding == KpadTextFormat::Utf16BE;
+    const qint64 width = wide ? 2 : 1;
+    const qint64 start = format.bomBytes().size();
+    const qint64 stop = qMin(size, start + kLineEndingScanBytes);
+    ushort previous = 0;
+    for (qint64 i = start; i + width <= stop; i += width) {
+        ushort unit = bytes[i];
+        if (format.encoding == KpadTextFormat::Utf16LE)
+            unit = ushort(bytes[i] | (bytes[i + 1] << 8));
+        else if (format.encoding == KpadTextFormat::Utf16BE)
+            unit = ushort((bytes[i] << 8) | bytes[i + 1]);
+
+        if (unit == '\n') {
+            format.crlf = previous == '\r';
+            break;
+        }
+        previous = unit;
+    }
+    return format;
+}
+
+bool fitsLatin1(const QChar *data, qint64 length) {
+    for (qint64 i = 0; i < length; ++i) {
+        if (data[i].unicode() > 0xFF)
+            return false;
+    }
+    return true;
+}
+
+} // namespace KpadEncoding
+
+// --------------------
+// Decoder
+// --------------------
+// Number of bytes in the UTF-8 sequence starting with lead (1 for bytes
+// that cannot start one; fromUtf8 turns those into U+FFFD)
+static int utf8SequenceLength(uchar lead) {
+    if (lead < 0xC0)
+        return 1;
+    if (lead < 0xE0)
+        return 2;
+    if (lead < 0xF0)
+        return 3;
+    if (lead < 0xF8)
+        return 4;
+    return 1;
+}
+
+KpadTextDecoder::KpadTextDecoder(KpadTextFormat::Encoding encoding)
+    : encoding(encoding)
+{
+}
+
+QString KpadTextDecoder::decode(const char *data, qint64 size) {
+    switch (encoding) {
+    case KpadTextFormat::Utf8:
+        return decodeUtf8(data, size);
+    case KpadTextFormat::Utf16LE:
+    case KpadTextFormat::Utf16BE:
+        return decodeUtf16(data, size);
+    case KpadTextFormat::Latin1:
+        break;
+    }
+    return QString::fromLatin1(data, int(size));
+}
+
+QString KpadTextDecoder::decodeUtf8(const char *data, qint64 size) {
+    QString text;
+
+    // Finish the character the previous chunk cut off
+    if (!carry.isEmpty()) {
+        const qint64 needed = utf8SequenceLength(uchar(carry.at(0))) - carry.size();
+        const qint64 taken = qMin(needed, size);
+        carry.append(data, int(taken));
+        data += taken;
+        size -= taken;
+        if (taken < needed)
+            return text;
+        text = QString::fromUtf8(carry);
+        carry.clear();
+    }
+
+    // Hold back a sequence cut off by the end of this chunk
+    qint64 complete = size;
+    int continuation = 0;
+    while (continuation < 3 && complete > 0 && (uchar(data[complete - 1]) & 0xC0) == 0x80) {
+        --complete;
+        ++continuation;
+    }
+    if (complete > 0 && utf8SequenceLength(uchar(data[complete - 1])) > continuation + 1)
+        --complete;
+    else
+        complete = size;
+    carry = QByteArray(data + complete, int(size - complete));
+
+    if (KpadEncoding::asciiPrefix(data, complete) == complete)
+        text += QString::fromLatin1(data, int(complete));
+    else
+        text += QString::fromUtf8(data, int(complete));
+    return text;
+}
+
+QString KpadTextDecoder::decodeUtf16(const char *data, qint64 size) {
+    QByteArray bytes = carry;
+    bytes.append(data, int(size));
+    carry.clear();
+
+    const bool littleEndian = encoding == KpadTextFormat::Utf16LE;
+    const qint64 units = bytes.size() / 2;
+    const uchar *in = reinterpret_cast<const uchar *>(bytes.constData());
+
+    QString text(int(units), Qt::Uninitialized);
+    QChar *out = text.data();
+    for (qint64 i = 0; i < units; ++i) {
+        const uchar a = in[2 * i];
+        const uchar b = in[2 * i + 1];
+        out[i] = QChar(littleEndian ? ushort(a | (b << 8)) : ushort((a << 8) | b));
+    }
+
+    // Keep an odd byte, and a high surrogate whose pair is still to come
+    qint64 keep = bytes.size() - units * 2;
+    if (!text.isEmpty() && text.at(text.size() - 1).isHighSurrogate()) {
+        text.chop(1);
+        keep += 2;
+    }
+    carry = bytes.right(int(keep));
+    return text;
+}
+
+QString KpadTextDecoder::flush() {
+    if (carry.isEmpty())
+        return QString();
+    carry.clear();
+    return QString(QChar(QChar::ReplacementCharacter));
+}
+
+// --------------------
+// Encoder
+// --------------------
+KpadTextEncoder::KpadTextEncoder(const KpadTextFormat &format)
+    : format(format)
+{
+}
+
+QByteArray KpadTextEncoder::encode(const QChar *data, qint64 length) {
+    QByteArray out;
+    if (!started) {
+        out = format.bomBytes();
+        started = true;
+    }
+
+    QStringView view(data, length);
+    const bool endsHigh = !view.isEmpty() && view.back().isHighSurrogate();
+
+    // The common case (LF, nothing held back) encodes straight from the view
+    if (!format.crlf && pendingHigh.isNull() && !endsHigh) {
+        out += encodeText(view);
+        return out;
+    }
+
+    QString text;
+    if (!pendingHigh.isNull())
+        text += pendingHigh;
+    text.append(data, int(endsHigh ? length - 1 : length));
+    pendingHigh = endsHigh ? view.back() : QChar();
+    if (format.crlf)
+        text.replace(QLatin1Char('\n'), QLatin1String("\r\n"));
+
+    out += encodeText(text);
+    return out;
+}
+
+QByteArray KpadTextEncoder::flush() {
+    QByteArray out = started ? QByteArray() : format.bomBytes();
+    started = true;
+    if (!pendingHigh.isNull()) {
+        const QChar high = pendingHigh;
+        pendingHigh = QChar();
+        out += encodeText(QStringView(&high, 1));
+    }
+    return out;
+}
+
+QByteArray KpadTextEncoder::encodeText(QStringView text) const {
+    switch (format.encoding) {
+    case KpadTextFormat::Utf8:
+        return text.toUtf8();
+    case KpadTextFormat::Latin1:
+        return text.toLatin1();
+    case KpadTextFormat::Utf16LE:
+    case KpadTextFormat::Utf16BE:
+        break;
+    }
+
+    const bool littleEndian = format.encoding == KpadTextFormat::Utf16LE;
+    QByteArray bytes(int(text.size() * 2), Qt::Uninitialized);
+    uchar *out = reinterpret_cast<uchar *>(bytes.data());
+    for (qsizetype i = 0; i < text.size(); ++i) {
+        const ushort unit = text.at(i).unicode();
+        out[2 * i] = uchar(littleEndian ? unit & 0xFF : unit >> 8);
+        out[2 * i + 1] = uchar(littleEndian ? unit >> 8 : unit & 0xFF);
+    }
+    return bytes;
+}
@@ -0,0 +1,84 @@
+#ifndef KPAD_ENCODING_H
+#define KPAD_ENCODING_H
+
+#include <QByteArray>
+#include <QString>
+#include <QStringView>
+
+// How a file's bytes map to text. Detected on load and kept with the
+// document so save() writes the file back the way it was read.
+struct KpadTextFormat
+{
+    enum Encoding { Utf8, Utf16LE, Utf16BE, Latin1 };
+
+    Encoding encoding = Utf8;
+    bool bom = false;               // byte order mark at the start
+    bool crlf = false;              // "\r\n" line endings
+
+    static KpadTextFormat platformDefault();    // for new documents
+    QByteArray bomBytes() const;
+    QString name() const;           // e.g. "UTF-8 (CRLF)"
+
+    bool operator==(const KpadTextFormat &other) const {
+        return encoding == other.encoding && bom == other.bom && crlf == other.crlf;
+    }
+    bool operator!=(const KpadTextFormat &other) const { return !(*this == other); }
+};
+
+namespace KpadEncoding {
+
+// Length of the leading run of ASCII bytes (SSE2: 64 bytes per step)
+qint64 asciiPrefix(const char *data, qint64 size);
+
+// Strict UTF-8 check: no overlongs, surrogates or code points past U+10FFFF.
+// With complete == false a sequence cut off by the end of data is accepted.
+bool isValidUtf8(const char *data, qint64 size, bool complete = true);
+
+// BOM first; then UTF-16 without a BOM (NUL in every other byte), valid
+// UTF-8, and finally Latin-1, which maps every byte and so round-trips any
+// file. The first line break decides crlf.
+KpadTextFormat detect(const char *data, qint64 size, bool complete = true);
+
+// True if every character can be written as Latin-1
+bool fitsLatin1(const QChar *data, qint64 length);
+
+} // namespace KpadEncoding
+
+// Chunked decoder (the BOM must already be skipped). A character split
+// across two chunks is completed by the next call. Pure-ASCII UTF-8 chunks
+// take the Latin-1 widening path.
+class KpadTextDecoder
+{
+public:
+    explicit KpadTextDecoder(KpadTextFormat::Encoding encoding);
+
+    QString decode(const char *data, qint64 size);
+    QString flush();                // an incomplete trailing character, as U+FFFD
+
+private:
+    QString decodeUtf8(const char *data, qint64 size);
+    QString decodeUtf16(const char *data, qint64 size);
+
+    KpadTextFormat::Encoding encoding;
+    QByteArray carry;               // bytes of a character cut off by the last chunk
+};
+
+// Chunked encoder: writes the BOM first, turns "\n" into "\r\n" when asked,
+// and holds back a high surrogate until its pair arrives.
+class KpadTextEncoder
+{
+public:
+    explicit KpadTextEncoder(const KpadTextFormat &format);
+
+    QByteArray encode(const QChar *data, qint64 length);
+    QByteArray flush();
+
+private:
+    QByteArray encodeText(QStringView text) const;
+
+    KpadTextFormat format;
+    bool started = false;
+    QChar pendingHigh;              // high surrogate that ended the last chunk
+};
+
+#endif // KPAD_ENCODING_H
@@ -1,5 +1,31 @@
 #include "kpad.h"
 #include "ui_kpad.h"
+#include "kpad_loader.h"
+#include "kpad_saver.h"
+#include "kpad_html.h"
+#include "kpad_largeview.h"
+#include "kpad_journal.h"
+#include "kpad_metrics.h"
+#include "kpad_session.h"
+#include "kpad_tab.h"
+#include "kpad_undo.h"
+
+#include <QLocale>
+#include <QPointer>
+#include <QtConcurrent>
+#include <utility>
+
+// Plain-text files at least this large are streamed in on a worker thread
+static const qint64 kStreamingThreshold = 8 * 1024 * 1024;
+// ...and from this size on they open in the read-only large-file viewer
+static const qint64 kViewerThreshold = 256 * 1024 * 1024;
+// HTML files at least this large are parsed on a worker thread
+static const qint64 kHtmlImportThreshold = 512 * 1024;
+
+// Decode throughput for the status bar, in MB/s
+static double decodeRate(qint64 bytes, qint64 nsecs) {
+    return bytes / (1024.0 * 1024.0) / (qMax<qint64>(nsecs, 1) / 1e9);
+}
 
 // --------------------
 // File Actions
@@ -7,15 +33,39 @@
 void Kpad::exit() { close(); }
 
 void Kpad::closeEvent(QCloseEvent *event) {
-    if (maybeSave()) {
-        event->accept();  // Allow the application to close
-    } else {
-        event->ignore();  // Cancel the close operation
+    // Ask about every tab with unsaved changes, showing each in turn
+    const int shown = activeTab;
+    for (int i = 0; i < tabs.size(); ++i) {
+        const KpadTab *tab = tabs[i];
+        const bool modified = i == activeTab ? hasUnsavedChanges()
+                            : tab->isLoaded() ? tab->document->isModified()
+                                              : tab->modified;
+        if (!modified)
+            continue;
+        setActiveTab(i);
+        if (!maybeSave()) {
+            event->ignore();  // Cancel the close operation
+            return;
+        }
     }
+    setActiveTab(shown);
+
+    for (KpadTab *tab : std::as_const(tabs))
+        tab->journal->stop();  // Nothing left to recover
+    saveSession();
+    if (!metricsReportPath.isEmpty())
+        KpadMetrics::writeReport(metricsReportPath);
+    event->accept();  // Allow the application to close
 }
 
+// A file that is still streaming in has nothing to save yet; its load is
+// only given up once the document is to be closed or replaced
 bool Kpad::maybeSave() {
+    // Let a save that is already running land first
+    fileSaver->waitForFinished();
+
     if (!hasUnsavedChanges()) {
+        cancelStreamingLoad();
         return true;  // No unsaved changes, safe to close
     }
 
@@ -33,8 +83,13 @@ bool Kpad::maybeSave() {
     switch (result) {
     case QMessageBox::Save:
         save();  // Use your existing save method
-        return true;  // Allow closing after save
+        fileSaver->waitForFinished();
+        if (hasUnsavedChanges())
+            return false;  // Only close once the file is on disk
+        cancelStreamingLoad();
+        return true;
     case QMessageBox::Discard:
+        cancelStreamingLoad();
         return true;  // Close without saving
     case QMessageBox::Cancel:
     default:
@@ -48,21 +103,17 @@ bool Kpad::hasUnsavedChanges() {
 }
 
 bool Kpad::saveFile(const QString &filePath, QTextEdit *editor) {
-    QFile file(filePath);
-    if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+    KpadTextSnapshot snapshot = editor == textEdit ? documentSnapshot()
+                                                   : KpadTextSnapshot::fromString(editor->toPlainText());
+    const KpadTextFormat format = editor == textEdit ? fileFormat : KpadTextFormat::platformDefault();
+    if (!KpadFileSaver::write(filePath, snapshot, format).ok)
         return false;
 
-    QTextStream out(&file);
-    out << editor->toPlainText();
     editor->document()->setModified(false);
     return true;
 }
 
 void Kpad::open() {
-    if (!maybeSave()) {
-        return;  // User cancelled, don't open new file
-    }
-
     QString fileName = QFileDialog::getOpenFileName(
         this,
         "Open File",
@@ -72,69 +123,481 @@ void Kpad::open() {
 
     if (fileName.isEmpty())
         return;
+    openPath(fileName);
+}
+
+// Shows fileName: its tab if it is open, otherwise loaded into a new one
+void Kpad::openPath(const QString &fileName) {
+    // Already open: show its tab
+    for (int i = 0; i < tabs.size(); ++i) {
+        const KpadTab *tab = tabs[i];
+        QString path = tab->largeFilePath.isEmpty() ? tab->filePath : tab->largeFilePath;
+        if (i == activeTab)
+            path = largeView->isOpen() ? largeView->filePath() : currentFile;
+        if (QFileInfo(path) == QFileInfo(fileName)) {
+            setActiveTab(i);
+            return;
+        }
+    }
+
+    // Opens in a new tab unless this one is still blank
+    if (!isBlankTab()) {
+        newTab();
+        setActiveTab(tabs.size() - 1);
+    }
+    loadFile(fileName);
+}
+
+void Kpad::loadFile(const QString &fileName) {
+    cancelStreamingLoad();
+    closeLargeFile();
+
+    bool isHtml = fileName.endsWith(".html", Qt::CaseInsensitive) || fileName.endsWith(".htm", Qt::CaseInsensitive);
+
+    // Too large for the editor to lay out: view it instead
+    if (!isHtml && QFileInfo(fileName).size() >= kViewerThreshold) {
+        openLargeFile(fileName);
+        return;
+    }
 
+    // Large plain-text files are streamed in on a worker thread
+    if (!isHtml && QFileInfo(fileName).size() >= kStreamingThreshold) {
+        startStreamingLoad(fileName);
+        return;
+    }
+
+    // ...and large HTML files are parsed into a document of their own there
+    if (isHtml && QFileInfo(fileName).size() >= kHtmlImportThreshold) {
+        startHtmlLoad(fileName);
+        return;
+    }
+
+    loadTimer.start();
     QFile file(fileName);
-    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+    if (!file.open(QIODevice::ReadOnly)) {
         QMessageBox::warning(this, "Warning", "Cannot open file: " + file.errorString());
         return;
     }
 
-    QTextStream in(&file);
-    QString text = in.readAll();
+    const QByteArray bytes = file.readAll();
     file.close();
 
+    // Detect the encoding, then decode what follows the BOM
+    QElapsedTimer decodeTimer;
+    decodeTimer.start();
+    const KpadTextFormat format = KpadEncoding::detect(bytes.constData(), bytes.size());
+    const int bomSize = format.bomBytes().size();
+    KpadTextDecoder decoder(format.encoding);
+    QString text = decoder.decode(bytes.constData() + bomSize, bytes.size() - bomSize);
+    text += decoder.flush();
+    text.replace(QLatin1String("\r\n"), QLatin1String("\n"));
+    const qint64 decodeNsecs = decodeTimer.nsecsElapsed();
+
     currentFile = fileName;
+    setFileFormat(format);
     setWindowTitle(QFileInfo(fileName).fileName() + " - KPad+");
 
-    if (fileName.endsWith(".html", Qt::CaseInsensitive) || fileName.endsWith(".htm", Qt::CaseInsensitive)) {
+    // The mirror is rebuilt from the loaded text rather than diffed
+    pieceTableSyncBlocked = true;
+    if (isHtml) {
         textEdit->setHtml(text);   // load with formatting
     } else {
         textEdit->setPlainText(text); // load as raw text
     }
+    pieceTableSyncBlocked = false;
+    resetPieceTable(text, !isHtml);
+    startJournal(true);
+    updateCodeGrammar();
 
     textEdit->document()->setModified(false);  // Mark as not modified since we just loaded
+    KpadMetrics::record(KpadMetrics::Open, loadTimer.nsecsElapsed());
+    statusBar()->showMessage(QString("Opened %1 (%2, decoded at %3 MB/s)")
+                                 .arg(QFileInfo(fileName).fileName())
+                                 .arg(format.name())
+                                 .arg(decodeRate(bytes.size(), decodeNsecs), 0, 'f', 0), 5000);
 }
 
-void Kpad::newDocument() {
-    if (!maybeSave()) {
-        return;  // User cancelled, don't create new document
+// --------------------
+// Streaming Load (large files)
+// --------------------
+void Kpad::startStreamingLoad(const QString &fileName) {
+    currentFile = fileName;
+    setWindowTitle(QFileInfo(fileName).fileName() + " - KPad+");
+    updateCodeGrammar();
+
+    // Chunks are appended straight into the document; keep them out of the
+    // undo stack and stop the user from editing half a file.
+    journal->stop();
+    textEdit->clear();
+    resetPieceTable(QString(), true);
+    textEdit->document()->setUndoRedoEnabled(false);
+    setLoadingState(true);
+
+    fileLoader = new KpadFileLoader(fileName, this);
+    connect(fileLoader, &KpadFileLoader::chunkReady, this, &Kpad::appendLoadedChunk);
+    connect(fileLoader, &KpadFileLoader::finished, this, &Kpad::finishStreamingLoad);
+    connect(fileLoader, &KpadFileLoader::progress, this, [=](qint64 done, qint64 total) {
+        if (total > 0)
+            loadProgress->setValue(int(done * 1000 / total));
+    });
+
+    statusBar()->showMessage("Loading " + QFileInfo(fileName).fileName() + "...");
+    loadTimer.start();
+    fileLoader->start();
+}
+
+void Kpad::appendLoadedChunk(const QString &text) {
+    // Ignore chunks that were queued before a cancel
+    KpadFileLoader *loader = qobject_cast<KpadFileLoader *>(sender());
+    KpadTab *tab = loader && loader != fileLoader ? tabForLoader(loader) : nullptr;
+    if (!loader || (loader != fileLoader && !tab))
+        return;
+
+    // A tab switched away from keeps loading; its document is not connected
+    // to the mirror or the counters, so both are fed here
+    QTextDocument *doc = tab ? tab->document : textEdit->document();
+    QTextCursor cursor(doc);
+    cursor.movePosition(QTextCursor::End);
+    const int position = cursor.position();
+    pieceTableSyncBlocked = true;
+    cursor.insertText(text);
+    pieceTableSyncBlocked = false;
+    if (tab)
+        countBlocks(doc, tab->wordTally, position, int(text.size()));
+
+    // The mirror shares the decoded chunk instead of reading it back
+    QString plain = text;
+    KpadPieceTable::normalize(plain);
+    (tab ? tab->pieceTable : pieceTable).append(plain);
+
+    loader->chunkConsumed();
+}
+
+void Kpad::finishStreamingLoad(bool ok, const QString &errorString) {
+    if (!fileLoader || sender() != fileLoader) {
+        if (KpadTab *tab = tabForLoader(sender()))
+            finishBackgroundLoad(tab, ok, errorString);
+        return;
+    }
+
+    const KpadTextFormat format = fileLoader->format();
+    const qint64 decodeNsecs = fileLoader->decodeTime();
+    fileLoader->deleteLater();
+    fileLoader = nullptr;
+    setLoadingState(false);
+
+    if (!ok) {
+        QString fileName = currentFile;
+        clearFailedLoad();
+        statusBar()->showMessage("Ready");
+        QMessageBox::warning(this, "Warning", "Cannot open file " + QFileInfo(fileName).fileName() + ": " + errorString);
+        return;
     }
 
+    textEdit->document()->setModified(false);  // Mark as not modified since we just loaded
+    setFileFormat(format);
+    startJournal(true);
+    KpadMetrics::record(KpadMetrics::Open, loadTimer.nsecsElapsed());
+    restoreLoadCursor();
+    applyPendingJump();
+    const qint64 bytes = QFileInfo(currentFile).size();
+    statusBar()->showMessage(QString("Loaded %1 (%2 MB, %3) in %4 ms, decoded at %5 MB/s")
+                                 .arg(QFileInfo(currentFile).fileName())
+                                 .arg(bytes / (1024.0 * 1024.0), 0, 'f', 1)
+                                 .arg(format.name())
+                                 .arg(loadTimer.elapsed())
+                                 .arg(decodeRate(bytes, decodeNsecs), 0, 'f', 0), 5000);
+}
+
+void Kpad::cancelStreamingLoad() {
+    if (!fileLoader && !htmlLoader)
+        return;
+
+    // Deleting the loader cancels it and waits for the worker thread
+    delete fileLoader;
+    fileLoader = nullptr;
+    // A running setHtml() cannot be stopped: leave it to finish unseen
+    if (htmlLoader)
+        htmlLoader->abandon();
+    htmlLoader = nullptr;
+    setLoadingState(false);
+
+    // Never leave a partial file behind that could be saved over the original
+    clearFailedLoad();
+    statusBar()->showMessage("Loading cancelled", 3000);
+}
+
+// Back to an untitled, empty document after a load that did not complete
+void Kpad::clearFailedLoad() {
+    pendingJump = KpadFileHit();
+    tabs[activeTab]->loadCursor = -1;
     currentFile.clear();
+    setFileFormat(KpadTextFormat::platformDefault());
+    // What had loaded goes without becoming an edit to undo
+    pieceTableSyncBlocked = true;
     textEdit->clear();
-    textEdit->document()->setModified(false);  // Mark as not modified
+    pieceTableSyncBlocked = false;
+    resetPieceTable(QString(), true);
+    textEdit->document()->setModified(false);
+    startJournal(false);
     setWindowTitle("KPad+");
 }
 
+// --------------------
+// HTML Import (large files)
+// --------------------
+// setHtml() on a large report can hold the GUI thread for seconds. The
+// file is parsed into a detached document on a worker thread instead; the
+// editor shows an empty, read-only document until it is swapped in.
+void Kpad::startHtmlLoad(const QString &fileName) {
+    currentFile = fileName;
+    setWindowTitle(QFileInfo(fileName).fileName() + " - KPad+");
+
+    journal->stop();
+    textEdit->clear();
+    resetPieceTable(QString(), false);
+    setLoadingState(true);
+
+    htmlLoader = new KpadHtmlLoader(fileName, textEdit->font(), this);
+    connect(htmlLoader, &KpadHtmlLoader::finished, this, &Kpad::finishHtmlLoad);
+    // Updates queued before a cancel may still arrive: check they are current
+    KpadHtmlLoader *loader = htmlLoader;
+    connect(htmlLoader, &KpadHtmlLoader::progress, this, [=](qint64 done, qint64 total) {
+        if (htmlLoader == loader && total > 0)
+            loadProgress->setValue(int(done * 1000 / total));
+    });
+    connect(htmlLoader, &KpadHtmlLoader::parsing, this, [=]() {
+        if (htmlLoader != loader)
+            return;
+        loadProgress->setRange(0, 0);   // busy: setHtml() gives no progress
+        statusBar()->showMessage("Parsing " + QFileInfo(fileName).fileName() + "...");
+    });
+
+    statusBar()->showMessage("Loading " + QFileInfo(fileName).fileName() + "...");
+    loadTimer.start();
+    htmlLoader->start();
+}
+
+void Kpad::finishHtmlLoad(bool ok, const QString &errorString) {
+    if (!htmlLoader || sender() != htmlLoader) {
+        if (KpadTab *tab = tabForLoader(sender()))
+            finishBackgroundLoad(tab, ok, errorString);
+        return;
+    }
+
+    KpadHtmlLoader *loader = htmlLoader;
+    htmlLoader = nullptr;
+    loader->deleteLater();
+    setLoadingState(false);
+
+    if (!ok) {
+        QString fileName = currentFile;
+        clearFailedLoad();
+        statusBar()->showMessage("Ready");
+        QMessageBox::warning(this, "Warning", "Cannot open file " + QFileInfo(fileName).fileName() + ": " + errorString);
+        return;
+    }
+
+    replaceDocument(loader->takeDocument(), loader->wordTally());
+    updateCodeGrammar();
+    setFileFormat(loader->format());
+    startJournal(true);     // rich documents are not journaled
+    updateTabTitle();
+    KpadMetrics::record(KpadMetrics::Open, loadTimer.nsecsElapsed());
+    restoreLoadCursor();
+    applyPendingJump();
+    statusBar()->showMessage(QString("Opened %1 (%2 MB, %3) in %4 ms")
+                                 .arg(QFileInfo(currentFile).fileName())
+                                 .arg(loader->fileSize() / (1024.0 * 1024.0), 0, 'f', 1)
+                                 .arg(loader->format().name())
+                                 .arg(loadTimer.elapsed()), 5000);
+}
+
+// A load that finished while its tab was in the background: the tab's
+// stashed state is settled the way the two functions above settle Kpad's
+void Kpad::finishBackgroundLoad(KpadTab *tab, bool ok, const QString &errorString) {
+    KpadFileLoader *loader = tab->fileLoader;
+    KpadHtmlLoader *html = tab->htmlLoader;
+    tab->fileLoader = nullptr;
+    tab->htmlLoader = nullptr;
+    if (loader)
+        loader->deleteLater();
+    if (html)
+        html->deleteLater();
+
+    const int index = tabs.indexOf(tab);
+    const QString fileName = QFileInfo(tab->filePath).fileName();
+    if (!ok) {
+        // As clearFailedLoad(): an untitled, empty document
+        tab->filePath.clear();
+        tab->format = KpadTextFormat::platformDefault();
+        tab->document->clear();
+        tab->document->setUndoRedoEnabled(false);
+        KpadUndoStack::of(tab->document)->clear();
+        tab->document->setModified(false);
+        tab->pieceTable = KpadPieceTable();
+        tab->pieceTableActive = true;
+        tab->loadCursor = -1;
+        tab->journal->start(QString(), tab->format, tab->snapshot(), false);
+        tabBar->setTabText(index, "Untitled");
+        tabBar->setTabToolTip(index, QString());
+        QMessageBox::warning(this, "Warning", "Cannot open file " + fileName + ": " + errorString);
+        return;
+    }
+
+    if (html) {
+        QTextDocument *doc = html->takeDocument();
+        doc->setParent(this);
+        doc->setDefaultFont(textEdit->font());
+        doc->setUndoRedoEnabled(true);
+        doc->setModified(false);
+        delete tab->document;
+        tab->document = doc;
+        tab->wordTally = html->wordTally();
+        tab->format = html->format();
+        tab->journal->stop();   // rich documents are not journaled
+    } else {
+        tab->format = loader->format();
+        tab->document->setModified(false);
+        tab->journal->start(tab->filePath, tab->format, tab->snapshot(), true);
+    }
+    if (tab->loadCursor >= 0) {
+        tab->cursorAnchor = tab->cursorPosition = tab->loadCursor;
+        tab->loadCursor = -1;
+    }
+    tabBar->setTabText(index, fileName);
+    statusBar()->showMessage("Loaded " + fileName, 5000);
+}
+
+// Puts the cursor back where it was when the active tab was unloaded
+void Kpad::restoreLoadCursor() {
+    KpadTab *tab = tabs[activeTab];
+    if (tab->loadCursor < 0)
+        return;
+    const int end = textEdit->document()->characterCount() - 1;
+    QTextCursor cursor(textEdit->document());
+    cursor.setPosition(qBound(0, tab->loadCursor, end));
+    textEdit->setTextCursor(cursor);
+    tab->loadCursor = -1;
+}
+
+void Kpad::setLoadingState(bool loading) {
+    textEdit->setReadOnly(loading);
+    QTextDocument *doc = textEdit->document();
+    doc->setUndoRedoEnabled(!loading && (!pieceTableActive || KpadUndoStack::of(doc)->isRetired()));
+
+    ui->actionSave->setEnabled(!loading);
+    ui->actionSave_as->setEnabled(!loading);
+    ui->actionSave_as_HTML->setEnabled(!loading);
+
+    loadProgress->setRange(0, 1000);
+    loadProgress->setValue(0);
+    loadProgress->setVisible(loading);
+    cancelLoadButton->setVisible(loading);
+}
+
+// --------------------
+// Large-File Viewer
+// --------------------
+// Files above kViewerThreshold are never loaded into the QTextDocument.
+// The viewer maps the file and lays out only the visible lines; the editor
+// stays empty (and clean) behind it, and saving is disabled.
+void Kpad::openLargeFile(const QString &fileName) {
+    QString errorString;
+    if (!largeView->open(fileName, &errorString)) {
+        QMessageBox::warning(this, "Warning", "Cannot open file: " + errorString);
+        return;
+    }
+
+    currentFile.clear();  // nothing in the editor may be saved over it
+    setFileFormat(KpadTextFormat::platformDefault());
+    pieceTableSyncBlocked = true;
+    textEdit->clear();
+    pieceTableSyncBlocked = false;
+    resetPieceTable(QString(), true);
+    textEdit->document()->setModified(false);
+    journal->stop();  // the viewer is read-only
+
+    setViewerMode(true);
+    setWindowTitle(QFileInfo(fileName).fileName() + " (read-only) - KPad+");
+    statusBar()->showMessage("Indexing " + QFileInfo(fileName).fileName() + "...");
+    loadTimer.start();
+}
+
+void Kpad::closeLargeFile() {
+    if (!largeView->isOpen())
+        return;
+
+    largeView->close();
+    setViewerMode(false);
+    setWindowTitle("KPad+");
+}
+
+void Kpad::setViewerMode(bool viewing) {
+    centralStack->setCurrentWidget(viewing ? static_cast<QWidget *>(largeView) : textEdit);
+    textEdit->setReadOnly(viewing);
+
+    ui->actionSave->setEnabled(!viewing);
+    ui->actionSave_as->setEnabled(!viewing);
+    ui->actionSave_as_HTML->setEnabled(!viewing);
+
+    loadProgress->setValue(0);
+    loadProgress->setVisible(viewing);
+    findMatches.clear();
+    paintVisibleMatches();
+    updateFindStatus();
+    updateCounts();
+
+    if (viewing)
+        largeView->setFocus();
+    else
+        textEdit->setFocus();
+}
+
+void Kpad::largeFileIndexed(qint64 lines) {
+    loadProgress->hide();
+    updateCounts();
+    KpadMetrics::record(KpadMetrics::Open, loadTimer.nsecsElapsed());
+    applyPendingJump();
+    statusBar()->showMessage(QString("Indexed %1 lines of %2 (%3 MB) in %4 ms")
+                                 .arg(lines)
+                                 .arg(QFileInfo(largeView->filePath()).fileName())
+                                 .arg(largeView->fileSize() / (1024.0 * 1024.0), 0, 'f', 1)
+                                 .arg(loadTimer.elapsed()), 5000);
+}
+
+void Kpad::setFileFormat(const KpadTextFormat &format) {
+    fileFormat = format;
+    encodingLabel->setText(format.name());
+}
+
+void Kpad::newDocument() {
+    // Every new document gets its own tab
+    newTab();
+    setActiveTab(tabs.size() - 1);
+    startJournal(false);
+}
+
 void Kpad::save() {
-    // If currentFile is empty, ask the user for a file name
-    QString fileName = currentFile.isEmpty() ? QFileDialog::getSaveFileName(
+    // A Save As still being written is where the document now goes
+    const QString target = savingFile.isEmpty() ? currentFile : savingFile;
+
+    // If there is no target yet, ask the user for a file name
+    QString fileName = target.isEmpty() ? QFileDialog::getSaveFileName(
                                                    this,
                                                    "Save",
                                                    "",
                                                    "Text Files (*.txt);;All Files (*.*)"  // default filter for .txt
-                                                   ) : currentFile;
+                                                   ) : target;
 
     if(fileName.isEmpty()) return;
 
     // Enforce .txt extension if saving a new file and user didn't provide one
-    if (currentFile.isEmpty() && !fileName.endsWith(".txt", Qt::CaseInsensitive)) {
+    if (target.isEmpty() && !fileName.endsWith(".txt", Qt::CaseInsensitive)) {
         fileName += ".txt";
     }
 
-    QFile file(fileName);
-    if(!file.open(QIODevice::WriteOnly | QFile::Text)){
-        QMessageBox::warning(this,"Warning","Cannot save file: "+file.errorString());
-        return;
-    }
-
-    currentFile = fileName;  // update the current file path
-    QTextStream out(&file);
-    out << textEdit->toPlainText();  // save plain text
-    file.close();
-
-    textEdit->document()->setModified(false);  // Mark as saved
-    setWindowTitle(QFileInfo(fileName).fileName() + " - KPad+");
+    writeDocument(fileName);
 }
 
 void Kpad::saveAs() {
@@ -150,19 +613,62 @@ void Kpad::saveAs() {
         fileName += ".txt";
     }
 
-    QFile file(fileName);
-    if(!file.open(QIODevice::WriteOnly | QFile::Text)){
-        QMessageBox::warning(this,"Warning","Cannot save file: "+file.errorString());
+    writeDocument(fileName);
+}
+
+// --------------------
+// Save Pipeline
+// --------------------
+// Hands a snapshot to the background saver; the user keeps editing while
+// it is encoded and written. The document only takes the new path once the
+// write succeeded, and is only marked clean if nothing changed between the
+// snapshot and the end of the write.
+void Kpad::writeDocument(const QString &fileName) {
+    savingFile = fileName;
+    saveTimer.start();
+    fileSaver->save(fileName, documentSnapshot(), fileFormat, KpadUndoStack::of(textEdit->document())->revision());
+    statusBar()->showMessage("Saving " + QFileInfo(fileName).fileName() + "...");
+}
+
+void Kpad::saveFinished(const KpadSaveResult &result) {
+    KpadMetrics::record(KpadMetrics::Save, saveTimer.nsecsElapsed());
+    if (!fileSaver->isBusy())
+        savingFile.clear();
+    if (!result.ok) {
+        statusBar()->clearMessage();
+        QMessageBox::warning(this, "Warning", "Cannot save file: " + result.errorString);
         return;
     }
 
-    currentFile = fileName;
-    QTextStream out(&file);
-    out << textEdit->toPlainText();
-    file.close();
+    if (result.filePath != currentFile) {
+        currentFile = result.filePath;  // update the current file path
+        setWindowTitle(QFileInfo(currentFile).fileName() + " - KPad+");
+        updateCodeGrammar();
+    }
 
-    textEdit->document()->setModified(false);  // Mark as saved
-    setWindowTitle(QFileInfo(fileName).fileName() + " - KPad+");
+    const bool clean = KpadUndoStack::of(textEdit->document())->revision() == result.revision;
+    if (clean)
+        textEdit->document()->setModified(false);  // Mark as saved
+
+    // A Latin-1 file that no longer fits Latin-1 was written as UTF-8
+    QString note;
+    if (result.format != fileFormat) {
+        setFileFormat(result.format);
+        note = ", now " + result.format.name();
+    }
+
+    // The file on disk is the journal's new base; edits made during the
+    // write are kept as a snapshot instead
+    startJournal(clean);
+
+    const double megabytes = result.bytes / (1024.0 * 1024.0);
+    const double seconds = qMax<qint64>(result.msecs, 1) / 1000.0;
+    statusBar()->showMessage(QString("Saved %1 (%2 MB in %3 ms, %4 MB/s%5)")
+                                 .arg(QFileInfo(result.filePath).fileName())
+                                 .arg(megabytes, 0, 'f', 1)
+                                 .arg(result.msecs)
+                                 .arg(megabytes / seconds, 0, 'f', 1)
+                                 .arg(note), 5000);
 }
 
 void Kpad::saveAsHTML() {
@@ -176,18 +682,278 @@ void Kpad::saveAsHTML() {
     if (fileName.isEmpty())
         return;
 
-    QFile file(fileName);
-    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
-        QMessageBox::warning(this, "Warning", "Cannot save file: " + file.errorString());
+    // Streamed out block by block, without building the page as a string
+    const KpadHtmlExportResult result = KpadHtmlExporter::write(textEdit->document(), fileName);
+    KpadMetrics::record(KpadMetrics::Save, result.msecs * 1000000);
+    if (!result.ok) {
+        QMessageBox::warning(this, "Warning", "Cannot save file: " + result.errorString);
         return;
     }
-
-    QTextStream out(&file);
-    out << textEdit->toHtml();
-    file.close();
+    statusBar()->showMessage(QString("Saved HTML: %1 KB, %2 styles, in %3 ms")
+                                 .arg((result.bytes + 1023) / 1024).arg(result.classes).arg(result.msecs), 4000);
 
     currentFile = fileName;
     textEdit->document()->setModified(false);  // Mark as saved
+    startJournal(false);
     setWindowTitle(QFileInfo(fileName).fileName() + " - KPad+");
+    updateCodeGrammar();
+}
+
+
+// --------------------
+// Autosave Journal
+// --------------------
+// Plain-text documents journal every edit (see KpadJournal). A document
+// that was just loaded or saved refers to its file on disk; anything else
+// is journaled from a snapshot. Rich (HTML) documents are not journaled.
+void Kpad::startJournal(bool matchesFile) {
+    journalTimer->stop();
+    if (!pieceTableActive || largeView->isOpen()) {
+        journal->stop();
+        return;
+    }
+
+    journal->start(currentFile, fileFormat, documentSnapshot(), matchesFile);
+    if (!journal->errorString().isEmpty())
+        statusBar()->showMessage("Autosave failed: " + journal->errorString(), 5000);
 }
 
+void Kpad::flushJournal() {
+    if (!journal->flush(documentSnapshot()))
+        statusBar()->showMessage("Autosave failed: " + journal->errorString(), 5000);
+}
+
+// Offers the journals of sessions that ended without closing cleanly,
+// newest first. Each one recovered opens in its own tab.
+void Kpad::recoverJournal() {
+    const QList<KpadJournalInfo> orphans = KpadJournal::orphans();
+    for (const KpadJournalInfo &orphan : orphans) {
+        const QString fileName = orphan.sourcePath.isEmpty() ? "Untitled" : QFileInfo(orphan.sourcePath).fileName();
+
+        QMessageBox::StandardButton result = QMessageBox::question(
+            this,
+            "KPad+ - Recover Unsaved Changes",
+            QString("KPad+ was not closed properly. Unsaved changes to '%1' from %2 were found.\n\n"
+                    "Do you want to recover them?")
+                .arg(fileName)
+                .arg(QLocale().toString(orphan.lastWritten, QLocale::ShortFormat)),
+            QMessageBox::Yes | QMessageBox::No,
+            QMessageBox::Yes
+            );
+
+        if (result != QMessageBox::Yes) {
+            KpadJournal::discard(orphan.journalPath);
+            continue;
+        }
+
+        KpadTextSnapshot text;
+        KpadJournalInfo info;
+        QString errorString;
+        if (!KpadJournal::replay(orphan.journalPath, &text, &info, &errorString)) {
+            QMessageBox::warning(this, "Warning", "Cannot recover " + fileName + ": " + errorString);
+            KpadJournal::discard(orphan.journalPath);
+            continue;
+        }
+
+        if (!isBlankTab()) {
+            newTab();
+            setActiveTab(tabs.size() - 1);
+        }
+        const QString recovered = text.toString();
+        currentFile = info.sourcePath;
+        setFileFormat(info.format);
+        pieceTableSyncBlocked = true;
+        textEdit->setPlainText(recovered);
+        pieceTableSyncBlocked = false;
+        resetPieceTable(recovered, true);
+        textEdit->document()->setModified(true);  // still to be saved
+        setWindowTitle(fileName + " - KPad+");
+
+        // Journal the recovered text before letting go of the old journal
+        startJournal(false);
+        KpadJournal::discard(orphan.journalPath);
+        statusBar()->showMessage("Recovered unsaved changes to " + fileName, 5000);
+    }
+}
+
+// --------------------
+// Session Restore
+// --------------------
+// On close every tab is written to a binary session file: its text as raw
+// UTF-16 plus format runs, cursor and scroll position. The next start maps
+// the shown tab's file back, so it is usable at once, and only then checks
+// the original on a worker thread. The other tabs stay unloaded until they
+// are first shown (see unloadTab()).
+enum SessionSource { SourceUnchanged, SourceChanged, SourceMissing };
+
+void Kpad::saveSession() {
+    KpadSessionFile::clearSession();
+
+    // Describe the shown tab the same way as all the others
+    const int shown = activeTab;
+    stashTab(tabs[shown]);
+
+    int index = 0;
+    for (int i = 0; i < tabs.size(); ++i) {
+        const KpadTab *tab = tabs[i];
+        KpadSessionDocument session;
+        session.active = i == shown;
+        if (!tab->largeFilePath.isEmpty()) {
+            session.sourcePath = tab->largeFilePath;  // reopened, not snapshotted
+        } else if (!tab->isLoaded() || tab->fileLoader || tab->htmlLoader) {
+            session.sourcePath = tab->filePath;       // reopened from its file
+        } else if (!tab->filePath.isEmpty()) {
+            const QFileInfo info(tab->filePath);
+            session.sourcePath = tab->filePath;
+            session.rich = !tab->pieceTableActive;
+            session.format = tab->format;
+            session.sourceSize = info.size();
+            session.sourceModified = info.lastModified().toMSecsSinceEpoch();
+            session.hasText = !tab->document->isModified();  // discarded changes stay discarded
+            session.cursorAnchor = tab->cursorAnchor;
+            session.cursorPosition = tab->cursorPosition;
+            session.verticalScroll = tab->verticalScroll;
+            session.horizontalScroll = tab->horizontalScroll;
+        }
+        if (session.sourcePath.isEmpty())
+            continue;
+
+        const KpadTextSnapshot text = session.hasText ? tab->snapshot() : KpadTextSnapshot();
+        if (KpadSessionFile::write(KpadSessionFile::sessionPath(index), session, tab->document, text))
+            ++index;
+    }
+}
+
+void Kpad::restoreSession() {
+    // Each saved tab comes back unloaded; its snapshot moves out of the
+    // session directory so the next close can write a new session
+    int shown = -1;
+    for (int index = 0;; ++index) {
+        const QString path = KpadSessionFile::sessionPath(index);
+        KpadSessionDocument doc;
+        {
+            KpadSessionFile session;
+            if (!session.open(path))
+                break;
+            doc = session.document();
+        }
+        if (!doc.hasText && !QFileInfo::exists(doc.sourcePath)) {
+            KpadSessionFile::remove(path);
+            continue;
+        }
+
+        KpadTab *tab = newTab();
+        delete tab->document;
+        tab->document = nullptr;
+        tab->filePath = doc.sourcePath;
+        tab->format = doc.format;
+        tab->cursorPosition = doc.cursorPosition;
+        if (doc.hasText) {
+            const QString snapshotPath = QFileInfo(path).absolutePath() + QString("/restored-%1.kps").arg(index);
+            QFile::remove(snapshotPath);
+            if (QFile::rename(path, snapshotPath))
+                tab->snapshotPath = snapshotPath;
+        } else {
+            KpadSessionFile::remove(path);
+        }
+        tabBar->setTabText(tabs.size() - 1, QFileInfo(doc.sourcePath).fileName());
+        tabBar->setTabToolTip(tabs.size() - 1, doc.sourcePath);
+        if (doc.active || shown < 0)
+            shown = tabs.size() - 1;
+    }
+    if (shown < 0)
+        return;
+
+    // Show the last active tab, then drop the blank one the window started with
+    setActiveTab(shown);
+    removeTab(0);
+    statusBar()->showMessage(QString("Restored %1 tab(s) from the last session").arg(tabs.size()), 5000);
+}
+
+// Maps a session snapshot into the (fresh) active document, then checks the
+// original file on a worker thread. Until that check, edits are journaled
+// only if the journal was already running.
+bool Kpad::restoreSnapshot(const QString &path) {
+    KpadSessionFile session;
+    if (!session.open(path))
+        return false;
+
+    const KpadSessionDocument doc = session.document();
+    const QString text = session.text();
+    currentFile = doc.sourcePath;
+    setFileFormat(doc.format);
+    pieceTableSyncBlocked = true;
+    textEdit->setPlainText(text);
+    session.applyFormats(textEdit->document());
+    pieceTableSyncBlocked = false;
+    resetPieceTable(text, !doc.rich);
+    // Its formats came from edits Qt's stack would have recorded
+    if (!doc.rich && session.hasFormatting())
+        useFormatUndo();
+    textEdit->document()->setModified(false);
+    setWindowTitle(doc.sourcePath.isEmpty() ? QString("KPad+") : QFileInfo(doc.sourcePath).fileName() + " - KPad+");
+    updateCodeGrammar();
+
+    const int end = textEdit->document()->characterCount() - 1;
+    QTextCursor cursor(textEdit->document());
+    cursor.setPosition(qBound(0, doc.cursorAnchor, end));
+    cursor.setPosition(qBound(0, doc.cursorPosition, end), QTextCursor::KeepAnchor);
+    textEdit->setTextCursor(cursor);
+    // The scroll ranges exist once the editor has been laid out
+    QTimer::singleShot(0, this, [=]() {
+        textEdit->verticalScrollBar()->setValue(doc.verticalScroll);
+        textEdit->horizontalScrollBar()->setValue(doc.horizontalScroll);
+    });
+
+    // An untitled document has nothing on disk to check
+    if (doc.sourcePath.isEmpty())
+        return true;
+
+    QPointer<QTextDocument> document = textEdit->document();
+    QFutureWatcher<int> *validation = new QFutureWatcher<int>(this);
+    connect(validation, &QFutureWatcher<int>::finished, this, [=]() {
+        const int source = validation->result();
+        validation->deleteLater();
+        if (!document)
+            return;     // its tab was closed
+
+        // The tab was switched away from in the meantime: settle it there
+        if (document != textEdit->document()) {
+            KpadTab *tab = tabForDocument(document);
+            if (!tab || tab->journal->isActive())
+                return;
+            if (source != SourceUnchanged)
+                document->setModified(true);
+            tab->journal->start(tab->filePath, tab->format, tab->snapshot(), !document->isModified());
+            return;
+        }
+
+        // Another file was opened in its place
+        if (currentFile != doc.sourcePath || fileLoader || htmlLoader || largeView->isOpen())
+            return;
+
+        const QString fileName = QFileInfo(doc.sourcePath).fileName();
+        if (source == SourceUnchanged) {
+            if (!journal->isActive())
+                startJournal(!hasUnsavedChanges());
+        } else if (source == SourceChanged && !hasUnsavedChanges()) {
+            loadFile(doc.sourcePath);
+            statusBar()->showMessage(fileName + " changed since the last session and was reloaded", 5000);
+        } else {
+            // Keep the restored text; it no longer matches anything on disk
+            textEdit->document()->setModified(true);
+            startJournal(false);
+            statusBar()->showMessage(source == SourceMissing ? fileName + " no longer exists"
+                                                             : fileName + " changed since the last session", 5000);
+        }
+    });
+    validation->setFuture(QtConcurrent::run([doc]() {
+        const QFileInfo info(doc.sourcePath);
+        if (!info.exists())
+            return int(SourceMissing);
+        if (info.size() != doc.sourceSize || info.lastModified().toMSecsSinceEpoch() != doc.sourceModified)
+            return int(SourceChanged);
+        return int(SourceUnchanged);
+    }));
+    return true;
+}
@@ -0,0 +1,308 @@
+#include "kpad_filesearch.h"
+#include "kpad_encoding.h"
+#include "kpad_piecetable.h"
+#include "kpad_search.h"
+
+#include <QByteArrayMatcher>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QMutex>
+#include <QRegularExpression>
+#include <QThread>
+#include <QThreadPool>
+#include <QTimer>
+#include <cstring>
+
+static const int kBatchFiles = 32;     // paths per pool task
+
+// Everything one search shares with its workers. Workers hold it by
+// shared_ptr, so a cancelled search's state outlives its KpadFileSearch.
+struct KpadFileSearchRun
+{
+    KpadFileSearchRun(const KpadFileSearch::Options &options)
+        : options(options)
+        , matcher(options.pattern, options.cs)
+    {
+    }
+
+    const KpadFileSearch::Options options;
+    const KpadSearch::LiteralMatcher matcher;
+    QRegularExpression re;
+    QByteArrayMatcher bytePattern;  // set for case-sensitive ASCII literals
+    bool byteFilter = false;
+
+    QAtomicInt cancel;
+    QAtomicInt walking{1};          // the walker is still listing files
+    QAtomicInt outstanding;         // batches queued or running
+    QAtomicInteger<qint64> filesListed;
+    QAtomicInteger<qint64> filesSearched;
+    QAtomicInteger<qint64> hitCount;
+    QAtomicInt truncated;
+
+    QMutex mutex;                   // guards pending
+    QVector<KpadFileHit> pending;   // found, not yet handed to the GUI
+};
+
+// --------------------
+// Workers
+// --------------------
+// NUL bytes near the start of a file that is not UTF-16
+static bool looksBinary(const char *data, qint64 size, const KpadTextFormat &format) {
+    if (format.encoding == KpadTextFormat::Utf16LE || format.encoding == KpadTextFormat::Utf16BE)
+        return false;
+    return std::memchr(data, 0, size_t(qMin<qint64>(size, 8192))) != nullptr;
+}
+
+static QVector<KpadMatch> findInText(KpadFileSearchRun &run, const QString &text) {
+    if (run.options.regex)
+        return KpadSearch::findRegex(KpadTextSnapshot::fromString(text), run.re, &run.cancel,
+                                     KpadFileSearch::kMaxHitsPerFile);
+
+    QVector<KpadMatch> matches;
+    const int m = int(run.matcher.length());
+    qsizetype from = 0;
+    while (matches.size() < KpadFileSearch::kMaxHitsPerFile) {
+        const qsizetype at = run.matcher.indexIn(text.constData(), text.size(), from);
+        if (at < 0)
+            break;
+        matches.append({int(at), m});
+        from = at + m;
+    }
+    return matches;
+}
+
+static void searchFile(KpadFileSearchRun &run, const QString &path, QVector<KpadFileHit> *hits) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+    const qint64 size = file.size();
+    if (size == 0 || size > KpadFileSearch::kMaxFileBytes)
+        return;
+    const uchar *mapped = file.map(0, size);
+    QByteArray bytes;
+    if (!mapped)
+        bytes = file.readAll();
+    const char *data = mapped ? reinterpret_cast<const char *>(mapped) : bytes.constData();
+
+    const KpadTextFormat format = KpadEncoding::detect(data, size);
+    if (looksBinary(data, size, format))
+        return;
+    // ASCII needle in an ASCII-compatible file: no bytes, no match
+    if (run.byteFilter && format.encoding != KpadTextFormat::Utf16LE && format.encoding != KpadTextFormat::Utf16BE
+        && run.bytePattern.indexIn(data, int(size)) < 0)
+        return;
+
+    const int bomSize = format.bomBytes().size();
+    KpadTextDecoder decoder(format.encoding);
+    QString text = decoder.decode(data + bomSize, size - bomSize);
+    text += decoder.flush();
+    if (mapped)
+        file.unmap(const_cast<uchar *>(mapped));
+
+    const QVector<KpadMatch> matches = findInText(run, text);
+    const QChar *chars = text.constData();
+    const int length = text.size();
+    qint64 line = 0;
+    int lineStart = 0;
+    int scanned = 0;
+    qint64 lastLine = -1;
+    const int before = hits->size();    // hits holds the whole batch so far
+    for (const KpadMatch &match : matches) {
+        for (; scanned < match.start; ++scanned) {
+            if (chars[scanned] == QLatin1Char('\n')) {
+                ++line;
+                lineStart = scanned + 1;
+            }
+        }
+        if (line == lastLine)
+            continue;       // one hit per line; the editor selects the first match
+        lastLine = line;
+
+        int lineEnd = lineStart;
+        while (lineEnd < length && lineEnd - lineStart < KpadFileSearch::kMaxHitText
+               && chars[lineEnd] != QLatin1Char('\n') && chars[lineEnd] != QLatin1Char('\r'))
+            ++lineEnd;
+        KpadFileHit hit;
+        hit.filePath = path;
+        hit.line = line;
+        hit.column = match.start - lineStart;
+        hit.length = match.length;
+        hit.text = QString(chars + lineStart, lineEnd - lineStart);
+        hits->append(hit);
+        if (hits->size() - before >= KpadFileSearch::kMaxHitsPerFile)
+            break;
+    }
+}
+
+static void searchBatch(const std::shared_ptr<KpadFileSearchRun> &run, const QStringList &paths) {
+    QVector<KpadFileHit> hits;
+    for (const QString &path : paths) {
+        if (run->cancel.loadRelaxed())
+            break;
+        const int before = hits.size();
+        searchFile(*run, path, &hits);
+        run->filesSearched.fetchAndAddRelaxed(1);
+        if (run->hitCount.fetchAndAddRelaxed(hits.size() - before) + (hits.size() - before) >= KpadFileSearch::kMaxHits) {
+            run->truncated.storeRelaxed(1);
+            run->cancel.storeRelaxed(1);
+        }
+    }
+    if (!hits.isEmpty()) {
+        QMutexLocker locker(&run->mutex);
+        run->pending += hits;
+    }
+    run->outstanding.fetchAndSubOrdered(1);
+}
+
+static void walkTree(const std::shared_ptr<KpadFileSearchRun> &run, QThreadPool *pool) {
+    QDirIterator it(run->options.root, run->options.nameFilters, QDir::Files | QDir::NoDotAndDotDot,
+                    QDirIterator::Subdirectories);
+    const int rootLength = qMax(0, int(run->options.root.size()) - 1);
+    QStringList batch;
+    while (it.hasNext() && !run->cancel.loadRelaxed()) {
+        const QString path = it.next();
+        // Leave out version control and other dot directories
+        if (path.indexOf(QLatin1String("/."), rootLength) >= 0)
+            continue;
+        batch.append(path);
+        run->filesListed.fetchAndAddRelaxed(1);
+        if (batch.size() == kBatchFiles) {
+            run->outstanding.fetchAndAddOrdered(1);
+            pool->start([run, batch]() { searchBatch(run, batch); });
+            batch.clear();
+        }
+    }
+    if (!batch.isEmpty()) {
+        run->outstanding.fetchAndAddOrdered(1);
+        pool->start([run, batch]() { searchBatch(run, batch); });
+    }
+    run->walking.storeRelease(0);
+}
+
+// --------------------
+// KpadFileSearch
+// --------------------
+KpadFileSearch::KpadFileSearch(QObject *parent)
+    : QObject(parent)
+    , pool(new QThreadPool(this))
+    , drainTimer(new QTimer(this))
+{
+    // Its own pool, so a tree of slow disks can't starve the editor's work
+    pool->setMaxThreadCount(qMax(2, QThread::idealThreadCount()));
+    drainTimer->setInterval(kDrainMsecs);
+    connect(drainTimer, &QTimer::timeout, this, &KpadFileSearch::drain);
+}
+
+KpadFileSearch::~KpadFileSearch() {
+    cancel();
+    pool->waitForDone();
+}
+
+bool KpadFileSearch::start(const Options &options, QString *errorString) {
+    cancel();
+
+    if (options.pattern.isEmpty() || !QDir(options.root).exists()) {
+        if (errorString)
+            *errorString = options.pattern.isEmpty() ? QString("Nothing to find") : "No such folder: " + options.root;
+        return false;
+    }
+    auto next = std::make_shared<KpadFileSearchRun>(options);
+    if (options.regex) {
+        next->re = QRegularExpression(options.pattern, options.cs == Qt::CaseInsensitive
+                                                           ? QRegularExpression::CaseInsensitiveOption
+                                                           : QRegularExpression::NoPatternOption);
+        if (!next->re.isValid()) {
+            if (errorString)
+                *errorString = next->re.errorString();
+            return false;
+        }
+        next->re.optimize();
+    } else if (options.cs == Qt::CaseSensitive) {
+        bool ascii = true;
+        for (QChar c : options.pattern)
+            ascii = ascii && c.unicode() < 0x80;
+        if (ascii) {
+            next->bytePattern.setPattern(options.pattern.toLatin1());
+            next->byteFilter = true;
+        }
+    }
+
+    run = next;
+    timer.start();
+    QThreadPool *workers = pool;
+    pool->start([next, workers]() { walkTree(next, workers); });
+    drainTimer->start();
+    return true;
+}
+
+void KpadFileSearch::cancel() {
+    if (!run)
+        return;
+    run->cancel.storeRelaxed(1);
+    run.reset();
+    drainTimer->stop();
+}
+
+void KpadFileSearch::drain() {
+    if (!run)
+        return;
+
+    // Read before taking the hits: anything found after this is in the
+    // next drain, and done means nothing can be found any more
+    const bool done = !run->walking.loadAcquire() && run->outstanding.loadAcquire() == 0;
+    QVector<KpadFileHit> hits;
+    {
+        QMutexLocker locker(&run->mutex);
+        hits.swap(run->pending);
+    }
+    if (!hits.isEmpty())
+        emit hitsFound(hits);
+    emit progress(run->filesSearched.loadRelaxed(), run->filesListed.loadRelaxed());
+
+    if (done) {
+        const std::shared_ptr<KpadFileSearchRun> finishedRun = run;
+        run.reset();
+        drainTimer->stop();
+        emit finished(finishedRun->filesSearched.loadRelaxed(), finishedRun->hitCount.loadRelaxed(),
+                      finishedRun->truncated.loadRelaxed(), timer.elapsed());
+    }
+}
+
+// --------------------
+// KpadFileHitModel
+// --------------------
+KpadFileHitModel::KpadFileHitModel(QObject *parent)
+    : QAbstractListModel(parent)
+{
+}
+
+void KpadFileHitModel::reset(const QString &rootPath) {
+    beginResetModel();
+    root = QDir(rootPath);
+    hits.clear();
+    endResetModel();
+}
+
+void KpadFileHitModel::append(const QVector<KpadFileHit> &more) {
+    if (more.isEmpty())
+        return;
+    beginInsertRows(QModelIndex(), hits.size(), hits.size() + more.size() - 1);
+    hits += more;
+    endInsertRows();
+}
+
+int KpadFileHitModel::rowCount(const QModelIndex &parent) const {
+    return parent.isValid() ? 0 : hits.size();
+}
+
+QVariant KpadFileHitModel::data(const QModelIndex &index, int role) const {
+    if (!index.isValid() || index.row() >= hits.size())
+        return QVariant();
+    const KpadFileHit &hit = hits.at(index.row());
+    if (role == Qt::DisplayRole)
+        return QString("%1:%2: %3").arg(root.relativeFilePath(hit.filePath)).arg(hit.line + 1).arg(hit.text.trimmed());
+    if (role == Qt::ToolTipRole)
+        return QDir::toNativeSeparators(hit.filePath);
+    return QVariant();
+}
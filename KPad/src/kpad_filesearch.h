@@ -0,0 +1,103 @@
+#ifndef KPAD_FILESEARCH_H
+#define KPAD_FILESEARCH_H
+
+#include <QAbstractListModel>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <memory>
+
+class QThreadPool;
+class QTimer;
+struct KpadFileSearchRun;
+
+// One matching line in a file
+struct KpadFileHit
+{
+    QString filePath;
+    qint64 line = -1;               // 0-based
+    int column = 0;                 // of the match, in characters into the line
+    int length = 0;
+    QString text;                   // the line, cut to kMaxHitText characters
+};
+
+// Find in Files: searches every file under a directory.
+// A walker lists the tree on a pool thread and hands out small batches of
+// paths; whichever pool thread is idle takes the next batch, so one huge
+// file never holds up the rest. Files are memory-mapped, binary files
+// skipped, and text decoded as the editor loads it. Case-sensitive
+// literal searches test the raw bytes first, so files without a match are
+// never decoded. Hits are collected under a mutex and handed to the GUI
+// thread in one batch every kDrainMsecs, however fast they are found.
+class KpadFileSearch : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Options
+    {
+        QString root;
+        QString pattern;
+        bool regex = false;
+        Qt::CaseSensitivity cs = Qt::CaseInsensitive;
+        QStringList nameFilters;    // e.g. "*.txt"; empty for every file
+    };
+
+    explicit KpadFileSearch(QObject *parent = nullptr);
+    ~KpadFileSearch();              // Cancels and waits for the workers
+
+    // Cancels a running search first; errorString is set when the pattern
+    // or directory is unusable
+    bool start(const Options &options, QString *errorString = nullptr);
+    // Stops at once: no more signals for this search, and the workers
+    // drop out after the file they are on
+    void cancel();
+    bool isRunning() const { return run != nullptr; }
+
+    static constexpr int kMaxHits = 100000;         // the search stops there
+    static constexpr int kMaxHitsPerFile = 1000;
+    static constexpr int kMaxHitText = 200;
+    static constexpr qint64 kMaxFileBytes = qint64(1) << 30;  // document offsets are ints
+
+signals:
+    void hitsFound(const QVector<KpadFileHit> &hits);
+    void progress(qint64 filesSearched, qint64 filesListed);
+    // truncated: stopped at kMaxHits
+    void finished(qint64 filesSearched, qint64 hits, bool truncated, qint64 msecs);
+
+private:
+    void drain();
+
+    static constexpr int kDrainMsecs = 100;
+
+    std::shared_ptr<KpadFileSearchRun> run;
+    QThreadPool *pool;
+    QTimer *drainTimer;
+    QElapsedTimer timer;
+};
+
+// The hits of one search as a flat list, appended to in batches.
+// Shown as "relative/path:line: text".
+class KpadFileHitModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+    explicit KpadFileHitModel(QObject *parent = nullptr);
+
+    void reset(const QString &rootPath);
+    void append(const QVector<KpadFileHit> &hits);
+    const KpadFileHit &hit(int row) const { return hits.at(row); }
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+private:
+    QDir root;                      // paths are shown relative to it
+    QVector<KpadFileHit> hits;
+};
+
+#endif // KPAD_FILESEARCH_H
@@ -0,0 +1,504 @@
+#include "kpad.h"
+#include "ui_kpad.h"
+#include "kpad_search.h"
+#include "kpad_largeview.h"
+#include "kpad_metrics.h"
+#include "kpad_undo.h"
+
+#include <QInputDialog>
+#include <QPointer>
+#include <QtConcurrent>
+#include <algorithm>
+#include <utility>
+
+// Edits spanning more lines than this are re-searched in the background
+static const int kLocalRescanChars = 256 * 1024;
+
+// --------------------
+// Find Box
+// --------------------
+// Matches are found on a worker thread into findMatches, a sorted index of
+// plain-text offsets. They are shown as extra selections (an overlay), so
+// the document's formats, undo stack and modified flag are never touched,
+// and only the matches inside the viewport are handed to the editor.
+void Kpad::highlightMatches(const QString &pattern) {
+    KPAD_TRACE_SCOPE(HighlightMatches);
+    findPattern = pattern;
+    startFind();
+}
+
+void Kpad::startFind() {
+    findTimer->stop();
+
+    // Tell a search that is still running to give up
+    if (findCancel)
+        findCancel->storeRelaxed(1);
+    findCancel.reset();
+
+    // The large-file viewer searches on demand (next/previous) instead
+    if (largeView->isOpen()) {
+        findMatches.clear();
+        updateFindStatus();
+        return;
+    }
+
+    const bool regexMode = regexButton->isChecked();
+    if (findPattern.isEmpty() || (regexMode && !compileFindRegex())) {
+        findMatches.clear();
+        paintVisibleMatches();
+        updateFindStatus();
+        return;
+    }
+    if (!regexMode)
+        setFindBoxError(QString());
+
+    auto cancel = std::make_shared<QAtomicInt>(0);
+    findCancel = cancel;
+
+    const KpadTextSnapshot snapshot = documentSnapshot();
+    const QString pattern = findPattern;
+    const QRegularExpression regex = findRegex;
+    // Searches given up on may still be finishing their current slice;
+    // this one does not queue behind them
+    if (findPool->activeThreadCount() >= findPool->maxThreadCount())
+        findPool->setMaxThreadCount(findPool->activeThreadCount() + 1);
+    findWatcher->setFuture(QtConcurrent::run(findPool, [snapshot, pattern, regex, regexMode, cancel]() {
+        if (regexMode)
+            return KpadSearch::findRegex(snapshot, regex, cancel.get());
+        return KpadSearch::findLiteral(snapshot, pattern, Qt::CaseInsensitive, cancel.get());
+    }));
+    updateFindStatus();
+}
+
+// Recompiles only when the pattern text changed, so the re-search after
+// every edit reuses the optimized expression.
+bool Kpad::compileFindRegex() {
+    if (findRegex.pattern() != findPattern) {
+        findRegex = QRegularExpression(findPattern, QRegularExpression::CaseInsensitiveOption);
+        findRegex.optimize();
+    }
+
+    setFindBoxError(findRegex.isValid() ? QString() : findRegex.errorString());
+    return findRegex.isValid();
+}
+
+void Kpad::setFindBoxError(const QString &error) {
+    findBox->setStyleSheet(error.isEmpty() ? QString() : QString("QLineEdit { color: #c62828; }"));
+    findBox->setToolTip(error);
+}
+
+void Kpad::findFinished() {
+    // The document changed while searching; the re-search is already queued
+    if (findTimer->isActive() || !findCancel || findCancel->loadRelaxed())
+        return;
+
+    findCancel.reset();
+    findMatches = findWatcher->result();
+    paintVisibleMatches();
+    updateFindStatus();
+}
+
+// Keeps the index in step with the document. Matches never span lines, so
+// in literal mode only the lines the edit touched are searched again (on
+// this thread) and the matches after them are shifted, in place. A regex
+// can take any time on a line, so in regex mode the edited lines' matches
+// are dropped and the worker searches again once typing pauses.
+void Kpad::shiftMatches(int position, int charsRemoved, int charsAdded) {
+    // What a Replace All is still searching was found in the old text
+    if (replaceCancel) {
+        replaceCancel->storeRelaxed(1);
+        replaceCancel.reset();
+        statusBar()->showMessage("Replace All stopped: the document changed while searching", 4000);
+    }
+    if (findPattern.isEmpty() || replacingAll)
+        return;
+
+    QTextDocument *doc = textEdit->document();
+    const int docLength = doc->characterCount() - 1;  // without the final separator
+    const int delta = charsAdded - charsRemoved;
+
+    // Edited lines, in new document offsets
+    const int from = doc->findBlock(qMin(position, docLength)).position();
+    const QTextBlock lastBlock = doc->findBlock(qMin(position + charsAdded, docLength));
+    const int to = qMin(lastBlock.position() + lastBlock.length() - 1, docLength);
+
+    // While a full search is running, or after a huge edit (a file was
+    // loaded), shift what we have and search again once typing pauses
+    const bool local = !findCancel && to - from <= kLocalRescanChars;
+    const bool rescan = local && !regexButton->isChecked();
+
+    // Range of old matches to drop, in old document offsets
+    const int dropFrom = local ? from : position;
+    const int dropTo = local ? to - delta : position + charsRemoved;
+
+    auto first = std::lower_bound(findMatches.cbegin(), findMatches.cend(), dropFrom,
+                                  [](const KpadMatch &match, int pos) {
+                                      return match.start + match.length <= pos;
+                                  });
+    auto last = std::lower_bound(first, findMatches.cend(), dropTo,
+                                 [](const KpadMatch &match, int pos) {
+                                     return match.start < pos;
+                                 });
+    const int index = int(first - findMatches.cbegin());
+    const int dropped = int(last - first);
+
+    QVector<KpadMatch> found;
+    if (rescan && to > from) {
+        const KpadTextSnapshot lines = KpadTextSnapshot::fromString(documentText(from, to - from));
+        found = KpadSearch::findLiteral(lines, findPattern, Qt::CaseInsensitive);
+    }
+
+    // Shift the matches after the edit, then splice the new ones in
+    if (delta != 0) {
+        for (int i = index + dropped; i < findMatches.size(); ++i)
+            findMatches[i].start += delta;
+    }
+    const int kept = qMin(dropped, int(found.size()));
+    if (dropped > kept)
+        findMatches.remove(index + kept, dropped - kept);
+    else if (found.size() > kept)
+        findMatches.insert(index + kept, int(found.size()) - kept, KpadMatch());
+    for (int i = 0; i < found.size(); ++i)
+        findMatches[index + i] = {from + found[i].start, found[i].length};
+
+    paintVisibleMatches();
+    updateFindStatus();
+    if (!rescan)
+        findTimer->start();
+}
+
+void Kpad::paintVisibleMatches() {
+    QList<QTextEdit::ExtraSelection> selections;
+
+    if (!findMatches.isEmpty()) {
+        // Document range currently on screen
+        const QRect area = textEdit->viewport()->rect();
+        const int top = textEdit->cursorForPosition(area.topLeft()).position();
+        const int bottom = textEdit->cursorForPosition(area.bottomRight()).position();
+
+        auto it = std::lower_bound(findMatches.cbegin(), findMatches.cend(), top,
+                                   [](const KpadMatch &match, int pos) {
+                                       return match.start + match.length <= pos;
+                                   });
+
+        QTextDocument *doc = textEdit->document();
+        for (; it != findMatches.cend() && it->start <= bottom; ++it) {
+            QTextEdit::ExtraSelection selection;
+            selection.cursor = QTextCursor(doc);
+            selection.cursor.setPosition(it->start);
+            selection.cursor.setPosition(it->start + it->length, QTextCursor::KeepAnchor);
+            selection.format = highlightFormat;
+            selections.append(selection);
+        }
+    }
+
+    textEdit->setExtraSelections(selections);
+}
+
+// --------------------
+// Match Navigation
+// --------------------
+// Next/previous are binary searches in the match index from the cursor,
+// wrapping around at either end of the document.
+void Kpad::findNext() {
+    if (largeView->isOpen()) {
+        if (!findPattern.isEmpty()) {
+            findCountLabel->setText("Searching...");
+            largeView->find(findPattern, true);
+        }
+        return;
+    }
+
+    if (findMatches.isEmpty()) {
+        statusBar()->showMessage(findPattern.isEmpty() ? "Nothing to find" : "No matches", 2000);
+        return;
+    }
+
+    const int from = textEdit->textCursor().selectionEnd();
+    auto it = std::lower_bound(findMatches.cbegin(), findMatches.cend(), from,
+                               [](const KpadMatch &match, int pos) {
+                                   return match.start < pos;
+                               });
+    if (it == findMatches.cend()) {
+        it = findMatches.cbegin();
+        statusBar()->showMessage("Search wrapped to the top", 2000);
+    }
+    selectMatch(*it);
+}
+
+void Kpad::findPrevious() {
+    if (largeView->isOpen()) {
+        if (!findPattern.isEmpty()) {
+            findCountLabel->setText("Searching...");
+            largeView->find(findPattern, false);
+        }
+        return;
+    }
+
+    if (findMatches.isEmpty()) {
+        statusBar()->showMessage(findPattern.isEmpty() ? "Nothing to find" : "No matches", 2000);
+        return;
+    }
+
+    const int from = textEdit->textCursor().selectionStart();
+    auto it = std::lower_bound(findMatches.cbegin(), findMatches.cend(), from,
+                               [](const KpadMatch &match, int pos) {
+                                   return match.start < pos;
+                               });
+    if (it == findMatches.cbegin()) {
+        it = findMatches.cend();
+        statusBar()->showMessage("Search wrapped to the bottom", 2000);
+    }
+    selectMatch(*(it - 1));
+}
+
+void Kpad::selectMatch(const KpadMatch &match) {
+    QTextCursor cursor(textEdit->document());
+    cursor.setPosition(match.start);
+    cursor.setPosition(match.start + match.length, QTextCursor::KeepAnchor);
+    textEdit->setTextCursor(cursor);  // also scrolls it into view
+}
+
+// "i of N" when the selection is a match, otherwise the match count
+void Kpad::updateFindStatus() {
+    if (findPattern.isEmpty() || largeView->isOpen()) {
+        findCountLabel->clear();
+        return;
+    }
+    if (findCancel) {
+        findCountLabel->setText("Searching...");
+        return;
+    }
+
+    const QTextCursor cursor = textEdit->textCursor();
+    auto it = std::lower_bound(findMatches.cbegin(), findMatches.cend(), cursor.selectionStart(),
+                               [](const KpadMatch &match, int pos) {
+                                   return match.start < pos;
+                               });
+    const bool onMatch = it != findMatches.cend() && it->start == cursor.selectionStart()
+                         && it->start + it->length == cursor.selectionEnd();
+
+    if (onMatch)
+        findCountLabel->setText(QString("%1 of %2").arg(int(it - findMatches.cbegin()) + 1).arg(findMatches.size()));
+    else
+        findCountLabel->setText(findMatches.size() == 1 ? QString("1 match")
+                                                        : QString("%1 matches").arg(findMatches.size()));
+}
+
+void Kpad::largeFindFinished(bool found, qint64 line) {
+    findCountLabel->clear();
+    if (found)
+        statusBar()->showMessage(QString("Match on line %1").arg(line + 1), 3000);
+    else if (largeView->isIndexing())
+        statusBar()->showMessage("No matches in the indexed part of the file", 3000);
+    else
+        statusBar()->showMessage("No matches", 3000);
+}
+
+// --------------------
+// Go to Line
+// --------------------
+void Kpad::goToLine() {
+    const bool viewing = largeView->isOpen();
+    const qint64 lines = viewing ? largeView->lineCount() : textEdit->document()->blockCount();
+    const int current = viewing ? int(largeView->topLine()) + 1 : textEdit->textCursor().blockNumber() + 1;
+
+    bool ok = false;
+    const int line = QInputDialog::getInt(this, "Go to Line", QString("Line (1 - %1):").arg(lines),
+                                          current, 1, int(qMin<qint64>(lines, INT_MAX)), 1, &ok);
+    if (!ok)
+        return;
+
+    if (viewing) {
+        largeView->goToLine(line - 1);
+        largeView->setFocus();
+        return;
+    }
+
+    textEdit->setTextCursor(QTextCursor(textEdit->document()->findBlockByNumber(line - 1)));
+    textEdit->setFocus();
+}
+
+// --------------------
+// Replace
+// --------------------
+// Replace All finds every match on a worker thread, in one pass over a
+// snapshot, then builds the replaced text in one buffer and puts it in
+// with a single cursor edit inside one edit block: one undo step, and one
+// contentsChange for the piece table, counters, journal and highlighter,
+// however many matches. Rich documents get one edit per match instead
+// (still in one block, newest first so offsets hold) so each keeps its
+// formatting. The match index is left alone while the edits go in, and
+// searched again afterwards.
+
+// The text for each match. In regex mode \0 - \9 are expanded against
+// the match's line, which is cut out of source once for all its matches.
+namespace {
+struct Replacer
+{
+    const QString &source;          // whole lines of the document
+    const QRegularExpression &re;
+    const QString &replacement;
+    bool expand;
+    int lineStart = 0;
+    int lineEnd = -1;
+    QString line;
+
+    QString textFor(const KpadMatch &match, int offset) {
+        if (!expand)
+            return replacement;
+        if (offset < lineStart || offset > lineEnd) {
+            // a match never spans lines
+            lineStart = offset > 0 ? int(source.lastIndexOf(QLatin1Char('\n'), offset - 1)) + 1 : 0;
+            lineEnd = int(source.indexOf(QLatin1Char('\n'), offset + match.length));
+            if (lineEnd < 0)
+                lineEnd = int(source.size());
+            line = source.mid(lineStart, lineEnd - lineStart);
+        }
+        return KpadSearch::expandReplacement(line, offset - lineStart, re, replacement);
+    }
+};
+}
+
+void Kpad::replaceAll() {
+    if (findPattern.isEmpty() || largeView->isOpen() || textEdit->isReadOnly())
+        return;
+    const bool regexMode = regexButton->isChecked();
+    if (regexMode && !compileFindRegex())
+        return;
+
+    // A Replace All still searching is superseded
+    if (replaceCancel)
+        replaceCancel->storeRelaxed(1);
+    auto cancel = std::make_shared<QAtomicInt>(0);
+    replaceCancel = cancel;
+
+    QElapsedTimer timer;
+    timer.start();
+    QPointer<QTextDocument> document = textEdit->document();
+    const KpadTextSnapshot snapshot = documentSnapshot();
+    const QString pattern = findPattern;
+    const QRegularExpression regex = findRegex;
+    const QString replacement = replaceBox->text();
+
+    QFutureWatcher<QVector<KpadMatch>> *search = new QFutureWatcher<QVector<KpadMatch>>(this);
+    connect(search, &QFutureWatcher<QVector<KpadMatch>>::finished, this, [=]() {
+        search->deleteLater();
+        // An edit cancels it (see shiftMatches()); the matches are only
+        // good for the text they were found in
+        if (cancel->loadRelaxed())
+            return;
+        replaceCancel.reset();
+        if (document != textEdit->document() || textEdit->isReadOnly()) {
+            statusBar()->showMessage("Replace All stopped: the document changed while searching", 4000);
+            return;
+        }
+        applyReplaceAll(snapshot, search->result(), regex, replacement,
+                        regexMode && replacement.contains(QLatin1Char('\\')), timer);
+    });
+    if (findPool->activeThreadCount() >= findPool->maxThreadCount())
+        findPool->setMaxThreadCount(findPool->activeThreadCount() + 1);
+    search->setFuture(QtConcurrent::run(findPool, [snapshot, pattern, regex, regexMode, cancel]() {
+        if (regexMode)
+            return KpadSearch::findRegex(snapshot, regex, cancel.get());
+        return KpadSearch::findLiteral(snapshot, pattern, Qt::CaseInsensitive, cancel.get());
+    }));
+    statusBar()->showMessage("Replace All: searching...");
+}
+
+// Puts the replacements for matches, found in snapshot (still the
+// document's text), into the document
+void Kpad::applyReplaceAll(const KpadTextSnapshot &snapshot, const QVector<KpadMatch> &matches,
+                           const QRegularExpression &regex, const QString &replacement, bool expand,
+                           const QElapsedTimer &timer) {
+    if (matches.isEmpty()) {
+        statusBar()->showMessage("No matches", 2000);
+        return;
+    }
+
+    // The span from the first match's line to the last match's line
+    QTextDocument *doc = textEdit->document();
+    const int from = doc->findBlock(matches.first().start).position();
+    const QTextBlock lastBlock = doc->findBlock(matches.last().start + matches.last().length);
+    const int to = qMin(lastBlock.position() + lastBlock.length() - 1, snapshot.length());
+    const QString source = snapshot.mid(from, to - from);
+    Replacer replacer{source, regex, replacement, expand};
+
+    // Where the cursor and the view were, to put them back afterwards
+    const int cursorPos = textEdit->textCursor().position();
+    int cursorShift = 0;
+    const int scroll = textEdit->verticalScrollBar()->value();
+
+    // The old index would be shifted edit by edit; search again afterwards
+    findMatches.clear();
+    replacingAll = true;
+
+    // A plain document is rewritten as one span, which KpadUndoStack keeps
+    // cheaply. Once it has been formatted (its stack retired) that would wipe
+    // the formats inside the span, so each match is replaced on its own.
+    QTextCursor cursor(doc);
+    cursor.beginEditBlock();
+    if (pieceTableActive && !KpadUndoStack::of(doc)->isRetired()) {
+        QString text;
+        text.reserve(source.size() + qMax(0, int(replacement.size()) - matches.first().length) * matches.size());
+        int copied = 0;
+        for (const KpadMatch &match : matches) {
+            const int offset = match.start - from;
+            text.append(source.constData() + copied, offset - copied);
+            const QString with = replacer.textFor(match, offset);
+            text += with;
+            copied = offset + match.length;
+            if (match.start + match.length <= cursorPos)
+                cursorShift += int(with.size()) - match.length;
+        }
+        text.append(source.constData() + copied, source.size() - copied);
+
+        cursor.setPosition(from);
+        cursor.setPosition(to, QTextCursor::KeepAnchor);
+        cursor.insertText(text);
+    } else {
+        for (int i = matches.size() - 1; i >= 0; --i) {
+            const KpadMatch &match = matches[i];
+            const QString with = replacer.textFor(match, match.start - from);
+            cursor.setPosition(match.start);
+            cursor.setPosition(match.start + match.length, QTextCursor::KeepAnchor);
+            cursor.insertText(with);
+            if (match.start + match.length <= cursorPos)
+                cursorShift += int(with.size()) - match.length;
+        }
+    }
+    cursor.endEditBlock();
+    replacingAll = false;
+
+    cursor.setPosition(qBound(0, cursorPos + cursorShift, doc->characterCount() - 1));
+    textEdit->setTextCursor(cursor);
+    textEdit->verticalScrollBar()->setValue(scroll);
+    startFind();
+    statusBar()->showMessage(QString("Replaced %1 matches in %2 ms").arg(matches.size()).arg(timer.elapsed()), 4000);
+}
+
+// Replaces the selected match, if it is one, and selects the next
+void Kpad::replaceNext() {
+    if (findPattern.isEmpty() || largeView->isOpen() || textEdit->isReadOnly())
+        return;
+
+    QTextCursor cursor = textEdit->textCursor();
+    auto it = std::lower_bound(findMatches.cbegin(), findMatches.cend(), cursor.selectionStart(),
+                               [](const KpadMatch &match, int pos) {
+                                   return match.start < pos;
+                               });
+    if (it != findMatches.cend() && it->start == cursor.selectionStart()
+        && it->start + it->length == cursor.selectionEnd()) {
+        const QString replacement = replaceBox->text();
+        QString with = replacement;
+        if (regexButton->isChecked() && replacement.contains(QLatin1Char('\\'))) {
+            const QTextBlock block = cursor.block();
+            QString line = block.text();
+            KpadPieceTable::normalize(line);
+            with = KpadSearch::expandReplacement(line, it->start - block.position(), findRegex, replacement);
+        }
+        cursor.insertText(with);
+        textEdit->setTextCursor(cursor);
+    }
+    findNext();
+}
@@ -0,0 +1,159 @@
+#include "kpad.h"
+#include "ui_kpad.h"
+#include "kpad_largeview.h"
+
+#include <QDir>
+#include <QGridLayout>
+
+// --------------------
+// Find in Files
+// --------------------
+// A dock under the editor. The search runs in KpadFileSearch; its hits are
+// appended to the list in batches, so the window stays responsive however
+// many files there are. Activating a hit opens the file (or shows its tab)
+// and selects the match, once the file has finished loading.
+void Kpad::createFindInFiles() {
+    findFilesDock = new QDockWidget("Find in Files", this);
+    findFilesDock->setObjectName("findFilesDock");
+    QWidget *panel = new QWidget(findFilesDock);
+    QGridLayout *layout = new QGridLayout(panel);
+    layout->setContentsMargins(4, 4, 4, 4);
+
+    findFilesPattern = new QLineEdit(panel);
+    findFilesPattern->setPlaceholderText("Find...");
+    findFilesFolder = new QLineEdit(QDir::homePath(), panel);
+    findFilesFolder->setPlaceholderText("Folder");
+    QPushButton *browseButton = new QPushButton("...", panel);
+    browseButton->setToolTip("Choose the folder to search");
+    browseButton->setMaximumWidth(30);
+    findFilesFilter = new QLineEdit(panel);
+    findFilesFilter->setPlaceholderText("Files (e.g. *.txt *.md; empty for all)");
+    findFilesRegex = new QCheckBox("Regex", panel);
+    findFilesCase = new QCheckBox("Match case", panel);
+    findFilesButton = new QPushButton("Search", panel);
+    findFilesStatus = new QLabel(panel);
+
+    // The list only ever appends and every row is one line of text
+    findFilesList = new QListView(panel);
+    findFilesList->setUniformItemSizes(true);
+    findFilesList->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    fileHits = new KpadFileHitModel(this);
+    findFilesList->setModel(fileHits);
+
+    layout->addWidget(findFilesPattern, 0, 0, 1, 2);
+    layout->addWidget(findFilesRegex, 0, 2);
+    layout->addWidget(findFilesCase, 0, 3);
+    layout->addWidget(findFilesButton, 0, 4);
+    layout->addWidget(findFilesFolder, 1, 0);
+    layout->addWidget(browseButton, 1, 1);
+    layout->addWidget(findFilesFilter, 1, 2, 1, 3);
+    layout->addWidget(findFilesList, 2, 0, 1, 5);
+    layout->addWidget(findFilesStatus, 3, 0, 1, 5);
+    layout->setColumnStretch(0, 1);
+    findFilesDock->setWidget(panel);
+    addDockWidget(Qt::BottomDockWidgetArea, findFilesDock);
+    findFilesDock->hide();
+
+    fileSearch = new KpadFileSearch(this);
+    connect(fileSearch, &KpadFileSearch::hitsFound, fileHits, &KpadFileHitModel::append);
+    connect(fileSearch, &KpadFileSearch::progress, this, [=](qint64 searched, qint64 listed) {
+        findFilesStatus->setText(QString("Searching... %1 of %2 files, %3 matches")
+                                     .arg(searched).arg(listed).arg(fileHits->rowCount()));
+    });
+    connect(fileSearch, &KpadFileSearch::finished, this, &Kpad::fileSearchFinished);
+
+    connect(findFilesButton, &QPushButton::clicked, this, &Kpad::startFileSearch);
+    connect(findFilesPattern, &QLineEdit::returnPressed, this, &Kpad::startFileSearch);
+    connect(findFilesFolder, &QLineEdit::returnPressed, this, &Kpad::startFileSearch);
+    connect(findFilesFilter, &QLineEdit::returnPressed, this, &Kpad::startFileSearch);
+    connect(browseButton, &QPushButton::clicked, this, [=]() {
+        const QString folder = QFileDialog::getExistingDirectory(this, "Find in Files", findFilesFolder->text());
+        if (!folder.isEmpty())
+            findFilesFolder->setText(QDir::toNativeSeparators(folder));
+    });
+    connect(findFilesList, &QListView::activated, this, &Kpad::openFileHit);
+}
+
+void Kpad::showFindInFiles() {
+    findFilesDock->show();
+    findFilesDock->raise();
+    // Start from what is selected in the editor, as the find box would
+    const QString selected = textEdit->textCursor().selectedText();
+    if (!selected.isEmpty() && !selected.contains(QChar::ParagraphSeparator))
+        findFilesPattern->setText(selected);
+    findFilesPattern->setFocus();
+    findFilesPattern->selectAll();
+}
+
+void Kpad::startFileSearch() {
+    // The button doubles as Stop
+    if (fileSearch->isRunning()) {
+        fileSearch->cancel();
+        findFilesButton->setText("Search");
+        findFilesStatus->setText(QString("Stopped, %1 matches").arg(fileHits->rowCount()));
+        return;
+    }
+
+    KpadFileSearch::Options options;
+    options.root = QDir::fromNativeSeparators(findFilesFolder->text().trimmed());
+    options.pattern = findFilesPattern->text();
+    options.regex = findFilesRegex->isChecked();
+    options.cs = findFilesCase->isChecked() ? Qt::CaseSensitive : Qt::CaseInsensitive;
+    options.nameFilters = findFilesFilter->text().split(QRegularExpression("[\\s;,]+"), Qt::SkipEmptyParts);
+
+    fileHits->reset(options.root);
+    QString errorString;
+    if (!fileSearch->start(options, &errorString)) {
+        findFilesStatus->setText(errorString);
+        return;
+    }
+    findFilesButton->setText("Stop");
+    findFilesStatus->setText("Searching...");
+}
+
+void Kpad::fileSearchFinished(qint64 files, qint64 hits, bool truncated, qint64 msecs) {
+    findFilesButton->setText("Search");
+    findFilesStatus->setText(QString("%1 matches in %2 files searched, %3 ms%4")
+                                 .arg(hits).arg(files).arg(msecs)
+                                 .arg(truncated ? QString(" (stopped at %1)").arg(KpadFileSearch::kMaxHits)
+                                                : QString()));
+}
+
+void Kpad::openFileHit(const QModelIndex &index) {
+    if (!index.isValid())
+        return;
+    pendingJump = fileHits->hit(index.row());
+    openPath(pendingJump.filePath);
+    applyPendingJump();
+}
+
+// Selects pendingJump once its file is in the editor or the viewer; called
+// again when a streaming load, HTML import or viewer index finishes
+void Kpad::applyPendingJump() {
+    if (pendingJump.line < 0 || fileLoader || htmlLoader || largeView->isIndexing())
+        return;
+    const KpadFileHit hit = pendingJump;
+    pendingJump = KpadFileHit();
+
+    if (largeView->isOpen()) {
+        if (QFileInfo(largeView->filePath()) != QFileInfo(hit.filePath))
+            return;
+        largeView->goToLine(hit.line);
+        largeView->setFocus();
+        return;
+    }
+    if (QFileInfo(currentFile) != QFileInfo(hit.filePath))
+        return;
+
+    const QTextBlock block = textEdit->document()->findBlockByNumber(int(qMin<qint64>(hit.line, INT_MAX)));
+    if (!block.isValid())
+        return;
+    const int start = block.position() + qMin(hit.column, block.length() - 1);
+    const int end = block.position() + qMin(hit.column + hit.length, block.length() - 1);
+    QTextCursor cursor(textEdit->document());
+    cursor.setPosition(start);
+    cursor.setPosition(end, QTextCursor::KeepAnchor);
+    textEdit->setTextCursor(cursor);
+    textEdit->ensureCursorVisible();
+    textEdit->setFocus();
+}
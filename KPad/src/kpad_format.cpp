@@ -0,0 +1,61 @@
+#include "kpad_format.h"
+
+#include <QTextBlock>
+#include <QTextCursor>
+#include <QVector>
+
+namespace {
+
+struct SizeRun
+{
+    int start;
+    int length;
+    qreal size;                     // new point size
+};
+
+} // namespace
+
+int kpadScaleFontSize(QTextDocument *doc, int start, int end, int delta, qreal defaultSize) {
+    // Collect first: formatting splits and joins fragments under the iterator
+    QVector<SizeRun> runs;
+    for (QTextBlock block = doc->findBlock(start); block.isValid() && block.position() < end; block = block.next()) {
+        for (QTextBlock::iterator it = block.begin(); !it.atEnd(); ++it) {
+            const QTextFragment fragment = it.fragment();
+            const int from = qMax(start, fragment.position());
+            const int to = qMin(end, fragment.position() + fragment.length());
+            if (from >= to)
+                continue;
+
+            qreal size = fragment.charFormat().fontPointSize();
+            if (size <= 0)
+                size = defaultSize;
+            const qreal newSize = qMax<qreal>(1, size + delta);
+
+            // Join with the previous run if nothing but a paragraph break
+            // lies between them and the new size is the same
+            if (!runs.isEmpty()) {
+                SizeRun &last = runs.last();
+                const int lastEnd = last.start + last.length;
+                const bool adjacent = lastEnd == from || (lastEnd + 1 == from && from == block.position());
+                if (adjacent && qFuzzyCompare(last.size, newSize)) {
+                    last.length = to - last.start;
+                    continue;
+                }
+            }
+            runs.append({from, to - from, newSize});
+        }
+    }
+
+    QTextCursor cursor(doc);
+    cursor.beginEditBlock();
+    for (const SizeRun &run : std::as_const(runs)) {
+        QTextCharFormat format;
+        format.setFontPointSize(run.size);
+        cursor.setPosition(run.start);
+        cursor.setPosition(run.start + run.length, QTextCursor::KeepAnchor);
+        cursor.mergeCharFormat(format);
+    }
+    cursor.endEditBlock();
+
+    return runs.size();
+}
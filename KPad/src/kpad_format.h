@@ -0,0 +1,14 @@
+#ifndef KPAD_FORMAT_H
+#define KPAD_FORMAT_H
+
+#include <QTextDocument>
+
+// Adds delta points to the font size of every character in [start, end),
+// as one undo step. Work is per format run (QTextFragment), not per
+// character: neighbouring runs that end up with the same size are joined
+// first, so each distinct size range gets a single mergeCharFormat().
+// Characters without an explicit size count as defaultSize.
+// Returns the number of ranges formatted.
+int kpadScaleFontSize(QTextDocument *doc, int start, int end, int delta, qreal defaultSize);
+
+#endif // KPAD_FORMAT_H
@@ -0,0 +1,587 @@
+#include "kpad_highlight.h"
+
+#include <QDir>
+#include <QElapsedTimer>
+#include <QEvent>
+#include <QFileInfo>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QScrollBar>
+#include <QStandardPaths>
+#include <QTextBlock>
+#include <QTextDocument>
+#include <QTextEdit>
+#include <QTextLayout>
+#include <QTimer>
+
+static const char *const kStyleNames[KpadGrammar::StyleCount] = {
+    "normal", "keyword", "type", "string", "number", "comment", "preprocessor", "function", "constant"
+};
+
+// --------------------
+// Built-in grammars
+// --------------------
+// Same format as the files users drop in the grammars folder
+static const char *const kBuiltinGrammars[] = {
+R"json({
+  "name": "C/C++",
+  "extensions": ["c", "h", "cpp", "cxx", "cc", "hpp", "hxx", "hh", "ino"],
+  "states": [
+    { "name": "code", "rules": [
+      { "match": "//.*", "style": "comment" },
+      { "match": "/\\*", "style": "comment", "next": "comment" },
+      { "match": "^\\s*#\\s*[A-Za-z_]+", "style": "preprocessor" },
+      { "match": "\"(?:[^\"\\\\]|\\\\.)*\"?", "style": "string" },
+      { "match": "'(?:[^'\\\\]|\\\\.)*'?", "style": "string" },
+      { "words": ["alignas", "alignof", "auto", "break", "case", "catch", "class", "const", "constexpr",
+                  "const_cast", "continue", "decltype", "default", "delete", "do", "dynamic_cast", "else",
+                  "enum", "explicit", "export", "extern", "final", "for", "friend", "goto", "if", "inline",
+                  "mutable", "namespace", "new", "noexcept", "operator", "override", "private", "protected",
+                  "public", "register", "reinterpret_cast", "return", "sizeof", "static", "static_assert",
+                  "static_cast", "struct", "switch", "template", "this", "throw", "try", "typedef",
+                  "typename", "union", "using", "virtual", "volatile", "while"], "style": "keyword" },
+      { "words": ["bool", "char", "char16_t", "char32_t", "double", "float", "int", "long", "short",
+                  "signed", "unsigned", "void", "wchar_t", "size_t", "int8_t", "int16_t", "int32_t",
+                  "int64_t", "uint8_t", "uint16_t", "uint32_t", "uint64_t"], "style": "type" },
+      { "words": ["true", "false", "nullptr", "NULL"], "style": "constant" },
+      { "match": "\\b(?:0[xX][0-9A-Fa-f']+|0[bB][01']+|\\d[\\d']*\\.?\\d*(?:[eE][+-]?\\d+)?)[uUlLfF]*\\b", "style": "number" },
+      { "match": "\\b[A-Za-z_]\\w*(?=\\s*\\()", "style": "function" } ] },
+    { "name": "comment", "style": "comment", "rules": [
+      { "match": "\\*/", "style": "comment", "next": "code" } ] } ]
+})json",
+R"json({
+  "name": "Python",
+  "extensions": ["py", "pyw", "pyi"],
+  "states": [
+    { "name": "code", "rules": [
+      { "match": "#.*", "style": "comment" },
+      { "match": "\\b[rRbBuUfF]{0,2}\"\"\"", "style": "string", "next": "docstring" },
+      { "match": "\\b[rRbBuUfF]{0,2}'''", "style": "string", "next": "docstring1" },
+      { "match": "\"\"\"", "style": "string", "next": "docstring" },
+      { "match": "'''", "style": "string", "next": "docstring1" },
+      { "match": "\"(?:[^\"\\\\]|\\\\.)*\"?", "style": "string" },
+      { "match": "'(?:[^'\\\\]|\\\\.)*'?", "style": "string" },
+      { "match": "^\\s*@[\\w.]+", "style": "preprocessor" },
+      { "words": ["and", "as", "assert", "async", "await", "break", "case", "class", "continue", "def",
+                  "del", "elif", "else", "except", "finally", "for", "from", "global", "if", "import",
+                  "in", "is", "lambda", "match", "nonlocal", "not", "or", "pass", "raise", "return",
+                  "try", "while", "with", "yield"], "style": "keyword" },
+      { "words": ["bool", "bytes", "dict", "float", "int", "list", "object", "set", "str", "tuple",
+                  "type"], "style": "type" },
+      { "words": ["True", "False", "None", "self", "cls"], "style": "constant" },
+      { "match": "\\b(?:0[xX][0-9A-Fa-f_]+|0[oO][0-7_]+|0[bB][01_]+|\\d[\\d_]*\\.?[\\d_]*(?:[eE][+-]?\\d+)?)[jJ]?\\b", "style": "number" },
+      { "match": "\\b[A-Za-z_]\\w*(?=\\s*\\()", "style": "function" } ] },
+    { "name": "docstring", "style": "string", "rules": [
+      { "match": "\\\\.", "style": "string" },
+      { "match": "\"\"\"", "style": "string", "next": "code" } ] },
+    { "name": "docstring1", "style": "string", "rules": [
+      { "match": "\\\\.", "style": "string" },
+      { "match": "'''", "style": "string", "next": "code" } ] } ]
+})json",
+R"json({
+  "name": "JavaScript",
+  "extensions": ["js", "mjs", "cjs", "jsx", "ts", "tsx"],
+  "states": [
+    { "name": "code", "rules": [
+      { "match": "//.*", "style": "comment" },
+      { "match": "/\\*", "style": "comment", "next": "comment" },
+      { "match": "\"(?:[^\"\\\\]|\\\\.)*\"?", "style": "string" },
+      { "match": "'(?:[^'\\\\]|\\\\.)*'?", "style": "string" },
+      { "match": "`", "style": "string", "next": "template" },
+      { "words": ["async", "await", "break", "case", "catch", "class", "const", "continue", "debugger",
+                  "default", "delete", "do", "else", "export", "extends", "finally", "for", "from",
+                  "function", "if", "import", "in", "instanceof", "interface", "let", "new", "of",
+                  "return", "static", "super", "switch", "throw", "try", "type", "typeof", "var",
+                  "void", "while", "with", "yield"], "style": "keyword" },
+      { "words": ["true", "false", "null", "undefined", "NaN", "Infinity", "this"], "style": "constant" },
+      { "match": "\\b(?:0[xX][0-9A-Fa-f_]+|0[bB][01_]+|\\d[\\d_]*\\.?[\\d_]*(?:[eE][+-]?\\d+)?)n?\\b", "style": "number" },
+      { "match": "\\b[A-Za-z_$][\\w$]*(?=\\s*\\()", "style": "function" } ] },
+    { "name": "comment", "style": "comment", "rules": [
+      { "match": "\\*/", "style": "comment", "next": "code" } ] },
+    { "name": "template", "style": "string", "rules": [
+      { "match": "\\\\.", "style": "string" },
+      { "match": "`", "style": "string", "next": "code" } ] } ]
+})json",
+R"json({
+  "name": "JSON",
+  "extensions": ["json"],
+  "states": [
+    { "name": "value", "rules": [
+      { "match": "\"(?:[^\"\\\\]|\\\\.)*\"(?=\\s*:)", "style": "type" },
+      { "match": "\"(?:[^\"\\\\]|\\\\.)*\"?", "style": "string" },
+      { "words": ["true", "false", "null"], "style": "constant" },
+      { "match": "-?\\b\\d+(?:\\.\\d+)?(?:[eE][+-]?\\d+)?\\b", "style": "number" } ] } ]
+})json",
+};
+
+// --------------------
+// Grammar
+// --------------------
+std::shared_ptr<const KpadGrammar> KpadGrammar::fromJson(const QByteArray &json, QString *errorString) {
+    auto fail = [errorString](const QString &message) {
+        if (errorString)
+            *errorString = message;
+        return std::shared_ptr<const KpadGrammar>();
+    };
+    auto styleByName = [](const QString &name, Style *style) {
+        for (int i = 0; i < StyleCount; ++i) {
+            if (name == QLatin1String(kStyleNames[i])) {
+                *style = Style(i);
+                return true;
+            }
+        }
+        return false;
+    };
+
+    QJsonParseError parseError;
+    const QJsonDocument document = QJsonDocument::fromJson(json, &parseError);
+    if (!document.isObject())
+        return fail(parseError.errorString());
+    const QJsonObject root = document.object();
+
+    auto grammar = std::make_shared<KpadGrammar>();
+    grammar->grammarName = root.value("name").toString();
+    if (grammar->grammarName.isEmpty())
+        return fail("no \"name\"");
+    for (const QJsonValue &suffix : root.value("extensions").toArray())
+        grammar->suffixes << suffix.toString().toLower();
+
+    const QJsonArray stateArray = root.value("states").toArray();
+    if (stateArray.isEmpty())
+        return fail("no \"states\"");
+    // Names first, so a rule may switch to a state defined after it
+    QHash<QString, int> stateIndex;
+    for (int i = 0; i < stateArray.size(); ++i)
+        stateIndex.insert(stateArray[i].toObject().value("name").toString(), i);
+    auto stateByName = [&](const QJsonValue &name, int *index) {
+        const auto it = stateIndex.constFind(name.toString());
+        if (it == stateIndex.constEnd())
+            return false;
+        *index = *it;
+        return true;
+    };
+
+    for (const QJsonValue &stateValue : stateArray) {
+        const QJsonObject object = stateValue.toObject();
+        State state;
+        state.name = object.value("name").toString();
+        if (!styleByName(object.value("style").toString("normal"), &state.style))
+            return fail(state.name + ": unknown style " + object.value("style").toString());
+        if (object.contains("lineEnd") && !stateByName(object.value("lineEnd"), &state.lineEnd))
+            return fail(state.name + ": unknown state " + object.value("lineEnd").toString());
+
+        QString pattern;
+        int group = 1;
+        for (const QJsonValue &ruleValue : object.value("rules").toArray()) {
+            const QJsonObject ruleObject = ruleValue.toObject();
+            QString match = ruleObject.value("match").toString();
+            if (ruleObject.contains("words")) {
+                QStringList words;
+                for (const QJsonValue &word : ruleObject.value("words").toArray())
+                    words << QRegularExpression::escape(word.toString());
+                match = "\\b(?:" + words.join('|') + ")\\b";
+            }
+            const QRegularExpression check(match);
+            if (match.isEmpty() || !check.isValid())
+                return fail(state.name + ": bad pattern " + match + " (" + check.errorString() + ")");
+
+            Rule rule;
+            rule.group = group;
+            rule.next = -1;
+            if (!styleByName(ruleObject.value("style").toString("normal"), &rule.style))
+                return fail(state.name + ": unknown style " + ruleObject.value("style").toString());
+            if (ruleObject.contains("next") && !stateByName(ruleObject.value("next"), &rule.next))
+                return fail(state.name + ": unknown state " + ruleObject.value("next").toString());
+            state.rules.append(rule);
+
+            if (!pattern.isEmpty())
+                pattern += '|';
+            pattern += '(' + match + ')';
+            group += 1 + check.captureCount();
+        }
+        // A state without rules runs to the end of the line
+        state.regex = QRegularExpression(pattern.isEmpty() ? QString("(?!)") : pattern);
+        state.regex.optimize();
+        grammar->states.append(state);
+    }
+    return grammar;
+}
+
+int KpadGrammar::lex(const QString &text, int state, QVector<Token> *tokens) const {
+    if (state < 0 || state >= states.size())
+        state = 0;
+
+    auto add = [tokens](int start, int length, Style style) {
+        if (length <= 0 || style == Normal)
+            return;
+        if (!tokens->isEmpty()) {
+            Token &last = tokens->last();
+            if (last.style == style && last.start + last.length == start) {
+                last.length += length;
+                return;
+            }
+        }
+        tokens->append({start, length, style});
+    };
+
+    const int length = text.size();
+    int pos = 0;
+    int emptyMatches = 0;   // in a row: rules that only switch state
+    while (pos < length) {
+        const State &current = states[state];
+        const QRegularExpressionMatch match = current.regex.match(text, pos);
+        if (!match.hasMatch()) {
+            add(pos, length - pos, current.style);
+            break;
+        }
+        const int start = match.capturedStart();
+        int end = match.capturedEnd();
+        add(pos, start - pos, current.style);
+
+        const Rule *rule = nullptr;
+        for (const Rule &candidate : current.rules) {
+            if (match.capturedStart(candidate.group) >= 0) {
+                rule = &candidate;
+                break;
+            }
+        }
+        if (rule)
+            add(start, end - start, rule->style);
+
+        // An empty match must not stall: step over one character unless it
+        // moves to another state (and that cannot go on forever)
+        if (end == start) {
+            if (!rule || rule->next < 0 || rule->next == state || ++emptyMatches > states.size()) {
+                add(start, 1, current.style);
+                end = start + 1;
+                emptyMatches = 0;
+            }
+        } else {
+            emptyMatches = 0;
+        }
+        pos = end;
+        if (rule && rule->next >= 0)
+            state = rule->next;
+    }
+
+    if (states[state].lineEnd >= 0)
+        state = states[state].lineEnd;
+    return state;
+}
+
+// --------------------
+// Registry
+// --------------------
+namespace {
+struct GrammarSet
+{
+    QVector<std::shared_ptr<const KpadGrammar>> grammars;   // user grammars first
+    QStringList errors;
+};
+}
+
+static const GrammarSet &grammarSet() {
+    static const GrammarSet set = []() {
+        GrammarSet loaded;
+        for (const char *json : kBuiltinGrammars) {
+            if (auto grammar = KpadGrammar::fromJson(QByteArray(json)))
+                loaded.grammars.append(grammar);
+        }
+
+        const QDir dir(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/grammars");
+        const QFileInfoList files = dir.entryInfoList(QStringList() << "*.json", QDir::Files, QDir::Name);
+        for (const QFileInfo &info : files) {
+            QFile file(info.filePath());
+            QString error;
+            std::shared_ptr<const KpadGrammar> grammar;
+            if (file.open(QIODevice::ReadOnly))
+                grammar = KpadGrammar::fromJson(file.readAll(), &error);
+            else
+                error = file.errorString();
+            if (!grammar) {
+                loaded.errors << info.fileName() + ": " + error;
+                continue;
+            }
+            // Replaces a built-in of the same name
+            for (int i = loaded.grammars.size() - 1; i >= 0; --i) {
+                if (loaded.grammars[i]->name().compare(grammar->name(), Qt::CaseInsensitive) == 0)
+                    loaded.grammars.remove(i);
+            }
+            loaded.grammars.prepend(grammar);
+        }
+        return loaded;
+    }();
+    return set;
+}
+
+std::shared_ptr<const KpadGrammar> KpadGrammarRegistry::forFile(const QString &filePath) {
+    const QString suffix = QFileInfo(filePath).suffix().toLower();
+    if (suffix.isEmpty())
+        return nullptr;
+    for (const auto &grammar : grammarSet().grammars) {
+        if (grammar->extensions().contains(suffix))
+            return grammar;
+    }
+    return nullptr;
+}
+
+std::shared_ptr<const KpadGrammar> KpadGrammarRegistry::byName(const QString &name) {
+    for (const auto &grammar : grammarSet().grammars) {
+        if (grammar->name().compare(name, Qt::CaseInsensitive) == 0)
+            return grammar;
+    }
+    return nullptr;
+}
+
+QStringList KpadGrammarRegistry::names() {
+    QStringList names;
+    for (const auto &grammar : grammarSet().grammars)
+        names << grammar->name();
+    return names;
+}
+
+QStringList KpadGrammarRegistry::loadErrors() {
+    return grammarSet().errors;
+}
+
+// --------------------
+// Highlighter
+// --------------------
+// A block's userState holds (end state << 1) | coloured, or -1 when it was
+// never lexed. Only blocks before the watermark are trusted; beyond it a
+// state may be left over from before an edit.
+KpadHighlighter::KpadHighlighter(QTextEdit *editor)
+    : QObject(editor)
+    , editor(editor)
+    , styles(KpadGrammar::StyleCount)
+{
+    visibleTimer = new QTimer(this);
+    visibleTimer->setSingleShot(true);
+    visibleTimer->setInterval(0);
+    connect(visibleTimer, &QTimer::timeout, this, &KpadHighlighter::highlightVisible);
+
+    sliceTimer = new QTimer(this);
+    sliceTimer->setSingleShot(true);
+    sliceTimer->setInterval(0);
+    connect(sliceTimer, &QTimer::timeout, this, &KpadHighlighter::lexAhead);
+
+    connect(editor->verticalScrollBar(), &QScrollBar::valueChanged, this, &KpadHighlighter::scheduleVisible);
+    editor->viewport()->installEventFilter(this);
+    setDarkMode(false);
+}
+
+void KpadHighlighter::setGrammar(std::shared_ptr<const KpadGrammar> grammar) {
+    lexer = std::move(grammar);
+    detach();
+    if (lexer)
+        attach(editor->document());
+}
+
+void KpadHighlighter::setDarkMode(bool dark) {
+    auto style = [&](KpadGrammar::Style which, const char *light, const char *darkColor, bool italic = false) {
+        QTextCharFormat format;
+        format.setForeground(QColor(dark ? darkColor : light));
+        if (italic)
+            format.setFontItalic(true);
+        styles[which] = format;
+    };
+    style(KpadGrammar::Keyword, "#0033b3", "#cc7832");
+    style(KpadGrammar::Type, "#00627a", "#4ec9b0");
+    style(KpadGrammar::String, "#067d17", "#6a8759");
+    style(KpadGrammar::Number, "#1750eb", "#6897bb");
+    style(KpadGrammar::Comment, "#8c8c8c", "#808080", true);
+    style(KpadGrammar::Preprocessor, "#9e880d", "#bbb529");
+    style(KpadGrammar::Function, "#795e26", "#ffc66d");
+    style(KpadGrammar::Constant, "#871094", "#9876aa");
+
+    // Lexer states stay valid; only the colours need redoing
+    if (!document)
+        return;
+    for (QTextBlock block = document->begin(); block.isValid() && block.blockNumber() < watermark;
+         block = block.next()) {
+        if (block.userState() > 0)
+            block.setUserState(block.userState() & ~1);
+    }
+    scheduleVisible();
+}
+
+void KpadHighlighter::documentReplaced() {
+    // Still the attached document: its edits come in through contentsChange
+    if (lexer && document == editor->document())
+        return;
+    detach();
+    if (lexer)
+        attach(editor->document());
+}
+
+void KpadHighlighter::attach(QTextDocument *doc) {
+    document = doc;
+    connect(doc, &QTextDocument::contentsChange, this, &KpadHighlighter::contentsChange);
+    blockCount = doc->blockCount();
+    watermark = 0;
+    scheduleVisible();
+}
+
+void KpadHighlighter::detach() {
+    visibleTimer->stop();
+    sliceTimer->stop();
+    if (!document)
+        return;
+    disconnect(document, nullptr, this, nullptr);
+    forgetFormats();
+    document = nullptr;
+}
+
+// Takes the colours off; the document may be shown again without a grammar
+void KpadHighlighter::forgetFormats() {
+    for (QTextBlock block = document->begin(); block.isValid(); block = block.next()) {
+        QTextLayout *layout = block.layout();
+        if (!layout->formats().isEmpty()) {
+            layout->clearFormats();
+            document->markContentsDirty(block.position(), block.length());
+        }
+        block.setUserState(-1);
+    }
+}
+
+bool KpadHighlighter::eventFilter(QObject *watched, QEvent *event) {
+    if (watched == editor->viewport() && event->type() == QEvent::Resize)
+        scheduleVisible();
+    return QObject::eventFilter(watched, event);
+}
+
+void KpadHighlighter::scheduleVisible() {
+    if (document && lexer)
+        visibleTimer->start();
+}
+
+int KpadHighlighter::stateBefore(const QTextBlock &block) const {
+    const QTextBlock previous = block.previous();
+    if (!previous.isValid() || previous.userState() < 0)
+        return 0;
+    return previous.userState() >> 1;
+}
+
+// Lexes a block that starts in state; with format, also colours it (the
+// layout is only redone when the colours actually changed)
+int KpadHighlighter::lexBlock(QTextBlock block, int state, bool format) {
+    tokens.clear();
+    const int end = lexer->lex(block.text(), state, &tokens);
+
+    if (format) {
+        QVector<QTextLayout::FormatRange> ranges;
+        ranges.reserve(tokens.size());
+        for (const KpadGrammar::Token &token : tokens) {
+            QTextLayout::FormatRange range;
+            range.start = token.start;
+            range.length = token.length;
+            range.format = styles[token.style];
+            ranges.append(range);
+        }
+        QTextLayout *layout = block.layout();
+        if (layout->formats() != ranges) {
+            layout->setFormats(ranges);
+            document->markContentsDirty(block.position(), block.length());
+        }
+    }
+    block.setUserState(end * 2 + (format ? 1 : 0));
+    return end;
+}
+
+// Runs before the editor's layout has caught up with the edit, so it works
+// from the view as of the last highlightVisible()
+void KpadHighlighter::contentsChange(int position, int charsRemoved, int charsAdded) {
+    Q_UNUSED(charsRemoved);
+    const int count = document->blockCount();
+    const int delta = count - blockCount;
+    blockCount = count;
+
+    QTextBlock block = document->findBlock(position);
+    if (!block.isValid())
+        return;
+    scheduleVisible();
+    const int first = block.blockNumber();
+    if (first >= watermark)
+        return;     // nothing lexed there yet
+    // The lexed blocks after the edit moved by delta
+    watermark = qMax(first + 1, watermark + delta);
+
+    const QTextBlock lastEdited = document->findBlock(position + charsAdded);
+    const int last = lastEdited.isValid() ? lastEdited.blockNumber() : count - 1;
+    const int bottom = visibleBottom + qMax(delta, 0) + kLookaheadBlocks;
+    int state = stateBefore(block);
+    for (; block.isValid(); block = block.next()) {
+        const int number = block.blockNumber();
+        if (number >= watermark)
+            break;
+        // Did not settle by the bottom of the view: the rest waits until shown
+        if (number > bottom || number > last + kSyncLexBlocks) {
+            watermark = number;
+            break;
+        }
+        const int old = block.userState();
+        state = lexBlock(block, state, number >= visibleTop - kLookaheadBlocks);
+        if (number >= last && old >= 0 && (old >> 1) == state)
+            break;  // ends as before: the blocks after it are still right
+    }
+}
+
+// Colours the blocks in view. Their start state needs every block above to
+// be lexed; a long way to go is done in slices (lexAhead) to keep input alive.
+void KpadHighlighter::highlightVisible() {
+    if (!document || !lexer)
+        return;
+
+    const QRect view = editor->viewport()->rect();
+    const QTextBlock top = editor->cursorForPosition(view.topLeft()).block();
+    visibleTop = top.blockNumber();
+    visibleBottom = editor->cursorForPosition(view.bottomLeft()).block().blockNumber();
+
+    if (watermark < visibleTop) {
+        if (visibleTop - watermark > kSyncLexBlocks) {
+            lexTarget = visibleTop;
+            sliceTimer->start();
+            return;
+        }
+        QTextBlock block = document->findBlockByNumber(watermark);
+        int state = stateBefore(block);
+        for (; block.isValid() && block.blockNumber() < visibleTop; block = block.next())
+            state = lexBlock(block, state, false);
+        watermark = visibleTop;
+    }
+
+    const int end = visibleBottom + kLookaheadBlocks;
+    int state = stateBefore(top);
+    for (QTextBlock block = top; block.isValid() && block.blockNumber() <= end; block = block.next()) {
+        const int number = block.blockNumber();
+        const int known = block.userState();
+        if (number < watermark && known >= 0 && (known & 1)) {
+            state = known >> 1;
+            continue;
+        }
+        state = lexBlock(block, state, true);
+        watermark = qMax(watermark, number + 1);
+    }
+}
+
+void KpadHighlighter::lexAhead() {
+    if (!document || !lexer)
+        return;
+
+    QElapsedTimer timer;
+    timer.start();
+    QTextBlock block = document->findBlockByNumber(watermark);
+    int state = stateBefore(block);
+    while (block.isValid() && block.blockNumber() < lexTarget && timer.elapsed() < kSliceMsecs) {
+        state = lexBlock(block, state, false);
+        ++watermark;
+        block = block.next();
+    }
+
+    if (block.isValid() && block.blockNumber() < lexTarget)
+        sliceTimer->start();
+    else
+        highlightVisible();
+}
@@ -0,0 +1,152 @@
+#ifndef KPAD_HIGHLIGHT_H
+#define KPAD_HIGHLIGHT_H
+
+#include <QObject>
+#include <QPointer>
+#include <QRegularExpression>
+#include <QString>
+#include <QStringList>
+#include <QTextCharFormat>
+#include <QVector>
+#include <memory>
+
+class QTextDocument;
+class QTextBlock;
+class QTextEdit;
+class QTimer;
+
+// --------------------
+// Grammar
+// --------------------
+// A language as data: a list of lexer states, each with rules that match a
+// token, give it a style and may switch to another state. A line ends in
+// some state, which is what the next line starts in (an open block comment,
+// a triple-quoted string). Grammars are JSON:
+//
+//   { "name": "C", "extensions": ["c", "h"],
+//     "states": [
+//       { "name": "code", "rules": [
+//           { "match": "//.*", "style": "comment" },
+//           { "match": "/\\*", "style": "comment", "next": "comment" },
+//           { "words": ["if", "else", "while"], "style": "keyword" } ] },
+//       { "name": "comment", "style": "comment", "rules": [
+//           { "match": "\\*/", "style": "comment", "next": "code" } ] } ] }
+//
+// The first state is the initial one. A state's "style" colours text no
+// rule matches, and "lineEnd" names the state a line ending switches to.
+// Rule patterns must not use backreferences: each state's rules are
+// compiled into one alternation, so a token costs one regex scan however
+// many rules or languages there are.
+class KpadGrammar
+{
+public:
+    enum Style { Normal, Keyword, Type, String, Number, Comment, Preprocessor, Function, Constant, StyleCount };
+
+    struct Token
+    {
+        int start;
+        int length;
+        Style style;
+    };
+
+    // nullptr (with errorString set) if the JSON is not a usable grammar
+    static std::shared_ptr<const KpadGrammar> fromJson(const QByteArray &json, QString *errorString = nullptr);
+
+    QString name() const { return grammarName; }
+    QStringList extensions() const { return suffixes; }
+
+    // Lexes one line that starts in state, appending its styled tokens
+    // (Normal runs are left out); returns the state the line ends in
+    int lex(const QString &text, int state, QVector<Token> *tokens) const;
+
+private:
+    struct Rule
+    {
+        int group;                  // capture group of the rule in its state's regex
+        Style style;
+        int next;                   // state to switch to, or -1
+    };
+    struct State
+    {
+        QString name;
+        Style style = Normal;
+        int lineEnd = -1;           // state a line ending switches to, or -1
+        QRegularExpression regex;   // all rules as one alternation
+        QVector<Rule> rules;
+    };
+
+    QString grammarName;
+    QStringList suffixes;
+    QVector<State> states;
+};
+
+// All known grammars: the built-in ones, plus *.json files in the
+// "grammars" folder of the app data directory (these win on a clash).
+// Loaded and compiled once, the first time one is asked for.
+class KpadGrammarRegistry
+{
+public:
+    // By file suffix; nullptr when no grammar claims it
+    static std::shared_ptr<const KpadGrammar> forFile(const QString &filePath);
+    static std::shared_ptr<const KpadGrammar> byName(const QString &name);
+    static QStringList names();
+    static QStringList loadErrors();    // one line per grammar file that was skipped
+};
+
+// --------------------
+// Highlighter
+// --------------------
+// Incremental highlighting for an editor's document. Each block caches the
+// lexer state it ends in (QTextBlock::userState, so the word-count user data
+// is left alone). An edit re-lexes from the edited block and stops as soon
+// as a block ends in the same state as before; past the bottom of the view
+// it stops anyway and leaves the rest to be done when it scrolls in.
+// Blocks are only coloured once they are (nearly) visible, so opening or
+// jumping around a large file lexes what is needed and no more; long runs
+// of lexing are done in short slices while the editor is idle.
+class KpadHighlighter : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit KpadHighlighter(QTextEdit *editor);
+
+    void setGrammar(std::shared_ptr<const KpadGrammar> grammar);
+    std::shared_ptr<const KpadGrammar> grammar() const { return lexer; }
+    void setDarkMode(bool dark);
+    // Follows the editor's current document; call after it swaps documents.
+    // Does nothing while it is the one already attached. Without a grammar,
+    // formats are removed again.
+    void documentReplaced();
+
+private:
+    void attach(QTextDocument *doc);
+    void detach();
+    void contentsChange(int position, int charsRemoved, int charsAdded);
+    void scheduleVisible();
+    void highlightVisible();
+    void lexAhead();
+    int lexBlock(QTextBlock block, int state, bool format);
+    int stateBefore(const QTextBlock &block) const;
+    void forgetFormats();
+    bool eventFilter(QObject *watched, QEvent *event) override;
+
+    static constexpr int kLookaheadBlocks = 30;     // coloured below the view
+    static constexpr int kSyncLexBlocks = 20000;    // lexed at once; more are sliced
+    static constexpr int kSliceMsecs = 8;
+
+    QTextEdit *editor;
+    QPointer<QTextDocument> document;
+    std::shared_ptr<const KpadGrammar> lexer;
+    QVector<QTextCharFormat> styles;    // by KpadGrammar::Style
+    QVector<KpadGrammar::Token> tokens; // reused between blocks
+    int watermark = 0;              // blocks before it have a known end state
+    int blockCount = 0;
+    int lexTarget = 0;              // block the sliced lexing is heading for
+    int visibleTop = 0;             // view as of the last highlightVisible()
+    int visibleBottom = 0;
+    QTimer *visibleTimer;
+    QTimer *sliceTimer;
+};
+
+#endif // KPAD_HIGHLIGHT_H
@@ -0,0 +1,449 @@
+#include "kpad_html.h"
+
+#include <QElapsedTimer>
+#include <QFont>
+#include <QHash>
+#include <QSaveFile>
+#include <QStringView>
+#include <QTextBlock>
+#include <QTextDocument>
+#include <QTextFragment>
+#include <QTextList>
+
+static const int kFlushBytes = 1 << 20;    // write out about every megabyte
+
+// --------------------
+// Output buffer
+// --------------------
+namespace {
+class HtmlStream
+{
+public:
+    explicit HtmlStream(QIODevice *device) : device(device) { buffer.reserve(kFlushBytes + 4096); }
+
+    HtmlStream &operator<<(const char *s) { buffer += s; return *this; }
+    HtmlStream &operator<<(const QByteArray &s) { buffer += s; return *this; }
+    HtmlStream &operator<<(int n) { buffer += QByteArray::number(n); return *this; }
+
+    // Text with markup characters escaped. Runs between them are converted
+    // to UTF-8 straight from the fragment, without an escaped copy.
+    void text(const QChar *data, int length) {
+        int run = 0;
+        for (int i = 0; i < length; ++i) {
+            const char *entity;
+            switch (data[i].unicode()) {
+            case '<': entity = "&lt;"; break;
+            case '>': entity = "&gt;"; break;
+            case '&': entity = "&amp;"; break;
+            case '"': entity = "&quot;"; break;
+            case 0x00A0: entity = "&nbsp;"; break;
+            case 0x2028: entity = "<br />"; break;     // QChar::LineSeparator (Shift+Enter)
+            default: continue;
+            }
+            if (i > run)
+                buffer += QStringView(data + run, i - run).toUtf8();
+            buffer += entity;
+            run = i + 1;
+        }
+        if (length > run)
+            buffer += QStringView(data + run, length - run).toUtf8();
+    }
+    void text(const QString &s) { text(s.constData(), s.size()); }
+
+    void flushIfFull() {
+        if (buffer.size() >= kFlushBytes)
+            flush();
+    }
+    bool flush() {
+        if (!buffer.isEmpty()) {
+            ok = ok && device->write(buffer) == buffer.size();
+            written += buffer.size();
+            buffer.clear();
+        }
+        return ok;
+    }
+    qint64 bytes() const { return written + buffer.size(); }
+
+private:
+    QIODevice *device;
+    QByteArray buffer;
+    qint64 written = 0;
+    bool ok = true;
+};
+}
+
+// --------------------
+// Style sheet
+// --------------------
+// Only properties set on the format go in, as toHtml() does; whatever is
+// unset is inherited from the body rule.
+static QByteArray colorCss(const QBrush &brush) {
+    const QColor color = brush.color();
+    if (color.alpha() == 255)
+        return color.name().toLatin1();
+    return QByteArray("rgba(") + QByteArray::number(color.red()) + ',' + QByteArray::number(color.green())
+        + ',' + QByteArray::number(color.blue()) + ',' + QByteArray::number(color.alphaF(), 'g', 3) + ')';
+}
+
+static QByteArray familyCss(const QStringList &families) {
+    QString css;
+    for (const QString &family : families) {
+        if (!css.isEmpty())
+            css += ',';
+        css += '\'' + family + '\'';
+    }
+    return css.toUtf8();
+}
+
+static QByteArray charCss(const QTextCharFormat &format) {
+    QByteArray css;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 13, 0)
+    if (format.hasProperty(QTextFormat::FontFamilies))
+        css += "font-family:" + familyCss(format.property(QTextFormat::FontFamilies).toStringList()) + ';';
+    else
+#endif
+    if (format.hasProperty(QTextFormat::FontFamily))
+        css += "font-family:" + familyCss(QStringList(format.stringProperty(QTextFormat::FontFamily))) + ';';
+    if (format.hasProperty(QTextFormat::FontPointSize))
+        css += "font-size:" + QByteArray::number(format.fontPointSize(), 'g', 4) + "pt;";
+    else if (format.hasProperty(QTextFormat::FontPixelSize))
+        css += "font-size:" + QByteArray::number(format.intProperty(QTextFormat::FontPixelSize)) + "px;";
+    if (format.hasProperty(QTextFormat::FontWeight)) {
+#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+        const int weight = qBound(1, (format.fontWeight() + 50) / 100, 9) * 100;
+#else
+        // Qt 5 weights are not CSS ones: Normal is 50, Bold 75
+        const int weight = format.fontWeight() >= QFont::Bold ? 700
+                         : format.fontWeight() > QFont::Normal ? 600 : 400;
+#endif
+        css += "font-weight:" + QByteArray::number(weight) + ';';
+    }
+    if (format.hasProperty(QTextFormat::FontItalic))
+        css += format.fontItalic() ? "font-style:italic;" : "font-style:normal;";
+
+    if (format.hasProperty(QTextFormat::TextUnderlineStyle) || format.hasProperty(QTextFormat::FontUnderline)
+        || format.hasProperty(QTextFormat::FontStrikeOut) || format.hasProperty(QTextFormat::FontOverline)) {
+        QByteArray lines;
+        if (format.fontUnderline())
+            lines += " underline";
+        if (format.fontStrikeOut())
+            lines += " line-through";
+        if (format.fontOverline())
+            lines += " overline";
+        css += "text-decoration:" + (lines.isEmpty() ? QByteArray(" none") : lines) + ';';
+    }
+    if (format.hasProperty(QTextFormat::ForegroundBrush) && format.foreground().style() != Qt::NoBrush)
+        css += "color:" + colorCss(format.foreground()) + ';';
+    if (format.hasProperty(QTextFormat::BackgroundBrush) && format.background().style() != Qt::NoBrush)
+        css += "background-color:" + colorCss(format.background()) + ';';
+
+    switch (format.verticalAlignment()) {
+    case QTextCharFormat::AlignSuperScript: css += "vertical-align:super;"; break;
+    case QTextCharFormat::AlignSubScript: css += "vertical-align:sub;"; break;
+    case QTextCharFormat::AlignMiddle: css += "vertical-align:middle;"; break;
+    case QTextCharFormat::AlignTop: css += "vertical-align:top;"; break;
+    case QTextCharFormat::AlignBottom: css += "vertical-align:bottom;"; break;
+    default: break;
+    }
+    return css;
+}
+
+static QByteArray blockCss(const QTextBlockFormat &format, qreal indentWidth) {
+    QByteArray css;
+    if (format.hasProperty(QTextFormat::BlockAlignment)) {
+        const Qt::Alignment align = format.alignment() & Qt::AlignHorizontal_Mask;
+        if (align & Qt::AlignRight)
+            css += "text-align:right;";
+        else if (align & Qt::AlignHCenter)
+            css += "text-align:center;";
+        else if (align & Qt::AlignJustify)
+            css += "text-align:justify;";
+        else if (align & Qt::AlignLeft)
+            css += "text-align:left;";
+    }
+    if (format.hasProperty(QTextFormat::BlockTopMargin))
+        css += "margin-top:" + QByteArray::number(format.topMargin(), 'g', 4) + "px;";
+    if (format.hasProperty(QTextFormat::BlockBottomMargin))
+        css += "margin-bottom:" + QByteArray::number(format.bottomMargin(), 'g', 4) + "px;";
+    if (format.hasProperty(QTextFormat::BlockLeftMargin) || format.hasProperty(QTextFormat::BlockIndent)) {
+        const qreal left = format.leftMargin() + format.indent() * indentWidth;
+        css += "margin-left:" + QByteArray::number(left, 'g', 4) + "px;";
+    }
+    if (format.hasProperty(QTextFormat::BlockRightMargin))
+        css += "margin-right:" + QByteArray::number(format.rightMargin(), 'g', 4) + "px;";
+    if (format.hasProperty(QTextFormat::TextIndent))
+        css += "text-indent:" + QByteArray::number(format.textIndent(), 'g', 4) + "px;";
+    if (format.hasProperty(QTextFormat::BackgroundBrush) && format.background().style() != Qt::NoBrush)
+        css += "background-color:" + colorCss(format.background()) + ';';
+    return css;
+}
+
+// Maps the document's format indexes to shared classes: formats that differ
+// only in properties HTML cannot show end up in the same class
+class HtmlClasses
+{
+public:
+    explicit HtmlClasses(const QTextDocument *doc)
+        : formats(doc->allFormats()), indentWidth(doc->indentWidth()),
+          charClass(formats.size(), kUnseen), blockClass(formats.size(), kUnseen) {}
+
+    int forChar(int index) { return lookup(index, charClass, charSheet, 'c'); }
+    int forBlock(int index) { return lookup(index, blockClass, blockSheet, 'b'); }
+    const QTextFormat &format(int index) const { return formats[index]; }
+    int count() const { return charSheet.size() + blockSheet.size(); }
+
+    QByteArray styleSheet() const { return blockRules + charRules; }
+
+private:
+    static constexpr int kUnseen = -2;
+    static constexpr int kNone = -1;    // nothing to style
+
+    int lookup(int index, QVector<int> &memo, QHash<QByteArray, int> &sheet, char prefix) {
+        if (index < 0 || index >= memo.size())
+            return kNone;
+        int &id = memo[index];
+        if (id != kUnseen)
+            return id;
+
+        const QByteArray css = prefix == 'c' ? charCss(formats[index].toCharFormat())
+                                             : blockCss(formats[index].toBlockFormat(), indentWidth);
+        if (css.isEmpty())
+            return id = kNone;
+        auto it = sheet.constFind(css);
+        if (it == sheet.constEnd()) {
+            it = sheet.insert(css, sheet.size());
+            (prefix == 'c' ? charRules : blockRules)
+                += '.' + QByteArray(1, prefix) + QByteArray::number(*it) + " { " + css + " }\n";
+        }
+        return id = *it;
+    }
+
+    QVector<QTextFormat> formats;
+    qreal indentWidth;
+    QVector<int> charClass;         // format index -> class, kNone or kUnseen
+    QVector<int> blockClass;
+    QHash<QByteArray, int> charSheet;
+    QHash<QByteArray, int> blockSheet;
+    QByteArray charRules;
+    QByteArray blockRules;
+};
+
+// --------------------
+// Body
+// --------------------
+static void openList(HtmlStream &out, const QTextList *list) {
+    const char *tag = "ul";
+    const char *type = "disc";
+    switch (list ? list->format().style() : QTextListFormat::ListDisc) {
+    case QTextListFormat::ListCircle: type = "circle"; break;
+    case QTextListFormat::ListSquare: type = "square"; break;
+    case QTextListFormat::ListDecimal: tag = "ol"; type = "decimal"; break;
+    case QTextListFormat::ListLowerAlpha: tag = "ol"; type = "lower-alpha"; break;
+    case QTextListFormat::ListUpperAlpha: tag = "ol"; type = "upper-alpha"; break;
+    case QTextListFormat::ListLowerRoman: tag = "ol"; type = "lower-roman"; break;
+    case QTextListFormat::ListUpperRoman: tag = "ol"; type = "upper-roman"; break;
+    default: break;
+    }
+    out << "<" << tag << " style=\"list-style-type:" << type << ";\">\n";
+}
+
+static void closeList(HtmlStream &out, const QTextList *list) {
+    // The numbered styles all come after ListDecimal (the styles are negative)
+    const bool ordered = list && list->format().style() <= QTextListFormat::ListDecimal;
+    out << (ordered ? "</ol>\n" : "</ul>\n");
+}
+
+static void writeFragment(HtmlStream &out, HtmlClasses &classes, const QTextFragment &fragment) {
+    const int index = fragment.charFormatIndex();
+    const QTextCharFormat format = classes.format(index).toCharFormat();
+    const QString text = fragment.text();
+
+    if (format.isImageFormat()) {
+        const QTextImageFormat image = format.toImageFormat();
+        for (int i = 0; i < text.size(); ++i) {
+            out << "<img src=\"";
+            out.text(image.name());
+            out << "\"";
+            if (image.hasProperty(QTextFormat::ImageWidth))
+                out << " width=\"" << qRound(image.width()) << "\"";
+            if (image.hasProperty(QTextFormat::ImageHeight))
+                out << " height=\"" << qRound(image.height()) << "\"";
+            out << " />";
+        }
+        return;
+    }
+
+    const bool anchor = format.isAnchor() && !format.anchorHref().isEmpty();
+    if (anchor) {
+        out << "<a href=\"";
+        out.text(format.anchorHref());
+        out << "\">";
+    }
+    const int cls = classes.forChar(index);
+    if (cls >= 0)
+        out << "<span class=\"c" << cls << "\">";
+    out.text(text);
+    if (cls >= 0)
+        out << "</span>";
+    if (anchor)
+        out << "</a>";
+}
+
+static void writeBody(HtmlStream &out, HtmlClasses &classes, const QTextDocument *doc) {
+    QVector<const QTextList *> lists;   // open lists, outermost first; nullptr fills a skipped level
+
+    for (QTextBlock block = doc->begin(); block.isValid(); block = block.next()) {
+        const QTextList *list = block.textList();
+        const int depth = list ? qMax(1, list->format().indent()) : 0;
+        while (lists.size() > depth || (lists.size() == depth && depth > 0 && lists.last() != list)) {
+            closeList(out, lists.last());
+            lists.removeLast();
+        }
+        while (lists.size() < depth) {
+            const QTextList *level = lists.size() == depth - 1 ? list : nullptr;
+            openList(out, level);
+            lists.append(level);
+        }
+
+        const char *tag = list ? "li" : "p";
+        const int cls = classes.forBlock(block.blockFormatIndex());
+        out << "<" << tag;
+        if (cls >= 0)
+            out << " class=\"b" << cls << "\"";
+        out << ">";
+        if (block.length() <= 1)
+            out << "<br />";
+        for (QTextBlock::iterator it = block.begin(); !it.atEnd(); ++it)
+            writeFragment(out, classes, it.fragment());
+        out << "</" << tag << ">\n";
+        out.flushIfFull();
+    }
+    while (!lists.isEmpty()) {
+        closeList(out, lists.last());
+        lists.removeLast();
+    }
+}
+
+static void writeHead(HtmlStream &out, const QString &title, const QByteArray &bodyCss, const QByteArray &styleSheet) {
+    out << "<!DOCTYPE html>\n<html>\n<head>\n<meta charset=\"utf-8\" />\n";
+    if (!title.isEmpty()) {
+        out << "<title>";
+        out.text(title);
+        out << "</title>\n";
+    }
+    out << "<style>\nbody { " << bodyCss << " white-space:pre-wrap; }\np, li { margin:0; }\n" << styleSheet
+        << "</style>\n</head>\n<body>\n";
+}
+
+// --------------------
+// Export
+// --------------------
+KpadHtmlExportResult KpadHtmlExporter::write(const QTextDocument *doc, QIODevice *device) {
+    KpadHtmlExportResult result;
+    QElapsedTimer timer;
+    timer.start();
+
+    // The style sheet goes first, so the classes are collected in a pass
+    // over the block and fragment formats that touches no text
+    HtmlClasses classes(doc);
+    for (QTextBlock block = doc->begin(); block.isValid(); block = block.next()) {
+        classes.forBlock(block.blockFormatIndex());
+        for (QTextBlock::iterator it = block.begin(); !it.atEnd(); ++it)
+            classes.forChar(it.fragment().charFormatIndex());
+    }
+
+    const QFont font = doc->defaultFont();
+    QByteArray bodyCss = "font-family:" + familyCss(QStringList(font.family())) + ';';
+    if (font.pointSizeF() > 0)
+        bodyCss += " font-size:" + QByteArray::number(font.pointSizeF(), 'g', 4) + "pt;";
+    HtmlStream out(device);
+    writeHead(out, doc->metaInformation(QTextDocument::DocumentTitle), bodyCss, classes.styleSheet());
+
+    writeBody(out, classes, doc);
+    out << "</body>\n</html>\n";
+
+    result.ok = out.flush();
+    if (!result.ok)
+        result.errorString = device->errorString();
+    result.bytes = out.bytes();
+    result.classes = classes.count();
+    result.msecs = timer.elapsed();
+    return result;
+}
+
+KpadHtmlExportResult KpadHtmlExporter::write(const QTextDocument *doc, const QString &filePath) {
+    KpadHtmlExportResult result;
+    QElapsedTimer timer;
+    timer.start();
+
+    QSaveFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        result.errorString = file.errorString();
+        return result;
+    }
+    result = write(doc, &file);
+    if (!result.ok) {
+        file.cancelWriting();
+        return result;
+    }
+    if (!file.commit()) {
+        result.ok = false;
+        result.errorString = file.errorString();
+    }
+    result.msecs = timer.elapsed();
+    return result;
+}
+
+KpadHtmlExportResult KpadHtmlExporter::writePlainText(const QString &text, const QString &title, QIODevice *device) {
+    KpadHtmlExportResult result;
+    QElapsedTimer timer;
+    timer.start();
+
+    HtmlStream out(device);
+    writeHead(out, title, QByteArray(), QByteArray());
+    const QChar *data = text.constData();
+    const int length = text.size();
+    for (int start = 0; start <= length;) {     // a line per block, as setPlainText() makes them
+        int end = start;
+        while (end < length && data[end] != QLatin1Char('\n'))
+            ++end;
+        out << "<p>";
+        if (end == start)
+            out << "<br />";
+        out.text(data + start, end - start);
+        out << "</p>\n";
+        out.flushIfFull();
+        start = end + 1;
+    }
+    out << "</body>\n</html>\n";
+
+    result.ok = out.flush();
+    if (!result.ok)
+        result.errorString = device->errorString();
+    result.bytes = out.bytes();
+    result.msecs = timer.elapsed();
+    return result;
+}
+
+KpadHtmlExportResult KpadHtmlExporter::writePlainText(const QString &text, const QString &title, const QString &filePath) {
+    KpadHtmlExportResult result;
+    QElapsedTimer timer;
+    timer.start();
+
+    QSaveFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        result.errorString = file.errorString();
+        return result;
+    }
+    result = writePlainText(text, title, &file);
+    if (!result.ok) {
+        file.cancelWriting();
+        return result;
+    }
+    if (!file.commit()) {
+        result.ok = false;
+        result.errorString = file.errorString();
+    }
+    result.msecs = timer.elapsed();
+    return result;
+}
@@ -0,0 +1,37 @@
+#ifndef KPAD_HTML_H
+#define KPAD_HTML_H
+
+#include <QString>
+
+class QIODevice;
+class QTextDocument;
+
+struct KpadHtmlExportResult
+{
+    bool ok = false;
+    QString errorString;
+    qint64 bytes = 0;               // bytes written
+    qint64 msecs = 0;
+    int classes = 0;                // distinct CSS classes in the style sheet
+};
+
+// Writes a QTextDocument as HTML without building the page in memory.
+// Blocks and fragments are walked once and streamed out through a small
+// buffer. Each distinct char or block format becomes one CSS class, so a
+// run carries class="c3" instead of a full inline style= as toHtml() does.
+// Lists, links and images are kept; tables come out as plain paragraphs.
+// Must run on the thread that owns the document.
+class KpadHtmlExporter
+{
+public:
+    // Written through QSaveFile: a failed export leaves the old file alone
+    static KpadHtmlExportResult write(const QTextDocument *doc, const QString &filePath);
+    static KpadHtmlExportResult write(const QTextDocument *doc, QIODevice *device);
+
+    // Plain text as the page a plain document exports to, one <p> per line,
+    // without building a QTextDocument: safe on any thread and without a GUI
+    static KpadHtmlExportResult writePlainText(const QString &text, const QString &title, const QString &filePath);
+    static KpadHtmlExportResult writePlainText(const QString &text, const QString &title, QIODevice *device);
+};
+
+#endif // KPAD_HTML_H
@@ -0,0 +1,421 @@
+#include "kpad_journal.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+// --------------------
+// Record format
+// --------------------
+// A journal is a sequence of records: type (1 byte), payload size (4),
+// payload, CRC-16 of the payload (2). It always opens with a Header; a
+// Snapshot replaces the text so far; an Edit is (position, removed, UTF-8
+// inserted text). A crash mid-append leaves a torn last record, which
+// fails its checksum and ends the replay.
+
+static quint16 recordChecksum(const QByteArray &payload) {
+#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+    return qChecksum(QByteArrayView(payload));
+#else
+    return qChecksum(payload.constData(), uint(payload.size()));
+#endif
+}
+
+static bool readRecord(QDataStream &in, quint8 *type, QByteArray *payload) {
+    quint32 size = 0;
+    in >> *type >> size;
+    if (in.status() != QDataStream::Ok || in.device()->bytesAvailable() < qint64(size) + 2)
+        return false;
+
+    payload->resize(int(size));
+    if (in.readRawData(payload->data(), int(size)) != int(size))
+        return false;
+
+    quint16 sum = 0;
+    in >> sum;
+    return in.status() == QDataStream::Ok && sum == recordChecksum(*payload);
+}
+
+// The text of the file the journal's edits apply to, as the editor loaded it
+static bool readSource(const QString &path, const KpadTextFormat &format, QString *text) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    const QByteArray bytes = file.readAll();
+    const int bomSize = format.bom ? format.bomBytes().size() : 0;
+    KpadTextDecoder decoder(format.encoding);
+    *text = decoder.decode(bytes.constData() + bomSize, bytes.size() - bomSize);
+    *text += decoder.flush();
+    text->replace(QLatin1String("\r\n"), QLatin1String("\n"));
+    KpadPieceTable::normalize(*text);
+    return true;
+}
+
+KpadJournal::KpadJournal(QObject *parent)
+    : QObject(parent)
+{
+}
+
+KpadJournal::~KpadJournal() {
+    // Not a clean stop: leave what was typed for the next start to recover
+    if (!active)
+        return;
+    commitEdit();
+    if (!pending.isEmpty() && (file.isOpen() || create()))
+        writePending();
+}
+
+QString KpadJournal::directory() {
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/journal";
+}
+
+// --------------------
+// Writing
+// --------------------
+void KpadJournal::start(const QString &sourcePath, const KpadTextFormat &format,
+                        const KpadTextSnapshot &text, bool matchesSource) {
+    stop();
+    active = true;
+    error.clear();
+    source = sourcePath;
+    sourceFormat = format;
+    baseIsSource = matchesSource && !sourcePath.isEmpty();
+
+    if (baseIsSource) {
+        const QFileInfo info(sourcePath);
+        baseSize = info.size();
+        baseModified = info.lastModified().toMSecsSinceEpoch();
+        return;
+    }
+
+    baseSize = 0;
+    baseModified = 0;
+    baseText = text;
+    // Text that exists nowhere on disk is journaled right away
+    if (!text.isEmpty())
+        create();
+}
+
+void KpadJournal::stop() {
+    active = false;
+    hasEdit = false;
+    editText.clear();
+    pending.clear();
+    baseText = KpadTextSnapshot();
+
+    if (file.isOpen()) {
+        file.close();
+        file.remove();
+    }
+    lock.reset();   // unlocks, removing the lock file
+}
+
+void KpadJournal::recordEdit(int position, int removed, const QString &added) {
+    if (!active)
+        return;
+
+    if (hasEdit) {
+        const int end = editPosition + editText.size();
+        if (removed == 0 && position == end) {
+            editText += added;                      // typing on
+            return;
+        }
+        if (added.isEmpty() && position + removed == end && position >= editPosition) {
+            editText.chop(removed);                 // backspace over what was typed
+            return;
+        }
+        if (added.isEmpty() && editText.isEmpty() && position + removed == editPosition) {
+            editPosition = position;                // backspace over older text
+            editRemoved += removed;
+            return;
+        }
+        if (added.isEmpty() && editText.isEmpty() && position == editPosition) {
+            editRemoved += removed;                 // forward delete
+            return;
+        }
+        commitEdit();
+    }
+
+    hasEdit = true;
+    editPosition = position;
+    editRemoved = removed;
+    editText = added;
+}
+
+void KpadJournal::commitEdit() {
+    if (!hasEdit)
+        return;
+    hasEdit = false;
+    if (editRemoved == 0 && editText.isEmpty())
+        return;
+
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_12);
+    out << qint32(editPosition) << qint32(editRemoved) << editText.toUtf8();
+    pending += record(Edit, payload);
+    editText.clear();
+}
+
+bool KpadJournal::flush(const KpadTextSnapshot &current) {
+    if (!active)
+        return true;
+
+    commitEdit();
+    if (pending.isEmpty())
+        return true;
+    if (!file.isOpen() && !create())
+        return false;
+
+    // Once replaying would cost more than reading a fresh snapshot, write one
+    if (editBytes + pending.size() > qMax(kMinCompactBytes, baseBytes))
+        return compact(current);
+    return writePending();
+}
+
+bool KpadJournal::create() {
+    if (!QDir().mkpath(directory())) {
+        error = "Cannot create " + directory();
+        return false;
+    }
+
+    const QString key = source.isEmpty()
+        ? QStringLiteral("untitled")
+        : QString::fromLatin1(QCryptographicHash::hash(source.toUtf8(), QCryptographicHash::Sha1).toHex().left(12));
+    const QString path = QString("%1/%2-%3.kpj").arg(directory(), key)
+                             .arg(QDateTime::currentMSecsSinceEpoch());
+
+    // Held for as long as the journal is live, so other instances leave it alone
+    lock.reset(new QLockFile(path + ".lock"));
+    lock->setStaleLockTime(0);
+    if (!lock->tryLock(0)) {
+        error = "Cannot lock " + path;
+        lock.reset();
+        return false;
+    }
+
+    file.setFileName(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        error = file.errorString();
+        lock.reset();
+        return false;
+    }
+
+    QByteArray base = headerRecord(baseIsSource);
+    if (!baseIsSource) {
+        const QByteArray snapshot = snapshotRecord(baseText);
+        base += snapshot;
+        baseBytes = snapshot.size();
+    } else {
+        baseBytes = baseSize;
+    }
+    baseText = KpadTextSnapshot();
+    editBytes = 0;
+
+    if (file.write(base) != base.size() || !file.flush()) {
+        error = file.errorString();
+        return false;
+    }
+    return true;
+}
+
+bool KpadJournal::writePending() {
+    if (file.write(pending) != pending.size() || !file.flush()) {
+        error = file.errorString();
+        return false;
+    }
+    editBytes += pending.size();
+    pending.clear();
+    return true;
+}
+
+// Rewrites the journal as a snapshot of the current text. The new file
+// replaces the old one in a single rename, so a crash keeps one or the other.
+bool KpadJournal::compact(const KpadTextSnapshot &current) {
+    const QByteArray header = headerRecord(false);
+    const QByteArray snapshot = snapshotRecord(current);
+    const QString path = file.fileName();
+
+    QSaveFile out(path);
+    if (!out.open(QIODevice::WriteOnly)) {
+        error = out.errorString();
+        return writePending();
+    }
+    out.write(header);
+    out.write(snapshot);
+
+    file.close();   // the rename can't replace a file that is still open everywhere
+    const bool ok = out.commit();
+    if (!ok)
+        error = out.errorString();
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        error = file.errorString();
+        return false;
+    }
+    if (!ok)
+        return writePending();
+
+    baseIsSource = false;
+    baseBytes = snapshot.size();
+    editBytes = 0;
+    pending.clear();
+    return true;
+}
+
+QByteArray KpadJournal::headerRecord(bool withBase) const {
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_12);
+    out << quint32(kVersion) << source << quint8(sourceFormat.encoding) << sourceFormat.bom
+        << sourceFormat.crlf << withBase << qint64(baseSize) << qint64(baseModified);
+    return record(Header, payload);
+}
+
+QByteArray KpadJournal::snapshotRecord(const KpadTextSnapshot &text) {
+    QByteArray payload;
+    payload.reserve(text.length());
+    KpadTextEncoder encoder{KpadTextFormat()};
+    text.forEachChunk([&](const QChar *data, int length) {
+        payload += encoder.encode(data, length);
+        return true;
+    });
+    payload += encoder.flush();
+    return record(Snapshot, payload);
+}
+
+QByteArray KpadJournal::record(RecordType type, const QByteArray &payload) {
+    QByteArray bytes;
+    QDataStream out(&bytes, QIODevice::WriteOnly);
+    out << quint8(type) << quint32(payload.size());
+    out.writeRawData(payload.constData(), payload.size());
+    out << recordChecksum(payload);
+    return bytes;
+}
+
+// --------------------
+// Recovery
+// --------------------
+static bool readHeader(const QByteArray &payload, KpadJournalInfo *info, bool *withBase,
+                       qint64 *baseSize, qint64 *baseModified) {
+    QDataStream in(payload);
+    in.setVersion(QDataStream::Qt_5_12);
+    quint32 version = 0;
+    quint8 encoding = 0;
+    in >> version >> info->sourcePath >> encoding >> info->format.bom >> info->format.crlf
+       >> *withBase >> *baseSize >> *baseModified;
+    if (in.status() != QDataStream::Ok || version != 1 || encoding > KpadTextFormat::Latin1)
+        return false;
+    info->format.encoding = KpadTextFormat::Encoding(encoding);
+    return true;
+}
+
+QList<KpadJournalInfo> KpadJournal::orphans() {
+    QList<KpadJournalInfo> result;
+    const QFileInfoList journals = QDir(directory()).entryInfoList(QStringList() << "*.kpj",
+                                                                   QDir::Files, QDir::Time);
+    for (const QFileInfo &journal : journals) {
+        // A live instance holds the lock; a crashed one left it stale
+        QLockFile probe(journal.filePath() + ".lock");
+        probe.setStaleLockTime(0);
+        if (!probe.tryLock(0))
+            continue;
+
+        QFile file(journal.filePath());
+        if (!file.open(QIODevice::ReadOnly))
+            continue;
+        QDataStream in(&file);
+        quint8 type = 0;
+        QByteArray payload;
+        KpadJournalInfo info;
+        bool withBase = false;
+        qint64 baseSize = 0, baseModified = 0;
+        if (readRecord(in, &type, &payload) && type == Header
+            && readHeader(payload, &info, &withBase, &baseSize, &baseModified)) {
+            info.journalPath = journal.filePath();
+            info.lastWritten = journal.lastModified();
+            result.append(info);
+        }
+    }
+    return result;
+}
+
+bool KpadJournal::replay(const QString &journalPath, KpadTextSnapshot *text,
+                         KpadJournalInfo *info, QString *errorString) {
+    QFile file(journalPath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        *errorString = file.errorString();
+        return false;
+    }
+
+    QDataStream in(&file);
+    quint8 type = 0;
+    QByteArray payload;
+    bool withBase = false;
+    qint64 baseSize = 0, baseModified = 0;
+    if (!readRecord(in, &type, &payload) || type != Header
+        || !readHeader(payload, info, &withBase, &baseSize, &baseModified)) {
+        *errorString = "Not a KPad+ journal.";
+        return false;
+    }
+    info->journalPath = journalPath;
+    info->lastWritten = QFileInfo(journalPath).lastModified();
+
+    KpadPieceTable table;
+    bool haveBase = false;
+    QString baseError = "The journal is empty.";
+    if (withBase) {
+        const QFileInfo source(info->sourcePath);
+        QString sourceText;
+        if (source.exists() && source.size() == baseSize
+            && source.lastModified().toMSecsSinceEpoch() == baseModified
+            && readSource(info->sourcePath, info->format, &sourceText)) {
+            table.reset(sourceText);
+            haveBase = true;
+        } else {
+            baseError = QString("'%1' was changed or removed after the edits were made.").arg(source.fileName());
+        }
+    }
+
+    while (readRecord(in, &type, &payload)) {
+        if (type == Snapshot) {
+            QString snapshot = QString::fromUtf8(payload);
+            KpadPieceTable::normalize(snapshot);
+            table.reset(snapshot);
+            haveBase = true;
+        } else if (type == Edit) {
+            if (!haveBase) {
+                *errorString = baseError;
+                return false;
+            }
+            QDataStream edit(payload);
+            edit.setVersion(QDataStream::Qt_5_12);
+            qint32 position = 0, removed = 0;
+            QByteArray added;
+            edit >> position >> removed >> added;
+            if (edit.status() != QDataStream::Ok || position < 0 || removed < 0
+                || position > table.length() - removed) {
+                *errorString = "The journal is damaged.";
+                return false;
+            }
+            if (removed > 0)
+                table.remove(position, removed);
+            if (!added.isEmpty())
+                table.insert(position, QString::fromUtf8(added));
+        }
+    }
+
+    if (!haveBase) {
+        *errorString = baseError;
+        return false;
+    }
+    *text = table.snapshot();
+    return true;
+}
+
+void KpadJournal::discard(const QString &journalPath) {
+    QFile::remove(journalPath);
+}
@@ -0,0 +1,106 @@
+#ifndef KPAD_JOURNAL_H
+#define KPAD_JOURNAL_H
+
+#include <QObject>
+#include <QString>
+#include <QByteArray>
+#include <QDateTime>
+#include <QFile>
+#include <QLockFile>
+#include <QList>
+#include <memory>
+
+#include "kpad_piecetable.h"
+#include "kpad_encoding.h"
+
+// A journal left behind by a session that did not shut down cleanly
+struct KpadJournalInfo
+{
+    QString journalPath;
+    QString sourcePath;             // empty for an untitled document
+    KpadTextFormat format;          // of sourcePath
+    QDateTime lastWritten;
+};
+
+// --------------------
+// Autosave journal
+// --------------------
+// Append-only record of the edits made to one plain-text document, kept in
+// a sidecar file under the app data directory. A document that matches its
+// file on disk is journaled as a reference to that file plus edits; any
+// other text starts from a snapshot. Autosave therefore writes what was
+// typed, not the document. Once the edits outgrow the base, the journal is
+// compacted into a fresh snapshot.
+//
+// The sidecar is created on the first edit and removed by stop(). One that
+// is still there on the next start, with its lock free, is recovered by
+// replaying it.
+class KpadJournal : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit KpadJournal(QObject *parent = nullptr);
+    ~KpadJournal();                 // Flushes, but keeps the sidecar
+
+    // Starts a new journal for the document, dropping the previous one.
+    // With matchesSource the text is exactly sourcePath's contents; without,
+    // non-empty text is written out as a snapshot straight away.
+    void start(const QString &sourcePath, const KpadTextFormat &format,
+               const KpadTextSnapshot &text, bool matchesSource);
+    void stop();                    // Removes the sidecar (saved, discarded or closed)
+    bool isActive() const { return active; }
+
+    // contentsChange, as applied to the piece table
+    void recordEdit(int position, int removed, const QString &added);
+    // Writes buffered edits; compacts into a snapshot of current when due
+    bool flush(const KpadTextSnapshot &current);
+    QString errorString() const { return error; }
+
+    // Journals of sessions that ended without stop(), newest first
+    static QList<KpadJournalInfo> orphans();
+    // Rebuilds the text a journal describes
+    static bool replay(const QString &journalPath, KpadTextSnapshot *text,
+                       KpadJournalInfo *info, QString *errorString);
+    static void discard(const QString &journalPath);
+    static QString directory();
+
+private:
+    enum RecordType : quint8 { Header = 'H', Snapshot = 'S', Edit = 'E' };
+
+    bool create();                  // Opens the sidecar and writes its base
+    bool compact(const KpadTextSnapshot &current);
+    void commitEdit();              // Moves the coalesced edit into pending
+    bool writePending();
+    QByteArray headerRecord(bool withBase) const;
+    static QByteArray record(RecordType type, const QByteArray &payload);
+    static QByteArray snapshotRecord(const KpadTextSnapshot &text);
+
+    static constexpr int kVersion = 1;
+    static constexpr qint64 kMinCompactBytes = 1024 * 1024;
+
+    bool active = false;
+    QString source;
+    KpadTextFormat sourceFormat;
+    bool baseIsSource = false;      // the journal refers to source instead of a snapshot
+    qint64 baseSize = 0;            // source size and mtime when journaling began
+    qint64 baseModified = 0;
+    KpadTextSnapshot baseText;      // written by create() unless baseIsSource
+
+    QFile file;
+    std::unique_ptr<QLockFile> lock;
+    QByteArray pending;             // records not yet written
+    qint64 baseBytes = 0;           // size of the base the edits apply to
+    qint64 editBytes = 0;           // edit records written since that base
+
+    // The edit being typed: consecutive inserts (and backspaces over them)
+    // coalesce into one record
+    bool hasEdit = false;
+    int editPosition = 0;
+    int editRemoved = 0;
+    QString editText;
+
+    QString error;
+};
+
+#endif // KPAD_JOURNAL_H
@@ -1,5 +1,6 @@
 #include "kpad.h"
 #include "ui_kpad.h"
+#include "kpad_metrics.h"
 #include <QClipboard>
 #include <QApplication>
 #include <QKeyEvent>
@@ -9,6 +10,7 @@
 // Key Event Handler
 // ------------
 void Kpad::keyPressEvent(QKeyEvent *event) {
+    KPAD_TRACE_SCOPE(KeyPress);
     QTextCursor cursor = textEdit->textCursor();
 
     // Arrow Down: move down; if on last line, move to end of line
@@ -44,86 +46,8 @@ void Kpad::keyPressEvent(QKeyEvent *event) {
     // ------------
     if (event->key() == Qt::Key_Backtab ||
         (event->key() == Qt::Key_Tab && event->modifiers() == Qt::ShiftModifier)) {
+        indentBlocks(true);
         event->accept(); // Prevent focus change
-        QTextCursor cursor = textEdit->textCursor();
-        cursor.beginEditBlock();
-
-        if (cursor.hasSelection()) {
-            int start = cursor.selectionStart();
-            int end = cursor.selectionEnd();
-            cursor.setPosition(start);
-            while (cursor.position() < end) {
-                cursor.movePosition(QTextCursor::StartOfLine);
-                // Try to remove a leading tab first
-                cursor.movePosition(QTextCursor::NextCharacter, QTextCursor::KeepAnchor, 1);
-                QString firstChar = cursor.selectedText();
-                if (firstChar == "\t") {
-                    cursor.removeSelectedText();
-                } else {
-                    // Not a tab — remove up to 4 leading spaces if present
-                    cursor.clearSelection();
-                    cursor.movePosition(QTextCursor::StartOfLine);
-                    cursor.movePosition(QTextCursor::NextCharacter, QTextCursor::KeepAnchor, 4);
-                    QString startChunk = cursor.selectedText();
-                    int toRemove = 0;
-                    for (int i = 0; i < startChunk.size() && i < 4; ++i) {
-                        if (startChunk[i] == ' ')
-                            ++toRemove;
-                        else
-                            break;
-                    }
-                    if (toRemove > 0) {
-                        cursor.clearSelection();
-                        cursor.movePosition(QTextCursor::StartOfLine);
-                        cursor.movePosition(QTextCursor::NextCharacter, QTextCursor::KeepAnchor, toRemove);
-                        cursor.removeSelectedText();
-                    }
-                }
-                cursor.movePosition(QTextCursor::Down);
-            }
-        } else {
-            // No selection: de-indent current line and preserve cursor position
-            int originalColumn = cursor.columnNumber();  // Save column position
-
-            cursor.movePosition(QTextCursor::StartOfLine);
-            cursor.movePosition(QTextCursor::NextCharacter, QTextCursor::KeepAnchor, 1);
-            int charsRemoved = 0;
-
-            if (cursor.selectedText() == "\t") {
-                cursor.removeSelectedText();
-                charsRemoved = 1;
-            } else {
-                cursor.clearSelection();
-                cursor.movePosition(QTextCursor::StartOfLine);
-                cursor.movePosition(QTextCursor::NextCharacter, QTextCursor::KeepAnchor, 4);
-                QString chunk = cursor.selectedText();
-                int toRemove = 0;
-                for (int i = 0; i < chunk.size() && i < 4; ++i) {
-                    if (chunk[i] == ' ')
-                        ++toRemove;
-                    else
-                        break;
-                }
-                if (toRemove > 0) {
-                    cursor.clearSelection();
-                    cursor.movePosition(QTextCursor::StartOfLine);
-                    cursor.movePosition(QTextCursor::NextCharacter, QTextCursor::KeepAnchor, toRemove);
-                    cursor.removeSelectedText();
-                    charsRemoved = toRemove;
-                }
-            }
-
-            // Restore cursor position, adjusted for removed characters
-            cursor.movePosition(QTextCursor::StartOfLine);
-            int newColumn = qMax(0, originalColumn - charsRemoved);
-            for (int i = 0; i < newColumn && !cursor.atBlockEnd(); ++i) {
-                cursor.movePosition(QTextCursor::NextCharacter);
-            }
-        }
-
-        cursor.endEditBlock();
-        textEdit->setTextCursor(cursor);
-        event->accept();
         return;
     }
 
@@ -131,46 +55,7 @@ void Kpad::keyPressEvent(QKeyEvent *event) {
     // Indent with Tab
     // ------------
     if (event->key() == Qt::Key_Tab && event->modifiers() == Qt::NoModifier) {
-        cursor.beginEditBlock();
-
-        if (cursor.hasSelection()) {
-            // If there's a selection, indent all selected lines
-            const int selStart = cursor.selectionStart();
-            const int selEnd = cursor.selectionEnd();
-            cursor.setPosition(selStart);
-
-            // iterate per line in selection
-            while (cursor.position() < selEnd) {
-                cursor.movePosition(QTextCursor::StartOfLine);
-                cursor.insertText("\t");
-                cursor.movePosition(QTextCursor::Down);
-            }
-        } else {
-            int columnPos = cursor.columnNumber();
-            QTextBlock currentBlock = cursor.block();
-
-            if (columnPos == 0) {
-                // --- Cursor at beginning of line: indent the entire line ---
-                QTextList *list = currentBlock.textList();
-                if (list) {
-                    QTextListFormat fmt = list->format();
-                    int oldIndent = fmt.indent();
-                    list->remove(currentBlock);
-
-                    QTextListFormat newFmt = fmt;
-                    newFmt.setIndent(oldIndent + 1);
-                    QTextCursor blockCursor(currentBlock);
-                    blockCursor.createList(newFmt);
-                } else {
-                    cursor.insertText("\t");
-                }
-            } else {
-                // --- Cursor mid-line: insert tab at cursor only ---
-                cursor.insertText("\t");
-            }
-        }
-
-        cursor.endEditBlock();
+        indentBlocks(false);
         event->accept();
         return;
     }
@@ -220,15 +105,132 @@ void Kpad::keyPressEvent(QKeyEvent *event) {
         return;
     }
 
+    // ------------
+    // F3 / Shift+F3: next / previous find match
+    // ------------
+    if (event->key() == Qt::Key_F3 &&
+        (event->modifiers() == Qt::NoModifier || event->modifiers() == Qt::ShiftModifier)) {
+        if (event->modifiers() == Qt::ShiftModifier)
+            findPrevious();
+        else
+            findNext();
+        event->accept();
+        return;
+    }
+
     // Base class (default)
     QMainWindow::keyPressEvent(event);
 }
 
+// ------------
+// Block Indent / Outdent
+// ------------
+// Tab and Shift+Tab over the selected blocks (or the cursor's block).
+// Each block is visited once: list items move one list level, other blocks
+// gain a leading tab or lose one tab / up to 4 leading spaces, read straight
+// from block.text(). All of it is one undo step.
+void Kpad::indentBlocks(bool outdent) {
+    QTextDocument *doc = textEdit->document();
+    const QTextCursor selection = textEdit->textCursor();
+
+    QTextBlock block = doc->findBlock(selection.selectionStart());
+    QTextBlock last = doc->findBlock(selection.selectionEnd());
+    // A selection that ends at the start of a line leaves that line alone
+    if (selection.hasSelection() && last != block && selection.selectionEnd() == last.position())
+        last = last.previous();
+
+    QTextCursor cursor(doc);
+    cursor.beginEditBlock();
+
+    for (; block.isValid(); block = block.next()) {
+        QTextList *list = block.textList();
+        cursor.setPosition(block.position());
+
+        if (list) {
+            // List item: one level deeper, or one level out
+            QTextListFormat fmt = list->format();
+            const int newIndent = fmt.indent() + (outdent ? -1 : 1);
+            list->remove(block);
+            if (newIndent > 0) {
+                fmt.setIndent(newIndent);
+                cursor.createList(fmt);
+            } else {
+                // At base indentation → remove list formatting entirely
+                QTextBlockFormat blockFmt;
+                blockFmt.setIndent(0);
+                cursor.setBlockFormat(blockFmt);
+            }
+        } else if (!outdent) {
+            cursor.insertText("\t");
+        } else {
+            // Remove one tab or up to 4 spaces
+            const QString text = block.text();
+            int toRemove = 0;
+            if (text.startsWith('\t')) {
+                toRemove = 1;
+            } else {
+                while (toRemove < 4 && toRemove < text.size() && text.at(toRemove) == ' ')
+                    ++toRemove;
+            }
+            if (toRemove > 0) {
+                cursor.setPosition(block.position() + toRemove, QTextCursor::KeepAnchor);
+                cursor.removeSelectedText();
+            }
+        }
+
+        if (block == last)
+            break;
+    }
+
+    cursor.endEditBlock();
+}
+
 bool Kpad::eventFilter(QObject *obj, QEvent *event) {
+    // With metrics on, the editor's paint event is delivered from here so
+    // its painting is timed; it comes back through with tracingPaint set
+    if (obj == textEdit->viewport() && event->type() == QEvent::Paint && KpadMetrics::isEnabled() && !tracingPaint) {
+        KPAD_TRACE_SCOPE(Paint);
+        tracingPaint = true;
+        QCoreApplication::sendEvent(obj, event);
+        tracingPaint = false;
+        return true;
+    }
+
+    KPAD_TRACE_SCOPE(EventFilter);
+
+    // Dropped rich text brings formats in: see useFormatUndo()
+    if (obj == textEdit->viewport() && event->type() == QEvent::Drop) {
+        useFormatUndoFor(static_cast<QDropEvent *>(event)->mimeData());
+    }
+
+    // The editor's menu: Undo, Redo and Paste go through Kpad as the keys do
+    if (obj == textEdit->viewport() && event->type() == QEvent::ContextMenu) {
+        showEditorMenu(static_cast<QContextMenuEvent *>(event));
+        return true;
+    }
+
+    // Re-paint find matches once the editor has re-laid out for the new size
+    if (obj == textEdit->viewport() && event->type() == QEvent::Resize) {
+        QTimer::singleShot(0, this, &Kpad::paintVisibleMatches);
+    }
+
     if (obj == textEdit && event->type() == QEvent::KeyPress) {
         QKeyEvent *keyEvent = static_cast<QKeyEvent*>(event);
         QTextCursor cursor = textEdit->textCursor();
 
+        // --- Undo / Redo go through Kpad, which keeps plain documents' history ---
+        if (keyEvent->matches(QKeySequence::Undo)) {
+            undo();
+            return true;
+        }
+        if (keyEvent->matches(QKeySequence::Redo)) {
+            redo();
+            return true;
+        }
+        if (keyEvent->matches(QKeySequence::Paste)) {
+            useFormatUndoFor(QApplication::clipboard()->mimeData());
+        }
+
         // --- Auto bullet / list detection ---
         if (keyEvent->key() == Qt::Key_Space && keyEvent->modifiers() == Qt::NoModifier) {
             QTextBlock block = cursor.block();
@@ -251,6 +253,7 @@ bool Kpad::eventFilter(QObject *obj, QEvent *event) {
                 listFmt.setStyle(trimmed == "-" ? QTextListFormat::ListDisc : QTextListFormat::ListCircle);
                 listFmt.setIndent(indentLevel / 4 + 1);
 
+                useFormatUndo();
                 cursor.beginEditBlock();
 
                 // Save the text after the "- " or "* "
@@ -344,97 +347,7 @@ bool Kpad::eventFilter(QObject *obj, QEvent *event) {
                 (keyEvent->key() == Qt::Key_Tab && keyEvent->modifiers() == Qt::ShiftModifier);
 
             if (isBacktab || keyEvent->modifiers() == Qt::NoModifier) {
-                cursor.beginEditBlock();
-
-                QList<QTextBlock> blocksToProcess;
-
-                // Collect all blocks in selection (or just current block if no selection)
-                if (cursor.hasSelection()) {
-                    int selStart = cursor.selectionStart();
-                    int selEnd = cursor.selectionEnd();
-
-                    QTextBlock block = textEdit->document()->findBlock(selStart);
-                    QTextBlock endBlock = textEdit->document()->findBlock(selEnd);
-
-                    while (block.isValid()) {
-                        blocksToProcess.append(block);
-                        if (block == endBlock) break;
-                        block = block.next();
-                    }
-                } else {
-                    blocksToProcess.append(cursor.block());
-                }
-
-                // Process each block independently
-                for (const QTextBlock &block : blocksToProcess) {
-                    QTextList *list = block.textList();
-                    QTextCursor blockCursor(block);
-
-                    if (!isBacktab) {
-                        // ----- INDENT (Tab) -----
-                        if (list) {
-                            // It's a list item: increase indent level
-                            QTextListFormat fmt = list->format();
-                            int oldIndent = fmt.indent();
-                            list->remove(block);
-
-                            QTextListFormat newFmt = fmt;
-                            newFmt.setIndent(oldIndent + 1);
-                            blockCursor.createList(newFmt);
-                        } else {
-                            // Not a list item: insert tab at block start
-                            blockCursor.movePosition(QTextCursor::StartOfBlock);
-                            blockCursor.insertText("\t");
-                        }
-                    } else {
-                        // ----- OUTDENT (Shift+Tab) -----
-                        if (list) {
-                            // It's a list item: decrease indent level
-                            QTextListFormat fmt = list->format();
-                            int oldIndent = fmt.indent();
-                            list->remove(block);
-
-                            if (oldIndent > 1) {
-                                QTextListFormat newFmt = fmt;
-                                newFmt.setIndent(oldIndent - 1);
-                                blockCursor.createList(newFmt);
-                            } else {
-                                // At base indentation → remove list formatting entirely
-                                QTextBlockFormat blockFmt;
-                                blockFmt.setIndent(0);
-                                blockCursor.setBlockFormat(blockFmt);
-                            }
-                        } else {
-                            // Non-list line: remove one tab or up to 4 spaces
-                            blockCursor.movePosition(QTextCursor::StartOfBlock);
-                            blockCursor.movePosition(QTextCursor::NextCharacter, QTextCursor::KeepAnchor, 1);
-                            QString first = blockCursor.selectedText();
-                            if (first == "\t") {
-                                blockCursor.removeSelectedText();
-                            } else {
-                                blockCursor.clearSelection();
-                                blockCursor.movePosition(QTextCursor::StartOfBlock);
-                                blockCursor.movePosition(QTextCursor::NextCharacter, QTextCursor::KeepAnchor, 4);
-                                QString chunk = blockCursor.selectedText();
-                                int toRemove = 0;
-                                for (int i = 0; i < chunk.size() && i < 4; ++i) {
-                                    if (chunk[i] == ' ')
-                                        ++toRemove;
-                                    else
-                                        break;
-                                }
-                                if (toRemove > 0) {
-                                    blockCursor.clearSelection();
-                                    blockCursor.movePosition(QTextCursor::StartOfBlock);
-                                    blockCursor.movePosition(QTextCursor::NextCharacter, QTextCursor::KeepAnchor, toRemove);
-                                    blockCursor.removeSelectedText();
-                                }
-                            }
-                        }
-                    }
-                }
-
-                cursor.endEditBlock();
+                indentBlocks(isBacktab);
                 return true;
             }
         }
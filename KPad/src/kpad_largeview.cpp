@@ -0,0 +1,479 @@
+#include "kpad_largeview.h"
+#include "kpad_metrics.h"
+
+#include <QFontDatabase>
+#include <QKeyEvent>
+#include <QPainter>
+#include <QScrollBar>
+#include <QtConcurrent>
+#include <algorithm>
+#include <cstring>
+
+// Bytes scanned between progress updates (indexing) and cancel checks (find)
+static const qint64 kIndexSliceBytes = 64 * 1024 * 1024;
+static const qint64 kFindSliceBytes = 4 * 1024 * 1024;
+static const int kMargin = 4;
+
+static inline uchar foldAscii(uchar c) {
+    return c >= 'A' && c <= 'Z' ? uchar(c + ('a' - 'A')) : c;
+}
+
+// Decoded line for display; tabs become four spaces
+static QString displayText(const char *bytes, qint64 length) {
+    QString text = QString::fromUtf8(bytes, int(length));
+    text.replace(QLatin1Char('\t'), QLatin1String("    "));
+    return text;
+}
+
+KpadLargeFileView::KpadLargeFileView(QWidget *parent)
+    : QAbstractScrollArea(parent)
+    , indexedLines(0)
+    , indexedBytes(0)
+    , cancelIndex(0)
+    , cancelFind(0)
+{
+    setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+    setFocusPolicy(Qt::StrongFocus);
+    connect(&findWatcher, &QFutureWatcher<qint64>::finished, this, &KpadLargeFileView::findDone);
+}
+
+KpadLargeFileView::~KpadLargeFileView() {
+    close();
+}
+
+// --------------------
+// Open / Close
+// --------------------
+bool KpadLargeFileView::open(const QString &filePath, QString *errorString) {
+    close();
+
+    file.setFileName(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        if (errorString)
+            *errorString = file.errorString();
+        return false;
+    }
+
+    size = file.size();
+    const uchar *mapped = size > 0 ? file.map(0, size) : nullptr;
+    if (!mapped) {
+        if (errorString)
+            *errorString = size > 0 ? file.errorString() : QString("The file is empty");
+        file.close();
+        size = 0;
+        return false;
+    }
+    data = reinterpret_cast<const char *>(mapped);
+
+    checkpoints = {0};
+    longLineStarts.clear();
+    longLineEnds.clear();
+    indexedLines.storeRelease(1);
+    indexedBytes.storeRelease(0);
+    cancelIndex.storeRelaxed(0);
+    indexFuture = QtConcurrent::run([this]() { buildIndex(); });
+
+    horizontalScrollBar()->setValue(0);
+    verticalScrollBar()->setValue(0);
+    updateScrollBars();
+    viewport()->update();
+    return true;
+}
+
+void KpadLargeFileView::close() {
+    cancelIndex.storeRelaxed(1);
+    cancelFind.storeRelaxed(1);
+    indexFuture.waitForFinished();
+    findWatcher.waitForFinished();
+
+    if (data) {
+        file.unmap(reinterpret_cast<uchar *>(const_cast<char *>(data)));
+        data = nullptr;
+    }
+    file.close();
+    size = 0;
+
+    checkpoints.clear();
+    longLineStarts.clear();
+    longLineEnds.clear();
+    indexedLines.storeRelease(0);
+    indexedBytes.storeRelease(0);
+    matchOffset = -1;
+    matchLength = 0;
+    markedLine = -1;
+    widestLine = 0;
+    updateScrollBars();
+    viewport()->update();
+}
+
+bool KpadLargeFileView::isIndexing() const {
+    return indexFuture.isRunning();
+}
+
+qint64 KpadLargeFileView::lineCount() const {
+    return indexedLines.loadAcquire();
+}
+
+qint64 KpadLargeFileView::topLine() const {
+    return verticalScrollBar()->value();
+}
+
+// --------------------
+// Line Index
+// --------------------
+// Line n starts after the n-th '\n'. The worker keeps the start of every
+// 1024th line; any other line is found by scanning forward from the
+// checkpoint before it. Lines longer than kMaxLineBytes are kept too, so
+// that scan never reads more than kMaxLineBytes of a line.
+void KpadLargeFileView::buildIndex() {
+    qint64 newlines = 0;
+    qint64 pos = 0;
+    qint64 lineBegin = 0;
+    QVector<qint64> found;
+    QVector<qint64> longStarts;
+    QVector<qint64> longEnds;
+
+    while (pos < size) {
+        if (cancelIndex.loadRelaxed())
+            return;
+
+        const char *p = data + pos;
+        const char *end = data + qMin(size, pos + kIndexSliceBytes);
+        while (p < end && (p = static_cast<const char *>(memchr(p, '\n', size_t(end - p))))) {
+            ++p;
+            const qint64 next = p - data;
+            if (next - 1 - lineBegin > kMaxLineBytes) {
+                longStarts.append(lineBegin);
+                longEnds.append(next);
+            }
+            lineBegin = next;
+            if (++newlines % kLinesPerCheckpoint == 0)
+                found.append(next);
+        }
+        pos = end - data;
+
+        {
+            QMutexLocker locker(&indexMutex);
+            checkpoints += found;
+            longLineStarts += longStarts;
+            longLineEnds += longEnds;
+        }
+        found.clear();
+        longStarts.clear();
+        longEnds.clear();
+        indexedLines.storeRelease(newlines + 1);
+        indexedBytes.storeRelease(pos);
+
+        const qint64 lines = newlines + 1;
+        QMetaObject::invokeMethod(this, [this, pos, lines]() { indexUpdated(pos, lines); },
+                                  Qt::QueuedConnection);
+    }
+}
+
+void KpadLargeFileView::indexUpdated(qint64 bytesDone, qint64 lines) {
+    updateScrollBars();
+    viewport()->update();
+    emit indexProgress(bytesDone, size);
+    if (bytesDone == size)
+        emit indexFinished(lines);
+}
+
+qint64 KpadLargeFileView::lineStart(qint64 line) const {
+    qint64 offset = 0;
+    {
+        QMutexLocker locker(&indexMutex);
+        if (checkpoints.isEmpty())
+            return 0;
+        const qint64 i = qMin<qint64>(line / kLinesPerCheckpoint, checkpoints.size() - 1);
+        offset = checkpoints.at(int(i));
+        line -= i * kLinesPerCheckpoint;
+    }
+
+    for (; line > 0 && offset < size; --line)
+        offset = nextLineStart(offset);
+    return offset;
+}
+
+// Start of the line after the one at start, or size. A line over
+// kMaxLineBytes is looked up in the index instead of scanned to its end; one
+// the index has not reached yet runs to the end of what is known.
+qint64 KpadLargeFileView::nextLineStart(qint64 start) const {
+    const qint64 available = qMin(size - start, kMaxLineBytes + 1);
+    if (const void *newline = memchr(data + start, '\n', size_t(available)))
+        return static_cast<const char *>(newline) - data + 1;
+    if (start + available == size)
+        return size;
+
+    QMutexLocker locker(&indexMutex);
+    auto it = std::lower_bound(longLineStarts.cbegin(), longLineStarts.cend(), start);
+    if (it != longLineStarts.cend() && *it == start)
+        return longLineEnds.at(int(it - longLineStarts.cbegin()));
+    return size;
+}
+
+qint64 KpadLargeFileView::lineAt(qint64 offset) const {
+    qint64 line = 0;
+    qint64 start = 0;
+    {
+        QMutexLocker locker(&indexMutex);
+        auto it = std::upper_bound(checkpoints.cbegin(), checkpoints.cend(), offset);
+        if (it == checkpoints.cbegin())
+            return 0;
+        --it;
+        line = qint64(it - checkpoints.cbegin()) * kLinesPerCheckpoint;
+        start = *it;
+    }
+    return line + std::count(data + start, data + offset, '\n');
+}
+
+// Text of the line starting at start (without its line break)
+QString KpadLargeFileView::lineText(qint64 start, qint64 *bytes) const {
+    const qint64 available = qMin(size - start, kMaxLineBytes);
+    const void *newline = memchr(data + start, '\n', size_t(available));
+    qint64 length = newline ? static_cast<const char *>(newline) - (data + start) : available;
+    if (length > 0 && data[start + length - 1] == '\r')
+        --length;
+
+    if (bytes)
+        *bytes = length;
+    return displayText(data + start, length);
+}
+
+// --------------------
+// Painting and Scrolling
+// --------------------
+void KpadLargeFileView::paintEvent(QPaintEvent *event) {
+    KPAD_TRACE_SCOPE(Paint);
+    QPainter painter(viewport());
+    painter.fillRect(event->rect(), palette().base());
+    if (!data)
+        return;
+
+    const QFontMetrics metrics(font());
+    const int lineHeight = metrics.lineSpacing();
+    const int x = kMargin - horizontalScrollBar()->value();
+    const qint64 lines = lineCount();
+    const int widest = widestLine;
+
+    qint64 line = topLine();
+    qint64 start = lineStart(line);
+    for (int y = 0; y < viewport()->height() && line < lines && start < size; y += lineHeight, ++line) {
+        qint64 bytes = 0;
+        const QString text = lineText(start, &bytes);
+
+        if (line == markedLine)
+            painter.fillRect(QRect(0, y, viewport()->width(), lineHeight), palette().alternateBase());
+        if (matchOffset >= start && matchOffset + matchLength <= start + bytes) {
+            const int from = metrics.horizontalAdvance(displayText(data + start, matchOffset - start));
+            const int width = metrics.horizontalAdvance(displayText(data + matchOffset, matchLength));
+            painter.fillRect(QRect(x + from, y, width, lineHeight), palette().highlight());
+        }
+
+        painter.setPen(palette().text().color());
+        painter.drawText(x, y + metrics.ascent(), text);
+        widestLine = qMax(widestLine, metrics.horizontalAdvance(text));
+
+        start = nextLineStart(start);
+    }
+
+    // Long lines only become known as they scroll into view
+    if (widestLine != widest)
+        updateScrollBars();
+}
+
+void KpadLargeFileView::updateScrollBars() {
+    const QFontMetrics metrics(font());
+    const int pageLines = qMax(1, viewport()->height() / metrics.lineSpacing());
+    const qint64 lines = lineCount();
+
+    verticalScrollBar()->setSingleStep(1);
+    verticalScrollBar()->setPageStep(pageLines);
+    verticalScrollBar()->setRange(0, int(qBound<qint64>(0, lines - pageLines, INT_MAX)));
+
+    horizontalScrollBar()->setSingleStep(metrics.averageCharWidth() * 4);
+    horizontalScrollBar()->setPageStep(viewport()->width());
+    horizontalScrollBar()->setRange(0, qMax(0, widestLine + 2 * kMargin - viewport()->width()));
+}
+
+void KpadLargeFileView::resizeEvent(QResizeEvent *event) {
+    QAbstractScrollArea::resizeEvent(event);
+    updateScrollBars();
+}
+
+void KpadLargeFileView::scrollContentsBy(int dx, int dy) {
+    Q_UNUSED(dx);
+    Q_UNUSED(dy);
+    viewport()->update();
+}
+
+void KpadLargeFileView::keyPressEvent(QKeyEvent *event) {
+    QScrollBar *vertical = verticalScrollBar();
+    QScrollBar *horizontal = horizontalScrollBar();
+
+    switch (event->key()) {
+    case Qt::Key_Up:       vertical->triggerAction(QAbstractSlider::SliderSingleStepSub); break;
+    case Qt::Key_Down:     vertical->triggerAction(QAbstractSlider::SliderSingleStepAdd); break;
+    case Qt::Key_PageUp:   vertical->triggerAction(QAbstractSlider::SliderPageStepSub); break;
+    case Qt::Key_PageDown: vertical->triggerAction(QAbstractSlider::SliderPageStepAdd); break;
+    case Qt::Key_Left:     horizontal->triggerAction(QAbstractSlider::SliderSingleStepSub); break;
+    case Qt::Key_Right:    horizontal->triggerAction(QAbstractSlider::SliderSingleStepAdd); break;
+    case Qt::Key_Home:     vertical->triggerAction(QAbstractSlider::SliderToMinimum); break;
+    case Qt::Key_End:      vertical->triggerAction(QAbstractSlider::SliderToMaximum); break;
+    default:
+        QAbstractScrollArea::keyPressEvent(event);  // unhandled keys go to the window
+        return;
+    }
+    event->accept();
+}
+
+// Scrolls line into the upper third of the viewport and marks it
+void KpadLargeFileView::scrollToLine(qint64 line) {
+    const int pageLines = verticalScrollBar()->pageStep();
+    if (line < topLine() || line >= topLine() + pageLines)
+        verticalScrollBar()->setValue(int(qBound<qint64>(0, line - pageLines / 3, INT_MAX)));
+    markedLine = line;
+    viewport()->update();
+}
+
+void KpadLargeFileView::goToLine(qint64 line) {
+    if (!data)
+        return;
+    matchOffset = -1;
+    scrollToLine(qBound<qint64>(0, line, lineCount() - 1));
+}
+
+// --------------------
+// Find
+// --------------------
+// Byte-level search straight over the mapping; ASCII letters match either
+// case, all other bytes (including UTF-8 sequences) must match exactly.
+// Only the indexed part of the file is searched, so every hit has a line.
+void KpadLargeFileView::find(const QString &pattern, bool forward) {
+    if (!data || pattern.isEmpty())
+        return;
+
+    // Only one search at a time; a running one stops within a slice
+    cancelFind.storeRelaxed(1);
+    findWatcher.waitForFinished();
+    cancelFind.storeRelaxed(0);
+
+    QByteArray needle = pattern.toUtf8();
+    for (char &c : needle)
+        c = char(foldAscii(uchar(c)));
+    findLength = needle.size();
+
+    const qint64 limit = indexedBytes.loadAcquire();
+    const qint64 n = findLength;
+    const qint64 anchor = matchOffset >= 0 ? matchOffset : lineStart(topLine());
+    const qint64 from = matchOffset >= 0 ? matchOffset + matchLength : anchor;
+    const char *bytes = data;
+    const QAtomicInt *cancel = &cancelFind;
+
+    findWatcher.setFuture(QtConcurrent::run([bytes, needle, n, anchor, from, limit, forward, cancel]() -> qint64 {
+        if (forward) {
+            const qint64 hit = findBytes(bytes, from, limit, needle, true, cancel);
+            return hit >= 0 ? hit : findBytes(bytes, 0, qMin(from + n - 1, limit), needle, true, cancel);
+        }
+        const qint64 hit = findBytes(bytes, 0, qMin(anchor + n - 1, limit), needle, false, cancel);
+        return hit >= 0 ? hit : findBytes(bytes, anchor, limit, needle, false, cancel);
+    }));
+}
+
+void KpadLargeFileView::findDone() {
+    if (cancelFind.loadRelaxed())
+        return;
+
+    const qint64 hit = findWatcher.result();
+    if (hit < 0) {
+        emit findFinished(false, -1);
+        return;
+    }
+
+    matchOffset = hit;
+    matchLength = findLength;
+    const qint64 line = lineAt(hit);
+    scrollToLine(line);
+
+    // Bring the match into view horizontally as well
+    const QFontMetrics metrics(font());
+    const qint64 start = lineStart(line);
+    const int x = metrics.horizontalAdvance(displayText(data + start, qMin(hit - start, kMaxLineBytes)));
+    QScrollBar *horizontal = horizontalScrollBar();
+    if (x < horizontal->value() || x > horizontal->value() + viewport()->width() - 2 * kMargin) {
+        widestLine = qMax(widestLine, x + viewport()->width());
+        updateScrollBars();
+        horizontal->setValue(qMax(0, x - viewport()->width() / 3));
+    }
+
+    emit findFinished(true, line);
+}
+
+// First (or last) start in [from, to) of a whole occurrence of the folded
+// needle that fits before to, or -1
+qint64 KpadLargeFileView::findBytes(const char *data, qint64 from, qint64 to, const QByteArray &needle,
+                                    bool forward, const QAtomicInt *cancel) {
+    const qint64 n = needle.size();
+    const qint64 lastStart = to - n + 1;  // candidate starts are below this
+    if (n == 0 || lastStart <= from)
+        return -1;
+
+    const uchar first = uchar(needle.at(0));
+    const uchar upper = first >= 'a' && first <= 'z' ? uchar(first - ('a' - 'A')) : first;
+
+    auto matchesAt = [&](qint64 pos) {
+        for (qint64 i = 1; i < n; ++i) {
+            if (foldAscii(uchar(data[pos + i])) != uchar(needle.at(int(i))))
+                return false;
+        }
+        return true;
+    };
+
+    // Candidates come from memchr on both forms of the first byte
+    auto scan = [&](qint64 begin, qint64 end, bool wantLast) -> qint64 {
+        qint64 result = -1;
+        qint64 nextLower = -2;  // -2: not looked up yet, -1: none left
+        qint64 nextUpper = upper == first ? -1 : -2;
+        for (qint64 pos = begin; pos < end;) {
+            if (nextLower != -1 && nextLower < pos) {
+                const void *hit = memchr(data + pos, first, size_t(end - pos));
+                nextLower = hit ? static_cast<const char *>(hit) - data : -1;
+            }
+            if (nextUpper != -1 && nextUpper < pos) {
+                const void *hit = memchr(data + pos, upper, size_t(end - pos));
+                nextUpper = hit ? static_cast<const char *>(hit) - data : -1;
+            }
+            if (nextLower < 0 && nextUpper < 0)
+                break;
+
+            const qint64 candidate = nextLower < 0 ? nextUpper
+                                   : nextUpper < 0 ? nextLower
+                                                   : qMin(nextLower, nextUpper);
+            if (matchesAt(candidate)) {
+                if (!wantLast)
+                    return candidate;
+                result = candidate;
+            }
+            pos = candidate + 1;
+        }
+        return result;
+    };
+
+    if (forward) {
+        for (qint64 begin = from; begin < lastStart; begin += kFindSliceBytes) {
+            if (cancel && cancel->loadRelaxed())
+                return -1;
+            const qint64 hit = scan(begin, qMin(begin + kFindSliceBytes, lastStart), false);
+            if (hit >= 0)
+                return hit;
+        }
+    } else {
+        for (qint64 end = lastStart; end > from; end -= kFindSliceBytes) {
+            if (cancel && cancel->loadRelaxed())
+                return -1;
+            const qint64 hit = scan(qMax(from, end - kFindSliceBytes), end, true);
+            if (hit >= 0)
+                return hit;
+        }
+    }
+    return -1;
+}
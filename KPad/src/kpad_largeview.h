@@ -0,0 +1,88 @@
+#ifndef KPAD_LARGEVIEW_H
+#define KPAD_LARGEVIEW_H
+
+#include <QAbstractScrollArea>
+#include <QAtomicInt>
+#include <QFile>
+#include <QFuture>
+#include <QFutureWatcher>
+#include <QMutex>
+#include <QVector>
+
+// Read-only viewer for files too large for QTextEdit.
+// The file is memory-mapped and a worker thread records the byte offset of
+// every 1024th line. Only the lines inside the viewport are decoded and
+// drawn, so memory use does not grow with the file beyond that sparse index.
+class KpadLargeFileView : public QAbstractScrollArea
+{
+    Q_OBJECT
+
+public:
+    explicit KpadLargeFileView(QWidget *parent = nullptr);
+    ~KpadLargeFileView();           // Stops the indexer and any running find
+
+    bool open(const QString &filePath, QString *errorString = nullptr);
+    void close();
+    bool isOpen() const { return data != nullptr; }
+    bool isIndexing() const;
+    QString filePath() const { return file.fileName(); }
+    qint64 fileSize() const { return size; }
+    qint64 lineCount() const;       // Lines indexed so far
+    qint64 topLine() const;         // First visible line (0-based)
+
+    void goToLine(qint64 line);     // 0-based; clamped to the indexed lines
+    // Case-insensitive (ASCII) search from the current match or the top of
+    // the viewport. Runs on a worker; emits findFinished().
+    void find(const QString &pattern, bool forward);
+    bool isFinding() const { return findWatcher.isRunning(); }
+
+signals:
+    void indexProgress(qint64 bytesDone, qint64 bytesTotal);
+    void indexFinished(qint64 lines);
+    void findFinished(bool found, qint64 line);
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+    void keyPressEvent(QKeyEvent *event) override;
+    void scrollContentsBy(int dx, int dy) override;
+
+private:
+    void buildIndex();              // Worker thread body
+    void indexUpdated(qint64 bytesDone, qint64 lines);
+    void findDone();
+    void updateScrollBars();
+    qint64 lineStart(qint64 line) const;
+    qint64 nextLineStart(qint64 start) const;
+    qint64 lineAt(qint64 offset) const;
+    QString lineText(qint64 start, qint64 *bytes = nullptr) const;
+    void scrollToLine(qint64 line);
+    static qint64 findBytes(const char *data, qint64 from, qint64 to, const QByteArray &needle,
+                            bool forward, const QAtomicInt *cancel);
+
+    static constexpr qint64 kLinesPerCheckpoint = 1024;
+    static constexpr qint64 kMaxLineBytes = 64 * 1024;  // longer lines are cut off on screen
+
+    QFile file;
+    const char *data = nullptr;     // The mapped file
+    qint64 size = 0;
+
+    mutable QMutex indexMutex;      // Guards checkpoints and long lines
+    QVector<qint64> checkpoints;    // Start of line i * kLinesPerCheckpoint
+    QVector<qint64> longLineStarts; // Lines over kMaxLineBytes, ascending
+    QVector<qint64> longLineEnds;   // Start of the line after each of them
+    QAtomicInteger<qint64> indexedLines;
+    QAtomicInteger<qint64> indexedBytes;
+    QAtomicInt cancelIndex;
+    QFuture<void> indexFuture;
+
+    QFutureWatcher<qint64> findWatcher;
+    QAtomicInt cancelFind;
+    qint64 findLength = 0;          // Needle length of the running find, in bytes
+    qint64 matchOffset = -1;        // Current match, in bytes
+    qint64 matchLength = 0;
+    qint64 markedLine = -1;         // Line of the last go-to or match
+    int widestLine = 0;             // Widest line painted so far, in pixels
+};
+
+#endif // KPAD_LARGEVIEW_H
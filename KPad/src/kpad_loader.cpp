@@ -0,0 +1,221 @@
+#include "kpad_loader.h"
+
+#include <QFile>
+#include <QElapsedTimer>
+#include <QTextBlock>
+#include <QTextDocument>
+#include <QThread>
+#include <QtConcurrent>
+
+KpadFileLoader::KpadFileLoader(const QString &filePath, QObject *parent)
+    : QObject(parent)
+    , path(filePath)
+    , cancelled(0)
+    , freeSlots(kMaxChunksInFlight)
+{
+}
+
+KpadFileLoader::~KpadFileLoader() {
+    cancel();
+    future.waitForFinished();
+}
+
+void KpadFileLoader::start() {
+    future = QtConcurrent::run([this]() { run(); });
+}
+
+void KpadFileLoader::cancel() {
+    cancelled.storeRelaxed(1);
+}
+
+void KpadFileLoader::chunkConsumed() {
+    freeSlots.release();
+}
+
+// --------------------
+// Worker
+// --------------------
+void KpadFileLoader::run() {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        emit finished(false, file.errorString());
+        return;
+    }
+
+    const qint64 total = file.size();
+    // Mapping keeps the raw bytes out of our heap; fall back to plain reads
+    // for devices that cannot be mapped.
+    const uchar *mapped = total > 0 ? file.map(0, total) : nullptr;
+    QByteArray readBuffer;
+    QElapsedTimer timer;
+
+    // Sniff the encoding: over the whole mapping, or the first chunk when
+    // the file has to be read
+    timer.start();
+    if (mapped)
+        textFormat = KpadEncoding::detect(reinterpret_cast<const char *>(mapped), total);
+    else {
+        const QByteArray head = file.peek(kChunkBytes);
+        textFormat = KpadEncoding::detect(head.constData(), head.size(), head.size() == total);
+    }
+    decodeNsecs = timer.nsecsElapsed();
+
+    KpadTextDecoder decoder(textFormat.encoding);
+    bool pendingCR = false;  // a '\r' that ended the previous chunk
+    qint64 offset = textFormat.bomBytes().size();
+    if (!mapped)
+        file.read(offset);  // skip the BOM
+
+    while (offset < total) {
+        qint64 length = qMin(kChunkBytes, total - offset);
+        const char *data = nullptr;
+
+        if (mapped) {
+            data = reinterpret_cast<const char *>(mapped + offset);
+        } else {
+            readBuffer = file.read(length);
+            if (readBuffer.isEmpty()) {
+                emit finished(false, file.errorString());
+                return;
+            }
+            length = readBuffer.size();
+            data = readBuffer.constData();
+        }
+
+        timer.start();
+        QString text = decoder.decode(data, length);
+        offset += length;
+        if (offset >= total)
+            text += decoder.flush();
+
+        // Same line-ending handling as QIODevice::Text: "\r\n" becomes "\n".
+        // A trailing '\r' is held back in case the next chunk starts with '\n'.
+        if (pendingCR)
+            text.prepend(QLatin1Char('\r'));
+        pendingCR = offset < total && text.endsWith(QLatin1Char('\r'));
+        if (pendingCR)
+            text.chop(1);
+        text.replace(QLatin1String("\r\n"), QLatin1String("\n"));
+        decodeNsecs += timer.nsecsElapsed();
+
+        // Wait for the GUI to consume a chunk before producing another one
+        while (!freeSlots.tryAcquire(1, 50)) {
+            if (cancelled.loadRelaxed())
+                return;
+        }
+        if (cancelled.loadRelaxed())
+            return;
+
+        emit chunkReady(text);
+        emit progress(offset, total);
+    }
+
+    emit finished(true, QString());
+}
+
+// --------------------
+// HTML Import
+// --------------------
+KpadHtmlLoader::KpadHtmlLoader(const QString &filePath, const QFont &font, QObject *parent)
+    : QObject(parent)
+    , path(filePath)
+    , defaultFont(font)
+    , cancelled(0)
+{
+    connect(&watcher, &QFutureWatcher<void>::finished, this, &KpadHtmlLoader::workerDone);
+}
+
+KpadHtmlLoader::~KpadHtmlLoader() {
+    cancel();
+    watcher.waitForFinished();
+    delete document;
+}
+
+void KpadHtmlLoader::start() {
+    targetThread = thread();
+    watcher.setFuture(QtConcurrent::run([this]() { run(); }));
+}
+
+void KpadHtmlLoader::cancel() {
+    cancelled.storeRelaxed(1);
+}
+
+void KpadHtmlLoader::abandon() {
+    cancel();
+    abandoned = true;
+    disconnect(this, nullptr, nullptr, nullptr);
+    setParent(nullptr);     // outlives the window it was started from, if need be
+    if (watcher.isFinished())
+        deleteLater();
+}
+
+QTextDocument *KpadHtmlLoader::takeDocument() {
+    QTextDocument *doc = document;
+    document = nullptr;
+    return doc;
+}
+
+void KpadHtmlLoader::workerDone() {
+    if (abandoned) {
+        deleteLater();
+        return;
+    }
+    emit finished(ok, errorString);
+}
+
+void KpadHtmlLoader::run() {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        errorString = file.errorString();
+        return;
+    }
+
+    bytesTotal = file.size();
+    QByteArray bytes;
+    bytes.reserve(int(qMin<qint64>(bytesTotal, INT_MAX)));
+    while (!file.atEnd()) {
+        const QByteArray chunk = file.read(kChunkBytes);
+        if (chunk.isEmpty()) {
+            errorString = file.errorString();
+            return;
+        }
+        bytes += chunk;
+        if (cancelled.loadRelaxed())
+            return;
+        emit progress(bytes.size(), bytesTotal);
+    }
+
+    textFormat = KpadEncoding::detect(bytes.constData(), bytes.size());
+    const int bomSize = textFormat.bomBytes().size();
+    KpadTextDecoder decoder(textFormat.encoding);
+    QString text = decoder.decode(bytes.constData() + bomSize, bytes.size() - bomSize);
+    text += decoder.flush();
+    bytes = QByteArray();
+    if (cancelled.loadRelaxed())
+        return;
+
+    emit parsing();
+    // No parent: a QObject cannot change threads with one
+    QTextDocument *doc = new QTextDocument;
+    doc->setDefaultFont(defaultFont);
+    doc->setUndoRedoEnabled(false);     // the import is not an edit
+    doc->setHtml(text);
+    text = QString();
+
+    // Count words here too, so the editor starts with a full tally
+    tally = std::make_shared<KpadWordTally>();
+    for (QTextBlock block = doc->begin(); block.isValid() && !cancelled.loadRelaxed(); block = block.next()) {
+        const QString blockText = block.text();
+        KpadBlockData *data = new KpadBlockData(tally);
+        data->setWords(kpadCountWords(blockText.constData(), blockText.size()));
+        block.setUserData(data);
+    }
+    if (cancelled.loadRelaxed()) {
+        delete doc;
+        return;
+    }
+
+    doc->moveToThread(targetThread);
+    document = doc;
+    ok = true;
+}
@@ -0,0 +1,109 @@
+#ifndef KPAD_LOADER_H
+#define KPAD_LOADER_H
+
+#include <QObject>
+#include <QString>
+#include <QFuture>
+#include <QSemaphore>
+#include <QAtomicInt>
+#include <QFont>
+#include <QFutureWatcher>
+#include <memory>
+
+#include "kpad_encoding.h"
+#include "kpad_counter.h"
+
+class QTextDocument;
+
+// Streams a large text file into the editor.
+// The file is memory-mapped and decoded in chunks on a worker thread; every
+// decoded chunk is handed to the GUI thread through chunkReady(). Only a few
+// chunks may be in flight at once, so memory stays near one copy of the text.
+// The encoding is detected first (see KpadEncoding::detect).
+class KpadFileLoader : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit KpadFileLoader(const QString &filePath, QObject *parent = nullptr);
+    ~KpadFileLoader();              // Cancels and waits for the worker
+
+    void start();
+    void cancel();
+    void chunkConsumed();           // GUI calls this once a chunk is in the document
+    QString filePath() const { return path; }
+    // Valid once finished() has been emitted
+    KpadTextFormat format() const { return textFormat; }
+    qint64 decodeTime() const { return decodeNsecs; }   // nanoseconds spent detecting and decoding
+
+signals:
+    void chunkReady(const QString &text);
+    void progress(qint64 bytesDone, qint64 bytesTotal);
+    void finished(bool ok, const QString &errorString);
+
+private:
+    void run();                     // Worker thread body
+
+    static constexpr qint64 kChunkBytes = 1024 * 1024;
+    static constexpr int kMaxChunksInFlight = 3;
+
+    QString path;
+    KpadTextFormat textFormat;
+    qint64 decodeNsecs = 0;
+    QAtomicInt cancelled;
+    QSemaphore freeSlots;
+    QFuture<void> future;
+};
+
+// Imports an HTML file into a detached QTextDocument on a worker thread.
+// The document is parsed (and its words counted) away from the editor,
+// then moved to the loader's thread and handed over whole with
+// takeDocument(), so the window keeps painting while a large report loads.
+// setHtml() reports no progress and cannot stop half way: progress covers
+// reading the file, and an abandoned import finishes parsing unseen.
+class KpadHtmlLoader : public QObject
+{
+    Q_OBJECT
+
+public:
+    KpadHtmlLoader(const QString &filePath, const QFont &font, QObject *parent = nullptr);
+    ~KpadHtmlLoader();              // Waits for the worker
+
+    void start();
+    // Drops the import without waiting: no more signals, and the loader
+    // deletes itself (and the document) once the worker is done
+    void abandon();
+    QString filePath() const { return path; }
+    // Valid once finished() has been emitted
+    QTextDocument *takeDocument();  // The caller owns it
+    std::shared_ptr<KpadWordTally> wordTally() const { return tally; }
+    KpadTextFormat format() const { return textFormat; }
+    qint64 fileSize() const { return bytesTotal; }
+
+signals:
+    void progress(qint64 bytesDone, qint64 bytesTotal);
+    void parsing();                 // The file is read; setHtml() is running
+    void finished(bool ok, const QString &errorString);
+
+private:
+    void run();                     // Worker thread body
+    void cancel();
+    void workerDone();
+
+    static constexpr qint64 kChunkBytes = 1024 * 1024;
+
+    QString path;
+    QFont defaultFont;
+    QThread *targetThread = nullptr;
+    QTextDocument *document = nullptr;
+    std::shared_ptr<KpadWordTally> tally;
+    KpadTextFormat textFormat;
+    qint64 bytesTotal = 0;
+    bool ok = false;
+    QString errorString;
+    QAtomicInt cancelled;
+    bool abandoned = false;
+    QFutureWatcher<void> watcher;
+};
+
+#endif // KPAD_LOADER_H
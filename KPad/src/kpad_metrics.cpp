@@ -0,0 +1,158 @@
+#include "kpad_metrics.h"
+
+#include <QSaveFile>
+#include <QTextStream>
+#include <QtAlgorithms>
+
+namespace {
+
+// Buckets 0-3 are whole microseconds; from there on each power of two of
+// microseconds is split into four equal buckets. 112 buckets reach ~8 minutes.
+constexpr int kSubBuckets = 4;
+constexpr int kBuckets = 112;
+
+int bucketFor(qint64 nsecs) {
+    const quint64 usecs = quint64(qMax<qint64>(nsecs, 0)) / 1000;
+    if (usecs < kSubBuckets)
+        return int(usecs);
+    const int octave = 63 - qCountLeadingZeroBits(usecs);   // >= 2
+    const int sub = int(usecs >> (octave - 2)) & (kSubBuckets - 1);
+    return qMin((octave - 1) * kSubBuckets + sub, kBuckets - 1);
+}
+
+// Smallest value (ns) that falls into bucket
+qint64 bucketFloor(int bucket) {
+    if (bucket < kSubBuckets)
+        return qint64(bucket) * 1000;
+    const int octave = bucket / kSubBuckets + 1;
+    const int sub = bucket % kSubBuckets;
+    return (qint64(kSubBuckets + sub) << (octave - 2)) * 1000;
+}
+
+struct Histogram
+{
+    qint64 count = 0;
+    qint64 totalNsecs = 0;
+    qint64 lastNsecs = 0;
+    qint64 maxNsecs = 0;
+    qint64 buckets[kBuckets] = {};
+};
+
+Histogram histograms[KpadMetrics::HandlerCount];
+
+const char *const kNames[KpadMetrics::HandlerCount] = {
+    "keyPressEvent", "eventFilter", "updateCounts", "highlightMatches", "open", "save", "paint"
+};
+
+QString formatMsecs(qint64 nsecs) {
+    return QString::number(nsecs / 1e6, 'f', nsecs < 10000000 ? 3 : 1);
+}
+
+} // namespace
+
+void KpadMetrics::addSample(Handler handler, qint64 nsecs) {
+    Histogram &h = histograms[handler];
+    ++h.count;
+    h.totalNsecs += nsecs;
+    h.lastNsecs = nsecs;
+    h.maxNsecs = qMax(h.maxNsecs, nsecs);
+    ++h.buckets[bucketFor(nsecs)];
+}
+
+void KpadMetrics::reset() {
+    for (Histogram &h : histograms)
+        h = Histogram();
+}
+
+const char *KpadMetrics::name(Handler handler) {
+    return kNames[handler];
+}
+
+qint64 KpadMetrics::count(Handler handler) {
+    return histograms[handler].count;
+}
+
+qint64 KpadMetrics::lastNsecs(Handler handler) {
+    return histograms[handler].lastNsecs;
+}
+
+qint64 KpadMetrics::maxNsecs(Handler handler) {
+    return histograms[handler].maxNsecs;
+}
+
+qint64 KpadMetrics::meanNsecs(Handler handler) {
+    const Histogram &h = histograms[handler];
+    return h.count ? h.totalNsecs / h.count : 0;
+}
+
+qint64 KpadMetrics::percentileNsecs(Handler handler, double fraction) {
+    const Histogram &h = histograms[handler];
+    if (!h.count)
+        return 0;
+    const qint64 rank = qMax<qint64>(1, qint64(fraction * h.count + 0.5));
+    qint64 seen = 0;
+    for (int b = 0; b < kBuckets; ++b) {
+        seen += h.buckets[b];
+        if (seen >= rank)
+            return qMin(b + 1 < kBuckets ? bucketFloor(b + 1) : h.maxNsecs, h.maxNsecs);
+    }
+    return h.maxNsecs;
+}
+
+QString KpadMetrics::report() {
+    QString text;
+    QTextStream out(&text);
+    out << "KPad+ latency report (ms)\n\n";
+    out << QString("%1 %2 %3 %4 %5 %6 %7\n")
+               .arg(QLatin1String("handler"), -18).arg(QLatin1String("count"), 9)
+               .arg(QLatin1String("mean"), 10).arg(QLatin1String("p50"), 10)
+               .arg(QLatin1String("p95"), 10).arg(QLatin1String("p99"), 10)
+               .arg(QLatin1String("max"), 10);
+    for (int i = 0; i < HandlerCount; ++i) {
+        const Handler handler = Handler(i);
+        if (!count(handler))
+            continue;
+        out << QString("%1 %2 %3 %4 %5 %6 %7\n")
+                   .arg(QLatin1String(name(handler)), -18)
+                   .arg(count(handler), 9)
+                   .arg(formatMsecs(meanNsecs(handler)), 10)
+                   .arg(formatMsecs(percentileNsecs(handler, 0.50)), 10)
+                   .arg(formatMsecs(percentileNsecs(handler, 0.95)), 10)
+                   .arg(formatMsecs(percentileNsecs(handler, 0.99)), 10)
+                   .arg(formatMsecs(maxNsecs(handler)), 10);
+    }
+
+    // Histograms: only the buckets that have samples
+    for (int i = 0; i < HandlerCount; ++i) {
+        const Histogram &h = histograms[i];
+        if (!h.count)
+            continue;
+        out << "\n" << QLatin1String(kNames[i]) << "\n";
+        for (int b = 0; b < kBuckets; ++b) {
+            if (!h.buckets[b])
+                continue;
+            out << QString("  %1 - %2 ms  %3\n")
+                       .arg(formatMsecs(bucketFloor(b)), 10)
+                       .arg(b + 1 < kBuckets ? formatMsecs(bucketFloor(b + 1)) : QString("..."), -10)
+                       .arg(h.buckets[b]);
+        }
+    }
+    out.flush();
+    return text;
+}
+
+bool KpadMetrics::writeReport(const QString &filePath, QString *errorString) {
+    QSaveFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        if (errorString)
+            *errorString = file.errorString();
+        return false;
+    }
+    file.write(report().toUtf8());
+    if (!file.commit()) {
+        if (errorString)
+            *errorString = file.errorString();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,73 @@
+#ifndef KPAD_METRICS_H
+#define KPAD_METRICS_H
+
+#include <QElapsedTimer>
+#include <QString>
+
+// --------------------
+// Latency Metrics
+// --------------------
+// Per-handler latency histograms for the editor's hot paths. Collection is
+// off by default; then a traced scope costs one load and branch of a
+// static bool, and nothing is timed or stored. When it is on, each sample
+// goes into a log-linear histogram (four buckets per power of two of
+// microseconds, so percentiles are within 25%), a fixed array per handler:
+// recording never allocates. Everything is recorded on the GUI thread.
+class KpadMetrics
+{
+public:
+    enum Handler { KeyPress, EventFilter, UpdateCounts, HighlightMatches, Open, Save, Paint, HandlerCount };
+
+    static bool isEnabled() { return enabled; }
+    static void setEnabled(bool on) { enabled = on; }
+    static void reset();
+
+    static void record(Handler handler, qint64 nsecs) {
+        if (enabled)
+            addSample(handler, nsecs);
+    }
+
+    static const char *name(Handler handler);
+    static qint64 count(Handler handler);
+    static qint64 lastNsecs(Handler handler);
+    static qint64 maxNsecs(Handler handler);
+    static qint64 meanNsecs(Handler handler);
+    // Upper bound of the bucket holding the given fraction of the samples
+    static qint64 percentileNsecs(Handler handler, double fraction);
+
+    // Plain-text table of every handler with samples, and its histogram
+    static QString report();
+    static bool writeReport(const QString &filePath, QString *errorString = nullptr);
+
+private:
+    static void addSample(Handler handler, qint64 nsecs);
+
+    static inline bool enabled = false;
+};
+
+// Times the enclosing scope into handler while metrics are enabled
+class KpadTraceScope
+{
+public:
+    explicit KpadTraceScope(KpadMetrics::Handler handler) : handler(handler) {
+        if (KpadMetrics::isEnabled())
+            timer.start();
+    }
+    ~KpadTraceScope() {
+        if (timer.isValid())
+            KpadMetrics::record(handler, timer.nsecsElapsed());
+    }
+    KpadTraceScope(const KpadTraceScope &) = delete;
+    KpadTraceScope &operator=(const KpadTraceScope &) = delete;
+
+private:
+    KpadMetrics::Handler handler;
+    QElapsedTimer timer;
+};
+
+#define KPAD_TRACE_CONCAT_(a, b) a##b
+#define KPAD_TRACE_CONCAT(a, b) KPAD_TRACE_CONCAT_(a, b)
+#define KPAD_TRACE_SCOPE(handler) \
+    KpadTraceScope KPAD_TRACE_CONCAT(kpadTraceScope, __LINE__)(KpadMetrics::handler)
+
+#endif // KPAD_METRICS_H
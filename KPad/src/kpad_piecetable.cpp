@@ -0,0 +1,279 @@
+#include "kpad_piecetable.h"
+
+#include <utility>
+
+namespace {
+
+using Visitor = std::function<bool(const QChar *data, int length)>;
+
+int sizeOf(const KpadPieceNodePtr &node) { return node ? node->size : 0; }
+int countOf(const KpadPieceNodePtr &node) { return node ? node->count : 0; }
+
+KpadPieceNodePtr makeNode(const KpadPiece &piece, quint32 priority,
+                          KpadPieceNodePtr left, KpadPieceNodePtr right) {
+    auto node = std::make_shared<KpadPieceNode>();
+    node->piece = piece;
+    node->priority = priority;
+    node->size = sizeOf(left) + piece.length + sizeOf(right);
+    node->count = countOf(left) + 1 + countOf(right);
+    node->left = std::move(left);
+    node->right = std::move(right);
+    return node;
+}
+
+KpadPieceNodePtr merge(const KpadPieceNodePtr &a, const KpadPieceNodePtr &b) {
+    if (!a) return b;
+    if (!b) return a;
+    if (a->priority >= b->priority)
+        return makeNode(a->piece, a->priority, a->left, merge(a->right, b));
+    return makeNode(b->piece, b->priority, merge(a, b->left), b->right);
+}
+
+// Splits so that the first tree holds exactly k characters.
+// A piece that straddles k is cut in two; both halves keep the node's priority.
+std::pair<KpadPieceNodePtr, KpadPieceNodePtr> split(const KpadPieceNodePtr &node, int k) {
+    if (!node)
+        return {nullptr, nullptr};
+
+    const int leftSize = sizeOf(node->left);
+    if (k <= leftSize) {
+        auto parts = split(node->left, k);
+        return {parts.first, makeNode(node->piece, node->priority, parts.second, node->right)};
+    }
+
+    const int inPiece = k - leftSize;
+    if (inPiece >= node->piece.length) {
+        auto parts = split(node->right, inPiece - node->piece.length);
+        return {makeNode(node->piece, node->priority, node->left, parts.first), parts.second};
+    }
+
+    KpadPiece head = node->piece;
+    KpadPiece tail = node->piece;
+    head.length = inPiece;
+    tail.start += inPiece;
+    tail.length -= inPiece;
+    return {makeNode(head, node->priority, node->left, nullptr),
+            makeNode(tail, node->priority, nullptr, node->right)};
+}
+
+// Grows the piece that ends at pos by n characters, if that piece ends at
+// the tail of buffer. Returns the new root, or null if no such piece exists.
+KpadPieceNodePtr extendAt(const KpadPieceNodePtr &node, int pos, int n, const QString *buffer) {
+    if (!node)
+        return nullptr;
+
+    const int leftSize = sizeOf(node->left);
+    const int pieceEnd = leftSize + node->piece.length;
+
+    if (pos <= leftSize) {
+        KpadPieceNodePtr left = extendAt(node->left, pos, n, buffer);
+        return left ? makeNode(node->piece, node->priority, left, node->right) : nullptr;
+    }
+    if (pos < pieceEnd)
+        return nullptr;  // pos falls inside this piece
+    if (pos == pieceEnd) {
+        const KpadPiece &piece = node->piece;
+        if (piece.buffer.get() != buffer || piece.start + piece.length != buffer->size())
+            return nullptr;
+        KpadPiece grown = piece;
+        grown.length += n;
+        return makeNode(grown, node->priority, node->left, node->right);
+    }
+
+    KpadPieceNodePtr right = extendAt(node->right, pos - pieceEnd, n, buffer);
+    return right ? makeNode(node->piece, node->priority, node->left, right) : nullptr;
+}
+
+bool visitRange(const KpadPieceNode *node, int from, int to, const Visitor &visit) {
+    if (!node || from >= to)
+        return true;
+
+    const int leftSize = sizeOf(node->left);
+    const int pieceEnd = leftSize + node->piece.length;
+
+    if (from < leftSize && !visitRange(node->left.get(), from, qMin(to, leftSize), visit))
+        return false;
+
+    const int a = qMax(from, leftSize);
+    const int b = qMin(to, pieceEnd);
+    if (a < b && !visit(node->piece.data() + (a - leftSize), b - a))
+        return false;
+
+    if (to > pieceEnd)
+        return visitRange(node->right.get(), qMax(from, pieceEnd) - pieceEnd, to - pieceEnd, visit);
+    return true;
+}
+
+} // namespace
+
+// --------------------
+// Snapshot
+// --------------------
+KpadTextSnapshot KpadTextSnapshot::fromString(const QString &text) {
+    if (text.isEmpty())
+        return KpadTextSnapshot();
+    KpadPiece piece{std::make_shared<const QString>(text), 0, int(text.size())};
+    return KpadTextSnapshot(makeNode(piece, 0, nullptr, nullptr));
+}
+
+int KpadTextSnapshot::length() const {
+    return sizeOf(root);
+}
+
+int KpadTextSnapshot::pieceCount() const {
+    return countOf(root);
+}
+
+QChar KpadTextSnapshot::at(int pos) const {
+    const KpadPieceNode *node = root.get();
+    while (node) {
+        const int leftSize = sizeOf(node->left);
+        if (pos < leftSize) {
+            node = node->left.get();
+        } else if (pos < leftSize + node->piece.length) {
+            return node->piece.data()[pos - leftSize];
+        } else {
+            pos -= leftSize + node->piece.length;
+            node = node->right.get();
+        }
+    }
+    return QChar();
+}
+
+QString KpadTextSnapshot::mid(int pos, int length) const {
+    QString result;
+    result.reserve(qMax(0, qMin(length, this->length() - pos)));
+    forEachChunk(pos, length, [&](const QChar *data, int n) {
+        result.append(data, n);
+        return true;
+    });
+    return result;
+}
+
+QString KpadTextSnapshot::toString() const {
+    // A freshly loaded document is one piece covering its whole buffer:
+    // hand out the buffer itself (implicitly shared, no copy). Not an add
+    // buffer: the editor thread keeps appending to that QString.
+    if (root && root->count == 1 && !root->piece.inAddBuffer && root->piece.start == 0
+        && root->piece.length == root->piece.buffer->size())
+        return *root->piece.buffer;
+    return mid(0, length());
+}
+
+void KpadTextSnapshot::forEachChunk(const std::function<bool(const QChar *, int)> &visit) const {
+    visitRange(root.get(), 0, length(), visit);
+}
+
+void KpadTextSnapshot::forEachChunk(int from, int length, const std::function<bool(const QChar *, int)> &visit) const {
+    from = qMax(0, from);
+    const int to = qMin(this->length(), from + length);
+    visitRange(root.get(), from, to, visit);
+}
+
+// --------------------
+// Piece Table
+// --------------------
+void KpadPieceTable::reset(const QString &original) {
+    addBuffer.reset();
+    root.reset();
+    if (!original.isEmpty())
+        root = leaf(KpadPiece{std::make_shared<const QString>(original), 0, int(original.size())});
+}
+
+void KpadPieceTable::append(const QString &text) {
+    if (text.isEmpty())
+        return;
+    root = merge(root, leaf(KpadPiece{std::make_shared<const QString>(text), 0, int(text.size())}));
+}
+
+void KpadPieceTable::insert(int pos, const QString &text) {
+    if (text.isEmpty())
+        return;
+    pos = qBound(0, pos, length());
+
+    // Typing: keep growing the piece the previous keystroke created
+    if (extendAddPiece(pos, text))
+        return;
+
+    KpadPiece piece;
+    if (text.size() >= kAddBufferSize / 4) {
+        // Large pastes keep their own buffer (shared with the caller)
+        piece = KpadPiece{std::make_shared<const QString>(text), 0, int(text.size())};
+    } else {
+        if (!addBuffer || addBuffer->size() + text.size() > addBuffer->capacity()) {
+            addBuffer = std::make_shared<QString>();
+            addBuffer->reserve(kAddBufferSize);
+        }
+        piece = KpadPiece{addBuffer, int(addBuffer->size()), int(text.size()), true};
+        addBuffer->append(text);
+    }
+
+    auto parts = split(root, pos);
+    root = merge(merge(parts.first, leaf(piece)), parts.second);
+}
+
+void KpadPieceTable::remove(int pos, int length) {
+    pos = qBound(0, pos, this->length());
+    length = qMin(length, this->length() - pos);
+    if (length <= 0)
+        return;
+
+    auto head = split(root, pos);
+    auto tail = split(head.second, length);
+    root = merge(head.first, tail.second);
+}
+
+void KpadPieceTable::normalize(QString &text) {
+    const QChar *begin = text.constData();
+    const QChar *end = begin + text.size();
+    for (const QChar *c = begin; c != end; ++c) {
+        const ushort u = c->unicode();
+        if (u != '\r' && u != 0x2028 && u != 0x2029 && u != 0x00A0 && u != 0xFDD0 && u != 0xFDD1)
+            continue;
+
+        // Only detach when something actually has to change
+        QChar *data = text.data();
+        for (qsizetype i = c - begin; i < text.size(); ++i) {
+            switch (data[i].unicode()) {
+            case '\r': case 0x2028: case 0x2029: case 0xFDD0: case 0xFDD1:
+                data[i] = QLatin1Char('\n');
+                break;
+            case 0x00A0:
+                data[i] = QLatin1Char(' ');
+                break;
+            default:
+                break;
+            }
+        }
+        return;
+    }
+}
+
+int KpadPieceTable::length() const {
+    return sizeOf(root);
+}
+
+int KpadPieceTable::pieceCount() const {
+    return countOf(root);
+}
+
+KpadPieceNodePtr KpadPieceTable::leaf(const KpadPiece &piece) {
+    // xorshift32: priorities only need to be well spread, not secure
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return makeNode(piece, seed, nullptr, nullptr);
+}
+
+bool KpadPieceTable::extendAddPiece(int pos, const QString &text) {
+    if (!addBuffer || addBuffer->size() + text.size() > addBuffer->capacity())
+        return false;
+
+    KpadPieceNodePtr grown = extendAt(root, pos, int(text.size()), addBuffer.get());
+    if (!grown)
+        return false;
+
+    addBuffer->append(text);
+    root = grown;
+    return true;
+}
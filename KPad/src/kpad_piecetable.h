@@ -0,0 +1,102 @@
+#ifndef KPAD_PIECETABLE_H
+#define KPAD_PIECETABLE_H
+
+#include <QString>
+#include <QStringView>
+#include <functional>
+#include <memory>
+
+// A piece points at a run of characters inside one immutable text buffer.
+// The buffer is kept alive by the shared pointer. An add buffer is only
+// immutable up to the characters pieces point at; more is appended to it.
+struct KpadPiece
+{
+    std::shared_ptr<const QString> buffer;
+    int start = 0;
+    int length = 0;
+    bool inAddBuffer = false;
+
+    const QChar *data() const { return buffer->constData() + start; }
+};
+
+// Treap node. Nodes are never modified after creation, so a snapshot is only
+// a root pointer. Edits copy the O(log n) path from the root to the change.
+struct KpadPieceNode
+{
+    KpadPiece piece;
+    std::shared_ptr<const KpadPieceNode> left;
+    std::shared_ptr<const KpadPieceNode> right;
+    quint32 priority = 0;
+    int size = 0;                   // characters in this subtree
+    int count = 0;                  // pieces in this subtree
+};
+
+using KpadPieceNodePtr = std::shared_ptr<const KpadPieceNode>;
+
+// --------------------
+// Read-only view of the text at one point in time
+// --------------------
+// Snapshots are cheap to take and copy, and safe to read from any thread
+// while the editor keeps changing the live table.
+class KpadTextSnapshot
+{
+public:
+    KpadTextSnapshot() = default;
+    static KpadTextSnapshot fromString(const QString &text);
+
+    int length() const;
+    bool isEmpty() const { return length() == 0; }
+    int pieceCount() const;
+    QChar at(int pos) const;
+    QString mid(int pos, int length) const;
+    QString toString() const;
+
+    // Calls visit(data, length) for each piece in order until it returns false
+    void forEachChunk(const std::function<bool(const QChar *data, int length)> &visit) const;
+    // Same, limited to the characters in [from, from + length)
+    void forEachChunk(int from, int length, const std::function<bool(const QChar *data, int length)> &visit) const;
+
+private:
+    friend class KpadPieceTable;
+    explicit KpadTextSnapshot(KpadPieceNodePtr root) : root(std::move(root)) {}
+
+    KpadPieceNodePtr root;
+};
+
+// --------------------
+// Piece table
+// --------------------
+// Plain-text buffer behind the editor. The text the file was opened with is
+// kept as one read-only piece; insertions go to an append-only add buffer.
+// Inserts and deletes cost O(log n) in the number of pieces.
+class KpadPieceTable
+{
+public:
+    KpadPieceTable() = default;
+
+    void reset(const QString &original);   // Original text becomes the read-only piece
+    void append(const QString &text);      // Shares text's buffer instead of copying it
+    void insert(int pos, const QString &text);
+    void remove(int pos, int length);
+
+    int length() const;
+    int pieceCount() const;
+    KpadTextSnapshot snapshot() const { return KpadTextSnapshot(root); }
+
+    // Maps separators and nbsp to the characters toPlainText() produces
+    static void normalize(QString &text);
+
+private:
+    KpadPieceNodePtr leaf(const KpadPiece &piece);
+    bool extendAddPiece(int pos, const QString &text);
+
+    static constexpr int kAddBufferSize = 64 * 1024;
+
+    KpadPieceNodePtr root;
+    // Current add buffer. Text is only ever appended within its reserved
+    // capacity, so characters that pieces already point at never move.
+    std::shared_ptr<QString> addBuffer;
+    quint32 seed = 0x9E3779B9u;
+};
+
+#endif // KPAD_PIECETABLE_H
@@ -0,0 +1,136 @@
+#include "kpad_saver.h"
+
+#include <QSaveFile>
+#include <QElapsedTimer>
+#include <QtConcurrent>
+
+// Huge pieces are encoded in slices so no full-size byte copy is ever made
+static const int kSliceChars = 1024 * 1024;
+
+KpadFileSaver::KpadFileSaver(QObject *parent)
+    : QObject(parent)
+{
+    connect(&watcher, &QFutureWatcher<KpadSaveResult>::finished, this, &KpadFileSaver::collectResult);
+}
+
+KpadFileSaver::~KpadFileSaver() {
+    hasPending = false;
+    watcher.waitForFinished();
+}
+
+void KpadFileSaver::save(const QString &filePath, const KpadTextSnapshot &snapshot, const KpadTextFormat &format,
+                         int revision) {
+    if (inFlight) {
+        // Only the newest request matters; it replaces an older queued one
+        hasPending = true;
+        pendingPath = filePath;
+        pendingSnapshot = snapshot;
+        pendingFormat = format;
+        pendingRevision = revision;
+        return;
+    }
+    start(filePath, snapshot, format, revision);
+}
+
+KpadSaveResult KpadFileSaver::waitForFinished() {
+    while (inFlight) {
+        watcher.waitForFinished();
+        collectResult();
+    }
+    return lastResult;
+}
+
+void KpadFileSaver::start(const QString &filePath, const KpadTextSnapshot &snapshot, const KpadTextFormat &format,
+                          int revision) {
+    inFlight = true;
+    watcher.setFuture(QtConcurrent::run([filePath, snapshot, format, revision]() {
+        KpadSaveResult result = write(filePath, snapshot, format);
+        result.revision = revision;
+        return result;
+    }));
+}
+
+void KpadFileSaver::collectResult() {
+    // Already collected by waitForFinished()
+    if (!inFlight || !watcher.isFinished())
+        return;
+
+    inFlight = false;
+    lastResult = watcher.result();
+
+    if (hasPending) {
+        hasPending = false;
+        start(pendingPath, pendingSnapshot, pendingFormat, pendingRevision);
+        pendingSnapshot = KpadTextSnapshot();
+    }
+
+    emit finished(lastResult);
+}
+
+// --------------------
+// Worker
+// --------------------
+KpadSaveResult KpadFileSaver::write(const QString &filePath, const KpadTextSnapshot &snapshot,
+                                    const KpadTextFormat &format) {
+    KpadSaveResult result;
+    result.filePath = filePath;
+    result.format = format;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // Line endings come from the format, so no QIODevice::Text translation
+    QSaveFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        result.errorString = file.errorString();
+        return result;
+    }
+
+    if (format.encoding == KpadTextFormat::Latin1) {
+        bool fits = true;
+        snapshot.forEachChunk([&](const QChar *data, int length) {
+            fits = KpadEncoding::fitsLatin1(data, length);
+            return fits;
+        });
+        if (!fits) {
+            result.format.encoding = KpadTextFormat::Utf8;
+            result.format.bom = false;
+        }
+    }
+
+    // Stateful encoder: a surrogate pair split across slices stays intact
+    KpadTextEncoder encoder(result.format);
+
+    bool ok = true;
+    snapshot.forEachChunk([&](const QChar *data, int length) {
+        for (int offset = 0; ok && offset < length; offset += kSliceChars) {
+            const int n = qMin(kSliceChars, length - offset);
+            QByteArray bytes = encoder.encode(data + offset, n);
+            ok = file.write(bytes) == bytes.size();
+            result.bytes += bytes.size();
+        }
+        return ok;
+    });
+
+    if (ok) {
+        QByteArray bytes = encoder.flush();
+        ok = file.write(bytes) == bytes.size();
+        result.bytes += bytes.size();
+    }
+
+    if (!ok) {
+        result.errorString = file.errorString();
+        file.cancelWriting();
+        return result;
+    }
+
+    // commit() syncs the temporary file to disk, then renames it over the target
+    if (!file.commit()) {
+        result.errorString = file.errorString();
+        return result;
+    }
+
+    result.ok = true;
+    result.msecs = timer.elapsed();
+    return result;
+}
@@ -0,0 +1,66 @@
+#ifndef KPAD_SAVER_H
+#define KPAD_SAVER_H
+
+#include <QObject>
+#include <QString>
+#include <QFutureWatcher>
+
+#include "kpad_piecetable.h"
+#include "kpad_encoding.h"
+
+struct KpadSaveResult
+{
+    QString filePath;
+    bool ok = false;
+    QString errorString;
+    qint64 bytes = 0;               // bytes written
+    qint64 msecs = 0;               // time spent encoding and writing
+    KpadTextFormat format;          // format actually written
+    int revision = 0;               // document revision the snapshot was taken at
+};
+
+// The one save engine behind Save, Save As and saveFile().
+// A document snapshot is encoded and written on a worker thread into a
+// temporary file, which is flushed to disk and renamed over the target in
+// one step (QSaveFile). A crash mid-write leaves the old file untouched.
+// Text is written in the file's own encoding, BOM and line endings; a
+// Latin-1 file that gained characters Latin-1 cannot hold is written as
+// UTF-8 instead (see KpadSaveResult::format).
+class KpadFileSaver : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit KpadFileSaver(QObject *parent = nullptr);
+    ~KpadFileSaver();               // Waits for a running write
+
+    // revision comes back in the result, to tell whether the document
+    // still matches what was written
+    void save(const QString &filePath, const KpadTextSnapshot &snapshot, const KpadTextFormat &format,
+              int revision);
+    bool isBusy() const { return inFlight; }
+    KpadSaveResult waitForFinished();   // Blocks until every queued save is done
+
+    // Synchronous write, also used by the worker
+    static KpadSaveResult write(const QString &filePath, const KpadTextSnapshot &snapshot,
+                                const KpadTextFormat &format);
+
+signals:
+    void finished(const KpadSaveResult &result);
+
+private:
+    void start(const QString &filePath, const KpadTextSnapshot &snapshot, const KpadTextFormat &format,
+               int revision);
+    void collectResult();
+
+    QFutureWatcher<KpadSaveResult> watcher;
+    bool inFlight = false;
+    bool hasPending = false;        // a save requested while another was running
+    QString pendingPath;
+    KpadTextSnapshot pendingSnapshot;
+    KpadTextFormat pendingFormat;
+    int pendingRevision = 0;
+    KpadSaveResult lastResult;
+};
+
+#endif // KPAD_SAVER_H
@@ -0,0 +1,438 @@
+#include "kpad_search.h"
+
+#include <QStringView>
+#include <QRegularExpressionMatchIterator>
+#include <cstring>
+
+// --------------------
+// SIMD availability
+// --------------------
+// SSE2 is part of x86-64, so it is a compile-time decision. AVX2 code is
+// compiled with a per-function target attribute and only run after a
+// CPUID check, so the binary still starts on CPUs without AVX2.
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#  if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#    define KPAD_SEARCH_SSE2 1
+#    include <immintrin.h>
+#    if defined(_MSC_VER) && !defined(__clang__)
+#      include <intrin.h>
+#      define KPAD_SEARCH_AVX2 1
+#      define KPAD_TARGET_AVX2
+#    elif defined(__GNUC__) || defined(__clang__)
+#      define KPAD_SEARCH_AVX2 1
+#      define KPAD_TARGET_AVX2 __attribute__((target("avx2")))
+#    endif
+#  endif
+#endif
+
+// Pieces are scanned in slices so a cancel is noticed quickly
+static const int kSliceChars = 256 * 1024;
+
+// How far a regex match may run past the slice of a long line it starts in
+static const int kRegexOverlapChars = 4 * 1024;
+
+namespace {
+
+bool cpuHasAvx2() {
+#if defined(KPAD_SEARCH_AVX2) && defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+        return false;  // the OS does not save YMM registers
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#elif defined(KPAD_SEARCH_AVX2)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+inline int lowestBit(unsigned mask) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return int(index);
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+// Accepted forms of an anchor character for the vector compare.
+// Only ASCII letters have exactly two case forms; 'k' and 's' are also the
+// fold of KELVIN SIGN and LONG S, so they cannot be anchors either.
+bool vectorAnchor(ushort c, Qt::CaseSensitivity cs, ushort forms[2]) {
+    forms[0] = forms[1] = c;
+    if (cs == Qt::CaseSensitive)
+        return true;
+    if (c >= 0x80)
+        return false;
+    const ushort lower = c | 0x20;
+    if (lower >= 'a' && lower <= 'z') {
+        if (lower == 'k' || lower == 's')
+            return false;
+        forms[0] = lower;
+        forms[1] = lower & ~0x20;
+    }
+    return true;
+}
+
+} // namespace
+
+namespace KpadSearch {
+
+// Kernel bodies; friends of LiteralMatcher
+struct LiteralKernels
+{
+    static bool verify(const ushort *h, const LiteralMatcher &p) {
+        const qsizetype m = p.needle.size();
+        if (p.cs == Qt::CaseSensitive)
+            return std::memcmp(h, p.needle.utf16(), size_t(m) * sizeof(ushort)) == 0;
+        for (qsizetype k = 0; k < m; ++k) {
+            if (QChar::toCaseFolded(h[k]) != p.folded[k])
+                return false;
+        }
+        return true;
+    }
+
+    // Checks the positions the vector loop did not cover
+    static qsizetype tail(const ushort *h, qsizetype n, qsizetype i, const LiteralMatcher &p) {
+        const qsizetype m = p.needle.size();
+        for (; i <= n - m; ++i) {
+            const ushort a = h[i];
+            const ushort b = h[i + m - 1];
+            if ((a == p.first[0] || a == p.first[1]) && (b == p.last[0] || b == p.last[1])
+                && verify(h + i, p))
+                return i;
+        }
+        return -1;
+    }
+
+#ifdef KPAD_SEARCH_SSE2
+    static qsizetype sse2(const ushort *h, qsizetype n, qsizetype i, const LiteralMatcher &p) {
+        const qsizetype m = p.needle.size();
+        const qsizetype lastStart = n - m;
+        const __m128i first0 = _mm_set1_epi16(short(p.first[0]));
+        const __m128i first1 = _mm_set1_epi16(short(p.first[1]));
+        const __m128i last0 = _mm_set1_epi16(short(p.last[0]));
+        const __m128i last1 = _mm_set1_epi16(short(p.last[1]));
+
+        for (; i + 7 <= lastStart; i += 8) {
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(h + i));
+            const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(h + i + m - 1));
+            const __m128i eqFirst = _mm_or_si128(_mm_cmpeq_epi16(a, first0), _mm_cmpeq_epi16(a, first1));
+            const __m128i eqLast = _mm_or_si128(_mm_cmpeq_epi16(b, last0), _mm_cmpeq_epi16(b, last1));
+            unsigned mask = unsigned(_mm_movemask_epi8(_mm_and_si128(eqFirst, eqLast)));
+            while (mask) {
+                const qsizetype pos = i + lowestBit(mask) / 2;
+                if (verify(h + pos, p))
+                    return pos;
+                mask &= mask - 1;  // every 16-bit lane sets two mask bits
+                mask &= mask - 1;
+            }
+        }
+        return tail(h, n, i, p);
+    }
+#endif
+
+#ifdef KPAD_SEARCH_AVX2
+    KPAD_TARGET_AVX2
+    static qsizetype avx2(const ushort *h, qsizetype n, qsizetype i, const LiteralMatcher &p) {
+        const qsizetype m = p.needle.size();
+        const qsizetype lastStart = n - m;
+        const __m256i first0 = _mm256_set1_epi16(short(p.first[0]));
+        const __m256i first1 = _mm256_set1_epi16(short(p.first[1]));
+        const __m256i last0 = _mm256_set1_epi16(short(p.last[0]));
+        const __m256i last1 = _mm256_set1_epi16(short(p.last[1]));
+
+        for (; i + 15 <= lastStart; i += 16) {
+            const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(h + i));
+            const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(h + i + m - 1));
+            const __m256i eqFirst = _mm256_or_si256(_mm256_cmpeq_epi16(a, first0), _mm256_cmpeq_epi16(a, first1));
+            const __m256i eqLast = _mm256_or_si256(_mm256_cmpeq_epi16(b, last0), _mm256_cmpeq_epi16(b, last1));
+            unsigned mask = unsigned(_mm256_movemask_epi8(_mm256_and_si256(eqFirst, eqLast)));
+            while (mask) {
+                const qsizetype pos = i + lowestBit(mask) / 2;
+                if (verify(h + pos, p))
+                    return pos;
+                mask &= mask - 1;
+                mask &= mask - 1;
+            }
+        }
+        return tail(h, n, i, p);
+    }
+#endif
+};
+
+// --------------------
+// Kernel selection
+// --------------------
+bool isSupported(Kernel kernel) {
+    switch (kernel) {
+    case Kernel::Auto:
+    case Kernel::Scalar:
+        return true;
+    case Kernel::Sse2:
+#ifdef KPAD_SEARCH_SSE2
+        return true;
+#else
+        return false;
+#endif
+    case Kernel::Avx2: {
+        static const bool avx2 = cpuHasAvx2();
+        return avx2;
+    }
+    }
+    return false;
+}
+
+Kernel bestKernel() {
+    if (isSupported(Kernel::Avx2))
+        return Kernel::Avx2;
+    if (isSupported(Kernel::Sse2))
+        return Kernel::Sse2;
+    return Kernel::Scalar;
+}
+
+const char *kernelName(Kernel kernel) {
+    switch (kernel) {
+    case Kernel::Auto:   return kernelName(bestKernel());
+    case Kernel::Scalar: return "scalar";
+    case Kernel::Sse2:   return "sse2";
+    case Kernel::Avx2:   return "avx2";
+    }
+    return "scalar";
+}
+
+// --------------------
+// Literal matcher
+// --------------------
+LiteralMatcher::LiteralMatcher(const QString &needle, Qt::CaseSensitivity cs, Kernel kernel)
+    : needle(needle)
+    , cs(cs)
+    , activeKernel(kernel == Kernel::Auto || !isSupported(kernel) ? bestKernel() : kernel)
+{
+    if (needle.isEmpty()) {
+        activeKernel = Kernel::Scalar;
+        return;
+    }
+
+    if (cs == Qt::CaseInsensitive) {
+        folded.reserve(needle.size());
+        for (QChar c : needle)
+            folded.append(ushort(QChar::toCaseFolded(c.unicode())));
+    }
+
+    const bool anchorsOk = vectorAnchor(needle.front().unicode(), cs, first)
+                           && vectorAnchor(needle.back().unicode(), cs, last);
+    if (!anchorsOk)
+        activeKernel = Kernel::Scalar;
+}
+
+qsizetype LiteralMatcher::indexIn(const QChar *haystack, qsizetype length, qsizetype from) const {
+    from = qMax<qsizetype>(0, from);
+    if (needle.isEmpty())
+        return from <= length ? from : -1;
+    if (needle.size() > length - from)
+        return -1;
+
+    const ushort *h = reinterpret_cast<const ushort *>(haystack);
+    switch (activeKernel) {
+#ifdef KPAD_SEARCH_AVX2
+    case Kernel::Avx2:
+        return LiteralKernels::avx2(h, length, from, *this);
+#endif
+#ifdef KPAD_SEARCH_SSE2
+    case Kernel::Sse2:
+        return LiteralKernels::sse2(h, length, from, *this);
+#endif
+    default:
+        return QStringView(haystack, length).indexOf(needle, from, cs);
+    }
+}
+
+qsizetype indexOf(const QChar *haystack, qsizetype length, const QString &needle,
+                  qsizetype from, Qt::CaseSensitivity cs, Kernel kernel) {
+    return LiteralMatcher(needle, cs, kernel).indexIn(haystack, length, from);
+}
+
+// --------------------
+// Whole-document search
+// --------------------
+QVector<KpadMatch> findLiteral(const KpadTextSnapshot &text, const QString &pattern,
+                               Qt::CaseSensitivity cs, const QAtomicInt *cancel, Kernel kernel) {
+    QVector<KpadMatch> matches;
+    const int m = pattern.size();
+    if (m == 0)
+        return matches;
+
+    const LiteralMatcher matcher(pattern, cs, kernel);
+    int nextAllowed = 0;    // matches never overlap
+    int sliceStart = 0;     // document position of the current slice
+    QString carry;          // up to m - 1 characters before the current slice
+    int carryStart = 0;
+
+    text.forEachChunk([&](const QChar *data, int length) {
+        for (int offset = 0; offset < length; offset += kSliceChars) {
+            if (cancel && cancel->loadRelaxed())
+                return false;
+
+            const int n = qMin(kSliceChars, length - offset);
+
+            // Matches that start in the carry and end in this slice
+            if (!carry.isEmpty()) {
+                QString window = carry;
+                window.append(data + offset, qMin(m - 1, n));
+                int from = qMax(0, nextAllowed - carryStart);
+                for (;;) {
+                    const int i = int(matcher.indexIn(window.constData(), window.size(), from));
+                    if (i < 0 || i >= carry.size())
+                        break;
+                    matches.append({carryStart + i, m});
+                    nextAllowed = carryStart + i + m;
+                    from = i + m;
+                }
+            }
+
+            // Matches inside this slice
+            int from = qMax(0, nextAllowed - sliceStart);
+            for (;;) {
+                const int i = int(matcher.indexIn(data + offset, n, from));
+                if (i < 0)
+                    break;
+                matches.append({sliceStart + i, m});
+                nextAllowed = sliceStart + i + m;
+                from = i + m;
+            }
+
+            // Keep the last m - 1 characters for the next boundary
+            if (n >= m - 1) {
+                carry = QString(data + offset + n - (m - 1), m - 1);
+            } else {
+                carry.append(data + offset, n);
+                carry = carry.right(m - 1);
+            }
+            sliceStart += n;
+            carryStart = sliceStart - int(carry.size());
+        }
+        return true;
+    });
+
+    return matches;
+}
+
+QVector<KpadMatch> findRegex(const KpadTextSnapshot &text, const QRegularExpression &re,
+                             const QAtomicInt *cancel, int limit) {
+    QVector<KpadMatch> matches;
+    if (!re.isValid() || re.pattern().isEmpty())
+        return matches;
+
+    const int total = text.length();
+    int windowStart = 0;
+
+    while (windowStart < total) {
+        // Copy out a window of whole lines (about one slice)
+        QString window = text.mid(windowStart, kSliceChars);
+        int windowEnd = windowStart + int(window.size());
+        if (windowEnd < total) {
+            const int lastNewline = int(window.lastIndexOf(QLatin1Char('\n')));
+            if (lastNewline >= 0) {
+                window.truncate(lastNewline + 1);
+                windowEnd = windowStart + lastNewline + 1;
+            } else {
+                // One line longer than a slice: extend to its end
+                while (windowEnd < total) {
+                    const QString more = text.mid(windowEnd, kSliceChars);
+                    const int newline = int(more.indexOf(QLatin1Char('\n')));
+                    if (newline >= 0) {
+                        window.append(more.left(newline + 1));
+                        windowEnd += newline + 1;
+                        break;
+                    }
+                    window.append(more);
+                    windowEnd += int(more.size());
+                }
+            }
+        }
+
+        const QStringView view(window);
+        int lineStart = 0;
+        while (lineStart < view.size()) {
+            if (cancel && cancel->loadRelaxed())
+                return matches;
+
+            int lineEnd = int(view.indexOf(QLatin1Char('\n'), lineStart));
+            if (lineEnd < 0)
+                lineEnd = int(view.size());
+
+            // A long line is matched a slice at a time, so no one call
+            // scans more than a slice and the overlap past it
+            for (int chunk = lineStart; chunk < lineEnd;) {
+                const int subjectEnd = qMin(lineEnd, chunk + kSliceChars + kRegexOverlapChars);
+                const int chunkEnd = subjectEnd == lineEnd ? lineEnd : chunk + kSliceChars;
+                const int offset = chunk - lineStart;
+#if QT_VERSION >= QT_VERSION_CHECK(6, 5, 0)
+                QRegularExpressionMatchIterator it = re.globalMatchView(view.mid(lineStart, subjectEnd - lineStart), offset);
+#elif QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+                QRegularExpressionMatchIterator it = re.globalMatch(view.mid(lineStart, subjectEnd - lineStart), offset);
+#else
+                QRegularExpressionMatchIterator it = re.globalMatch(window.midRef(lineStart, subjectEnd - lineStart), offset);
+#endif
+                int next = chunkEnd;
+                while (it.hasNext()) {
+                    if (cancel && cancel->loadRelaxed())
+                        return matches;
+                    const QRegularExpressionMatch match = it.next();
+                    const int start = lineStart + int(match.capturedStart());
+                    if (start >= chunkEnd)
+                        break;  // the next chunk finds it
+                    if (match.capturedLength() > 0) {
+                        matches.append({windowStart + start, int(match.capturedLength())});
+                        if (limit > 0 && matches.size() >= limit)
+                            return matches;
+                        next = qMax(next, start + int(match.capturedLength()));
+                    }
+                }
+                chunk = next;
+            }
+            lineStart = lineEnd + 1;
+        }
+
+        windowStart = windowEnd;
+    }
+
+    return matches;
+}
+
+QString expandReplacement(const QString &line, int column, const QRegularExpression &re,
+                          const QString &replacement) {
+#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+    const QRegularExpression::MatchOption anchored = QRegularExpression::AnchorAtOffsetMatchOption;
+#else
+    const QRegularExpression::MatchOption anchored = QRegularExpression::AnchoredMatchOption;
+#endif
+    const QRegularExpressionMatch match = re.match(line, column, QRegularExpression::NormalMatch, anchored);
+    QString text;
+    text.reserve(replacement.size());
+    for (int i = 0; i < replacement.size(); ++i) {
+        const QChar c = replacement[i];
+        if (c != QLatin1Char('\\') || i + 1 == replacement.size()) {
+            text += c;
+            continue;
+        }
+        const QChar next = replacement[++i];
+        if (next.isDigit())
+            text += match.captured(next.digitValue());
+        else
+            text += next;
+    }
+    return text;
+}
+
+} // namespace KpadSearch
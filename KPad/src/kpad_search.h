@@ -0,0 +1,79 @@
+#ifndef KPAD_SEARCH_H
+#define KPAD_SEARCH_H
+
+#include <QAtomicInt>
+#include <QRegularExpression>
+#include <QString>
+#include <QVector>
+
+#include "kpad_piecetable.h"
+
+// One hit in the document (plain-text offsets, same as document positions)
+struct KpadMatch
+{
+    int start = 0;
+    int length = 0;
+};
+
+namespace KpadSearch {
+
+// Literal-match kernels. Auto picks the best one the CPU supports at runtime.
+enum class Kernel { Auto, Scalar, Sse2, Avx2 };
+
+Kernel bestKernel();
+bool isSupported(Kernel kernel);
+const char *kernelName(Kernel kernel);
+
+// A needle prepared once for repeated searches.
+// Candidates are found by comparing the needle's first and last characters
+// against 8 (SSE2) or 16 (AVX2) positions at a time; only candidates are
+// compared in full. Case-insensitive search uses the vector path when both
+// anchor characters have exactly two ASCII case forms.
+class LiteralMatcher
+{
+public:
+    LiteralMatcher(const QString &needle, Qt::CaseSensitivity cs, Kernel kernel = Kernel::Auto);
+
+    qsizetype indexIn(const QChar *haystack, qsizetype length, qsizetype from = 0) const;
+    Kernel kernel() const { return activeKernel; }
+    qsizetype length() const { return needle.size(); }
+
+private:
+    QString needle;
+    QVector<ushort> folded;         // case-folded needle (case-insensitive only)
+    ushort first[2] = {0, 0};       // accepted forms of the first character
+    ushort last[2] = {0, 0};        // accepted forms of the last character
+    Qt::CaseSensitivity cs;
+    Kernel activeKernel;
+
+    friend struct LiteralKernels;
+};
+
+// Index of the first occurrence of needle in haystack at or after from, or -1
+qsizetype indexOf(const QChar *haystack, qsizetype length, const QString &needle,
+                  qsizetype from, Qt::CaseSensitivity cs, Kernel kernel = Kernel::Auto);
+
+// All non-overlapping occurrences of pattern, in document order.
+// Runs on any thread; gives up early once *cancel becomes non-zero.
+QVector<KpadMatch> findLiteral(const KpadTextSnapshot &text, const QString &pattern,
+                               Qt::CaseSensitivity cs, const QAtomicInt *cancel = nullptr,
+                               Kernel kernel = Kernel::Auto);
+
+// All matches of re, line by line (like QTextDocument::find, a match never
+// spans lines). Empty matches are skipped. Lines longer than a slice are
+// matched a slice at a time, and a match may run at most a few thousand
+// characters past its slice. Cancel is checked between matches and slices;
+// PCRE2's match limit bounds the work of any one match attempt. With a
+// limit, stops once that many matches are found.
+QVector<KpadMatch> findRegex(const KpadTextSnapshot &text, const QRegularExpression &re,
+                             const QAtomicInt *cancel = nullptr, int limit = 0);
+
+// The text that replaces one findRegex() match: \0 - \9 in replacement
+// become its capture groups and \\ a backslash. line is the line holding
+// the match (without its '\n'), column where the match starts in it.
+QString expandReplacement(const QString &line, int column, const QRegularExpression &re,
+                          const QString &replacement);
+
+} // namespace KpadSearch
+
+#endif // KPAD_SEARCH_H
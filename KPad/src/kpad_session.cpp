@@ -0,0 +1,262 @@
+#include "kpad_session.h"
+
+#include <QDataStream>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QSysInfo>
+#include <QTextBlock>
+#include <QTextCursor>
+#include <QTextDocument>
+#include <QTextList>
+
+static const int kPrefixBytes = 12;     // magic, version, header size
+
+// Adds a run, extending the last one when it continues it in the same format
+static void addRun(QVector<qint32> *runs, int start, int length, int format) {
+    const int n = runs->size();
+    if (n >= 3 && runs->at(n - 1) == format && runs->at(n - 3) + runs->at(n - 2) == start) {
+        (*runs)[n - 2] += length;
+        return;
+    }
+    runs->append(start);
+    runs->append(length);
+    runs->append(format);
+}
+
+// A plain document comes out as one char run and one block run. Lists are
+// objects of the document, so they go by number with the format of each,
+// and are made again on restore.
+static void collectRuns(const QTextDocument *document, QVector<qint32> *charRuns, QVector<qint32> *blockRuns,
+                        QVector<qint32> *listRuns, QVector<qint32> *listFormats) {
+    QVector<const QTextList *> lists;
+    int blockNumber = 0;
+    for (QTextBlock block = document->begin(); block.isValid(); block = block.next(), ++blockNumber) {
+        addRun(blockRuns, blockNumber, 1, block.blockFormatIndex());
+        if (const QTextList *list = block.textList()) {
+            int number = int(lists.indexOf(list));
+            if (number < 0) {
+                number = int(lists.size());
+                lists.append(list);
+                listFormats->append(list->formatIndex());
+            }
+            addRun(listRuns, blockNumber, 1, number);
+        }
+        for (QTextBlock::iterator it = block.begin(); !it.atEnd(); ++it) {
+            const QTextFragment fragment = it.fragment();
+            addRun(charRuns, fragment.position(), fragment.length(), fragment.charFormatIndex());
+        }
+        // The paragraph separator carries the block's char format
+        addRun(charRuns, block.position() + block.length() - 1, 1, block.charFormatIndex());
+    }
+}
+
+// A block or char format's ObjectIndex points into its own document's
+// object table; in another document it would name some other object
+static void dropObjectIndexes(QVector<QTextFormat> *formats) {
+    for (QTextFormat &format : *formats) {
+        if (format.hasProperty(QTextFormat::ObjectIndex))
+            format.clearProperty(QTextFormat::ObjectIndex);
+    }
+}
+
+static QString sessionDirectory() {
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/session";
+}
+
+QString KpadSessionFile::sessionPath(int index) {
+    return QString("%1/%2.kps").arg(sessionDirectory()).arg(index);
+}
+
+void KpadSessionFile::clearSession() {
+    QDir dir(sessionDirectory());
+    const QStringList files = dir.entryList(QStringList() << "*.kps", QDir::Files);
+    for (const QString &file : files)
+        dir.remove(file);
+}
+
+void KpadSessionFile::remove(const QString &path) {
+    QFile::remove(path);
+}
+
+// --------------------
+// Writing
+// --------------------
+bool KpadSessionFile::write(const QString &path, const KpadSessionDocument &info,
+                            const QTextDocument *document, const KpadTextSnapshot &text,
+                            QString *errorString) {
+    QVector<QTextFormat> formats;
+    QVector<qint32> charRuns;
+    QVector<qint32> blockRuns;
+    QVector<qint32> listRuns;
+    QVector<qint32> listFormats;
+    if (info.hasText && document) {
+        formats = document->allFormats();
+        collectRuns(document, &charRuns, &blockRuns, &listRuns, &listFormats);
+        dropObjectIndexes(&formats);
+    }
+    const qint64 length = info.hasText ? text.length() : 0;
+
+    QByteArray header;
+    QDataStream out(&header, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_12);
+    out << info.sourcePath << info.rich << quint8(info.format.encoding) << info.format.bom
+        << info.format.crlf << qint64(info.sourceSize) << qint64(info.sourceModified)
+        << info.hasText << info.active << qint32(info.cursorAnchor) << qint32(info.cursorPosition)
+        << qint32(info.verticalScroll) << qint32(info.horizontalScroll)
+        << quint8(QSysInfo::ByteOrder) << length << formats << charRuns << blockRuns
+        << listRuns << listFormats;
+
+    QByteArray prefix;
+    QDataStream prefixOut(&prefix, QIODevice::WriteOnly);
+    prefixOut << kMagic << kVersion << quint32(header.size());
+    prefix += header;
+    // The text starts 8-byte aligned so it can be read in place from the mapping
+    prefix.append(int((8 - prefix.size() % 8) % 8), '\0');
+
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        if (errorString)
+            *errorString = file.errorString();
+        return false;
+    }
+    file.write(prefix);
+    if (length > 0) {
+        text.forEachChunk([&](const QChar *data, int size) {
+            const qint64 bytes = qint64(size) * qint64(sizeof(QChar));
+            return file.write(reinterpret_cast<const char *>(data), bytes) == bytes;
+        });
+    }
+    if (!file.commit()) {
+        if (errorString)
+            *errorString = file.errorString();
+        return false;
+    }
+    return true;
+}
+
+// --------------------
+// Reading
+// --------------------
+bool KpadSessionFile::open(const QString &path) {
+    file.setFileName(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    const qint64 size = file.size();
+    if (size < kPrefixBytes)
+        return false;
+    data = file.map(0, size);
+    if (!data)
+        return false;
+
+    const QByteArray prefix = QByteArray::fromRawData(reinterpret_cast<const char *>(data), kPrefixBytes);
+    QDataStream prefixIn(prefix);
+    quint32 magic = 0, version = 0, headerSize = 0;
+    prefixIn >> magic >> version >> headerSize;
+    if (magic != kMagic || version != kVersion || kPrefixBytes + qint64(headerSize) > size)
+        return false;
+
+    const QByteArray header = QByteArray::fromRawData(reinterpret_cast<const char *>(data) + kPrefixBytes,
+                                                      int(headerSize));
+    QDataStream in(header);
+    in.setVersion(QDataStream::Qt_5_12);
+    quint8 encoding = 0, byteOrder = 0;
+    qint64 sourceSize = 0, sourceModified = 0;
+    qint32 anchor = 0, position = 0, vertical = 0, horizontal = 0;
+    in >> info.sourcePath >> info.rich >> encoding >> info.format.bom >> info.format.crlf
+       >> sourceSize >> sourceModified >> info.hasText >> info.active
+       >> anchor >> position >> vertical >> horizontal
+       >> byteOrder >> textLength >> formats >> charRuns >> blockRuns >> listRuns >> listFormats;
+    if (in.status() != QDataStream::Ok || encoding > KpadTextFormat::Latin1
+        || byteOrder != quint8(QSysInfo::ByteOrder) || charRuns.size() % 3 || blockRuns.size() % 3
+        || listRuns.size() % 3)
+        return false;
+    dropObjectIndexes(&formats);
+
+    info.format.encoding = KpadTextFormat::Encoding(encoding);
+    info.sourceSize = sourceSize;
+    info.sourceModified = sourceModified;
+    info.cursorAnchor = anchor;
+    info.cursorPosition = position;
+    info.verticalScroll = vertical;
+    info.horizontalScroll = horizontal;
+
+    textOffset = (kPrefixBytes + qint64(headerSize) + 7) & ~qint64(7);
+    return textLength >= 0 && textLength <= INT_MAX
+        && textOffset + textLength * qint64(sizeof(QChar)) <= size;
+}
+
+QString KpadSessionFile::text() const {
+    if (!data || textLength == 0)
+        return QString();
+    return QString(reinterpret_cast<const QChar *>(data + textOffset), int(textLength));
+}
+
+bool KpadSessionFile::hasFormatting() const {
+    if (!listRuns.isEmpty())
+        return true;
+    for (int i = 0; i + 2 < blockRuns.size(); i += 3) {
+        const int format = blockRuns[i + 2];
+        if (format >= 0 && format < formats.size() && !formats[format].properties().isEmpty())
+            return true;
+    }
+    for (int i = 5; i < charRuns.size(); i += 3) {
+        if (charRuns[i] != charRuns[2])
+            return true;
+    }
+    return false;
+}
+
+void KpadSessionFile::applyFormats(QTextDocument *document) const {
+    // Restoring formats is part of loading, not an edit to undo
+    const bool undo = document->isUndoRedoEnabled();
+    document->setUndoRedoEnabled(false);
+
+    const int end = document->characterCount() - 1;
+    QTextCursor cursor(document);
+    cursor.beginEditBlock();
+    for (int i = 0; i + 2 < blockRuns.size(); i += 3) {
+        const QTextBlock first = document->findBlockByNumber(blockRuns[i]);
+        const QTextBlock last = document->findBlockByNumber(blockRuns[i] + blockRuns[i + 1] - 1);
+        const int format = blockRuns[i + 2];
+        if (!first.isValid() || format < 0 || format >= formats.size())
+            continue;
+        cursor.setPosition(first.position());
+        cursor.setPosition(last.isValid() ? last.position() : end, QTextCursor::KeepAnchor);
+        cursor.setBlockFormat(formats[format].toBlockFormat());
+    }
+    for (int i = 0; i + 2 < charRuns.size(); i += 3) {
+        const int start = charRuns[i];
+        const int format = charRuns[i + 2];
+        if (start < 0 || start >= end || format < 0 || format >= formats.size())
+            continue;
+        cursor.setPosition(start);
+        cursor.setPosition(qMin(start + charRuns[i + 1], end), QTextCursor::KeepAnchor);
+        cursor.setCharFormat(formats[format].toCharFormat());
+    }
+    // Each list is made on its first block; the rest are added to it
+    QVector<QTextList *> lists(listFormats.size(), nullptr);
+    for (int i = 0; i + 2 < listRuns.size(); i += 3) {
+        const int number = listRuns[i + 2];
+        if (number < 0 || number >= lists.size())
+            continue;
+        const int format = listFormats[number];
+        if (format < 0 || format >= formats.size() || !formats[format].isListFormat())
+            continue;
+        QTextBlock block = document->findBlockByNumber(listRuns[i]);
+        for (int n = 0; n < listRuns[i + 1] && block.isValid(); ++n, block = block.next()) {
+            if (lists[number]) {
+                lists[number]->add(block);
+            } else {
+                cursor.setPosition(block.position());
+                lists[number] = cursor.createList(formats[format].toListFormat());
+            }
+        }
+    }
+    cursor.endEditBlock();
+
+    document->setUndoRedoEnabled(undo);
+}
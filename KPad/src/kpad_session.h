@@ -0,0 +1,74 @@
+#ifndef KPAD_SESSION_H
+#define KPAD_SESSION_H
+
+#include <QFile>
+#include <QString>
+#include <QTextFormat>
+#include <QVector>
+
+#include "kpad_piecetable.h"
+#include "kpad_encoding.h"
+
+class QTextDocument;
+
+// One document that was open when KPad+ last closed
+struct KpadSessionDocument
+{
+    QString sourcePath;
+    bool rich = false;              // opened as HTML
+    KpadTextFormat format;
+    qint64 sourceSize = 0;          // to tell whether the file changed since
+    qint64 sourceModified = 0;      // msecs since epoch
+    bool hasText = false;           // false: only the path is kept (unsaved or viewer)
+    bool active = false;            // the tab that was shown
+    int cursorAnchor = 0;
+    int cursorPosition = 0;
+    int verticalScroll = 0;
+    int horizontalScroll = 0;
+};
+
+// --------------------
+// Session snapshot
+// --------------------
+// One binary file: a small header (the document, its format table, the
+// char and block format runs and the blocks of each list) followed by the
+// text as raw UTF-16 at an aligned offset. Restoring maps the file and copies the text straight out
+// of the mapping, so nothing is decoded and the original file is not read.
+class KpadSessionFile
+{
+public:
+    KpadSessionFile() = default;
+
+    static QString sessionPath(int index);      // one file per tab
+    static void clearSession();
+    // Writes info, and with info.hasText the text and formats of document
+    static bool write(const QString &path, const KpadSessionDocument &info,
+                      const QTextDocument *document, const KpadTextSnapshot &text,
+                      QString *errorString = nullptr);
+    static void remove(const QString &path);
+
+    bool open(const QString &path); // Maps the file and reads its header
+    const KpadSessionDocument &document() const { return info; }
+    QString text() const;
+    // Reapplies the saved formats to a document holding text()
+    void applyFormats(QTextDocument *document) const;
+    // More than one character format, or any block formatting (lists, alignment)
+    bool hasFormatting() const;
+
+private:
+    static constexpr quint32 kMagic = 0x4B505353;   // "KPSS"
+    static constexpr quint32 kVersion = 3;
+
+    QFile file;
+    const uchar *data = nullptr;
+    KpadSessionDocument info;
+    QVector<QTextFormat> formats;   // the document's format table
+    QVector<qint32> charRuns;       // (start, length, format) triples
+    QVector<qint32> blockRuns;      // (first block, block count, format) triples
+    QVector<qint32> listRuns;       // (first block, block count, list) triples
+    QVector<qint32> listFormats;    // format of each list in listRuns
+    qint64 textOffset = 0;
+    qint64 textLength = 0;          // in characters
+};
+
+#endif // KPAD_SESSION_H
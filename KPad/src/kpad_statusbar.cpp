@@ -1,45 +1,95 @@
 #include "kpad.h"
 #include "ui_kpad.h"
+#include "kpad_largeview.h"
+#include "kpad_metrics.h"
 
 // --------------------
-// Find Box
+// Word and Char Counter
 // --------------------
-void Kpad::highlightMatches(const QString &pattern) {
-    // First, clear all existing highlights
-    QTextCursor cursor(textEdit->document());
-    QTextCharFormat clearFormat;
-    clearFormat.setBackground(Qt::transparent);
-    cursor.select(QTextCursor::Document);
-    cursor.mergeCharFormat(clearFormat);
-
-    if (pattern.isEmpty()) return; // nothing to highlight
-
-    QTextDocument *doc = textEdit->document();
-    QTextCursor highlightCursor(doc);
-    while (!highlightCursor.isNull() && !highlightCursor.atEnd()) {
-        highlightCursor = doc->find(pattern, highlightCursor);
-        if (!highlightCursor.isNull()) {
-            highlightCursor.mergeCharFormat(highlightFormat);
+// Recount only the blocks touched by an edit. Blocks that were deleted
+// remove their own words from the tally (see KpadBlockData).
+void Kpad::countChangedBlocks(int position, int charsRemoved, int charsAdded) {
+    Q_UNUSED(charsRemoved);
+    countBlocks(textEdit->document(), wordTally, position, charsAdded);
+    updateCounts();
+}
+
+// Recounts the blocks holding [position, position + length) into tally
+void Kpad::countBlocks(QTextDocument *doc, const std::shared_ptr<KpadWordTally> &tally,
+                       int position, int length) {
+    QTextBlock block = doc->findBlock(position);
+    QTextBlock last = doc->findBlock(position + length);
+    if (!last.isValid())
+        last = doc->lastBlock();
+
+    for (; block.isValid(); block = block.next()) {
+        const QString text = block.text();
+        KpadBlockData *data = static_cast<KpadBlockData *>(block.userData());
+        if (!data) {
+            data = new KpadBlockData(tally);
+            block.setUserData(data);
         }
+        data->setWords(kpadCountWords(text.constData(), text.size()));
+        if (block == last)
+            break;
     }
 }
 
-// --------------------
-// Word and Char Counter
-// --------------------
+// Cached word count of one block (counts it first if it has none yet)
+int Kpad::blockWords(QTextBlock block) {
+    KpadBlockData *data = static_cast<KpadBlockData *>(block.userData());
+    if (!data) {
+        const QString text = block.text();
+        data = new KpadBlockData(wordTally);
+        data->setWords(kpadCountWords(text.constData(), text.size()));
+        block.setUserData(data);
+    }
+    return data->words();
+}
+
 void Kpad::updateCounts() {
+    KPAD_TRACE_SCOPE(UpdateCounts);
+    // The viewer does not count words; show its size instead
+    if (largeView->isOpen()) {
+        wordCountLabel->setText(QString("Lines: %1").arg(largeView->lineCount()));
+        charCountLabel->setText(QString("Bytes: %1").arg(largeView->fileSize()));
+        return;
+    }
+
     QTextCursor cursor = textEdit->textCursor();
-    QString text;
+    qint64 wordCount = 0;
+    qint64 charCount = 0;
 
     if (cursor.hasSelection()) {
-        text = cursor.selectedText();
+        // Only the selected blocks are visited; the two edge blocks are
+        // counted on their selected part, the rest use the cached counts.
+        QTextDocument *doc = textEdit->document();
+        const int start = cursor.selectionStart();
+        const int end = cursor.selectionEnd();
+        charCount = end - start;
+
+        QTextBlock block = doc->findBlock(start);
+        const QTextBlock endBlock = doc->findBlock(end);
+        for (; block.isValid(); block = block.next()) {
+            const int blockStart = block.position();
+            const int blockEnd = blockStart + block.length() - 1;
+            if (blockStart >= start && blockEnd <= end) {
+                wordCount += blockWords(block);
+            } else {
+                const QString text = block.text();
+                const int from = qMax(start, blockStart) - blockStart;
+                const int to = qMin(end, blockEnd) - blockStart;
+                if (to > from)
+                    wordCount += kpadCountWords(text.constData() + from, to - from);
+            }
+            if (block == endBlock)
+                break;
+        }
     } else {
-        text = textEdit->toPlainText();
+        // Whole document: both totals are already known
+        charCount = textEdit->document()->characterCount() - 1;
+        wordCount = wordTally->words;
     }
-    // Count characters:
-    int charCount = text.length();
-    // Count words (split by whitespace);
-    int wordCount = text.split(QRegularExpression("\\s+"), Qt::SkipEmptyParts).count();
 
     // Update labels:
     wordCountLabel->setText(QString("Words: %1").arg(wordCount));
@@ -74,3 +124,55 @@ void Kpad::toggleWindowLock(bool locked)
         lockButton->setToolTip("Lock window size");
     }
 }
+
+// --------------------
+// Latency Overlay
+// --------------------
+void Kpad::toggleMetricsOverlay(bool shown) {
+    // Timing stays on for a KPAD_METRICS run
+    KpadMetrics::setEnabled(shown || !metricsReportPath.isEmpty());
+    metricsLabel->setVisible(shown);
+    if (shown) {
+        metricsTimer->start();
+        updateMetricsOverlay();
+    } else {
+        metricsTimer->stop();
+    }
+}
+
+void Kpad::updateMetricsOverlay() {
+    static const KpadMetrics::Handler handlers[] = {
+        KpadMetrics::KeyPress, KpadMetrics::EventFilter, KpadMetrics::Paint,
+        KpadMetrics::UpdateCounts, KpadMetrics::HighlightMatches, KpadMetrics::Open, KpadMetrics::Save
+    };
+    static const char *const labels[] = { "key", "filter", "paint", "counts", "find", "open", "save" };
+
+    QStringList parts;
+    for (int i = 0; i < int(sizeof(handlers) / sizeof(handlers[0])); ++i) {
+        if (!KpadMetrics::count(handlers[i]))
+            continue;
+        const double msecs = KpadMetrics::percentileNsecs(handlers[i], 0.95) / 1e6;
+        parts << QString("%1 %2").arg(QLatin1String(labels[i])).arg(msecs, 0, 'f', msecs < 10 ? 2 : 0);
+    }
+    metricsLabel->setText("p95 ms: " + (parts.isEmpty() ? QString("-") : parts.join("  ")));
+}
+
+void Kpad::saveMetricsReport() {
+    QString fileName = QFileDialog::getSaveFileName(
+        this,
+        "Save Latency Report",
+        "kpad-latency.txt",
+        "Text Files (*.txt)"
+        );
+    if (fileName.isEmpty())
+        return;
+
+    QString errorString;
+    if (!KpadMetrics::writeReport(fileName, &errorString)) {
+        QMessageBox::warning(this, "Warning", "Cannot save file: " + errorString);
+        return;
+    }
+    statusBar()->showMessage(KpadMetrics::isEnabled() ? "Saved latency report"
+                                                      : "Saved latency report (timing is off: show View > Latency Overlay)",
+                             4000);
+}
@@ -0,0 +1,52 @@
+#ifndef KPAD_TAB_H
+#define KPAD_TAB_H
+
+#include <QElapsedTimer>
+#include <QString>
+#include <QTextDocument>
+#include <memory>
+
+#include "kpad_piecetable.h"
+#include "kpad_counter.h"
+#include "kpad_encoding.h"
+
+class KpadJournal;
+class KpadFileLoader;
+class KpadHtmlLoader;
+
+// One open document. The active tab's state lives in Kpad's own members
+// (currentFile, pieceTable, ...); the others keep theirs here until they
+// are switched back in. An unloaded tab has no document at all: it is
+// reopened from its file, or from a session snapshot when it had changes.
+struct KpadTab
+{
+    QTextDocument *document = nullptr;  // nullptr while unloaded
+    QString filePath;
+    KpadTextFormat format = KpadTextFormat::platformDefault();
+    KpadPieceTable pieceTable;
+    bool pieceTableActive = true;
+    std::shared_ptr<KpadWordTally> wordTally;
+    KpadJournal *journal = nullptr;
+    QString largeFilePath;          // shown in the large-file viewer
+    KpadFileLoader *fileLoader = nullptr;   // still streaming into document
+    KpadHtmlLoader *htmlLoader = nullptr;   // still parsing the document that replaces it
+    int loadCursor = -1;            // cursor position to restore once loaded
+
+    int cursorAnchor = 0;
+    int cursorPosition = 0;
+    int verticalScroll = 0;
+    int horizontalScroll = 0;
+
+    QString snapshotPath;           // KpadSessionFile holding an unloaded document
+    bool modified = false;          // of an unloaded document
+    QElapsedTimer inactive;         // since it was switched away from
+
+    bool isLoaded() const { return document != nullptr; }
+    KpadTextSnapshot snapshot() const {
+        if (pieceTableActive)
+            return pieceTable.snapshot();
+        return KpadTextSnapshot::fromString(document ? document->toPlainText() : QString());
+    }
+};
+
+#endif // KPAD_TAB_H
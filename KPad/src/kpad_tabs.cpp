@@ -0,0 +1,368 @@
+#include "kpad.h"
+#include "ui_kpad.h"
+#include "kpad_highlight.h"
+#include "kpad_journal.h"
+#include "kpad_largeview.h"
+#include "kpad_loader.h"
+#include "kpad_session.h"
+#include "kpad_tab.h"
+#include "kpad_undo.h"
+
+#include <QCoreApplication>
+#include <QSignalBlocker>
+#include <QStandardPaths>
+#include <QTextLayout>
+#include <algorithm>
+#include <utility>
+
+// Inactive tabs past this many (most recently used first) are unloaded
+static const int kMaxLoadedTabs = 8;
+// ...and so is any tab left alone for this long
+static const qint64 kUnloadAfterMsecs = 5 * 60 * 1000;
+
+// Where an unloaded tab with changes keeps its snapshot
+static QString tabSnapshotPath() {
+    static int serial = 0;
+    return QString("%1/tabs/%2-%3.kps")
+        .arg(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation))
+        .arg(QCoreApplication::applicationPid())
+        .arg(++serial);
+}
+
+// Frees the line layout of a document that is no longer shown. The editor
+// lays it out again (lazily, from the top) when the document comes back.
+static void dropLayout(QTextDocument *doc) {
+    for (QTextBlock block = doc->begin(); block.isValid(); block = block.next())
+        block.layout()->clearLayout();
+}
+
+// --------------------
+// Tabs
+// --------------------
+// Every tab owns a QTextDocument; the one editor shows the active tab's.
+// All documents share the editor's font (and zoom), so fonts and glyphs
+// are cached once for the window.
+QTextDocument *Kpad::createDocument() {
+    QTextDocument *doc = new QTextDocument(this);
+    doc->setDefaultFont(textEdit->font());
+    doc->setUndoRedoEnabled(false);     // plain until loaded otherwise: KpadUndoStack keeps its history
+    return doc;
+}
+
+void Kpad::connectDocument(QTextDocument *doc) {
+    // The mirror goes first, so counts and find see the new text
+    connect(doc, &QTextDocument::contentsChange, this, &Kpad::syncPieceTable);
+    connect(doc, &QTextDocument::contentsChange, this, &Kpad::countChangedBlocks);
+    connect(doc, &QTextDocument::contentsChange, this, &Kpad::shiftMatches);
+    connect(doc, &QTextDocument::modificationChanged, this, &Kpad::updateTabTitle);
+    connect(KpadUndoStack::of(doc), &KpadUndoStack::historyTrimmed, this, &Kpad::undoHistoryTrimmed,
+            Qt::UniqueConnection);
+}
+
+// Puts a document built elsewhere (off-thread, already counted) in place
+// of the active tab's, which is deleted
+void Kpad::replaceDocument(QTextDocument *doc, std::shared_ptr<KpadWordTally> tally) {
+    QTextDocument *previous = textEdit->document();
+    previous->disconnect(this);
+
+    doc->setParent(this);
+    doc->setDefaultFont(textEdit->font());  // the zoom may have changed meanwhile
+    doc->setUndoRedoEnabled(true);
+    doc->setModified(false);
+    connectDocument(doc);
+    textEdit->setDocument(doc);
+    tabs[activeTab]->document = doc;
+    wordTally = std::move(tally);
+    delete previous;
+    highlighter->documentReplaced();
+
+    findMatches.clear();
+    startFind();
+    updateCounts();
+}
+
+// Adds an empty, inactive tab at the end
+KpadTab *Kpad::newTab() {
+    KpadTab *tab = new KpadTab;
+    tab->document = createDocument();
+    tab->wordTally = std::make_shared<KpadWordTally>();
+    tab->journal = new KpadJournal(this);
+    tabs.append(tab);
+
+    const QSignalBlocker blocker(tabBar);
+    tabBar->addTab("Untitled");
+    return tab;
+}
+
+void Kpad::setActiveTab(int index) {
+    if (index == activeTab)
+        return;
+    {
+        const QSignalBlocker blocker(tabBar);
+        tabBar->setCurrentIndex(index);
+    }
+    switchTab(index);
+}
+
+void Kpad::switchTab(int index) {
+    if (index < 0 || index >= tabs.size() || index == activeTab)
+        return;
+
+    // A running save reports back to the document it saved
+    fileSaver->waitForFinished();
+
+    QTextDocument *previous = nullptr;
+    if (activeTab >= 0) {
+        stashTab(tabs[activeTab]);
+        previous = tabs[activeTab]->document;
+    }
+    activeTab = index;
+    activateTab(tabs[index]);
+    if (previous)
+        dropLayout(previous);
+
+    unloadIdleTabs();
+}
+
+// Moves the active document's state out of Kpad into its tab
+void Kpad::stashTab(KpadTab *tab) {
+    flushJournal();
+    journalTimer->stop();
+
+    const QTextCursor cursor = textEdit->textCursor();
+    tab->cursorAnchor = cursor.anchor();
+    tab->cursorPosition = cursor.position();
+    tab->verticalScroll = textEdit->verticalScrollBar()->value();
+    tab->horizontalScroll = textEdit->horizontalScrollBar()->value();
+    tab->largeFilePath = largeView->isOpen() ? largeView->filePath() : QString();
+    if (largeView->isOpen()) {
+        largeView->close();
+        setViewerMode(false);
+    }
+
+    tab->filePath = currentFile;
+    tab->format = fileFormat;
+    tab->pieceTable = std::move(pieceTable);
+    pieceTable = KpadPieceTable();
+    tab->pieceTableActive = pieceTableActive;
+    tab->wordTally = wordTally;
+    tab->journal = journal;
+    // A load still running goes on in the background (see appendLoadedChunk())
+    tab->fileLoader = std::exchange(fileLoader, nullptr);
+    tab->htmlLoader = std::exchange(htmlLoader, nullptr);
+    tab->document->disconnect(this);
+    tab->inactive.start();
+}
+
+// Moves a tab's state into Kpad and shows it, loading it first if needed
+void Kpad::activateTab(KpadTab *tab) {
+    const bool load = !tab->isLoaded();
+    if (load) {
+        tab->document = createDocument();
+        tab->wordTally = std::make_shared<KpadWordTally>();
+    }
+
+    tab->document->setDefaultFont(textEdit->font());   // zoom is shared by all tabs
+    connectDocument(tab->document);
+    textEdit->setDocument(tab->document);
+
+    currentFile = tab->filePath;
+    setFileFormat(tab->format);
+    pieceTable = std::move(tab->pieceTable);
+    tab->pieceTable = KpadPieceTable();
+    pieceTableActive = tab->pieceTableActive;
+    wordTally = tab->wordTally;
+    journal = tab->journal;
+    fileLoader = std::exchange(tab->fileLoader, nullptr);
+    htmlLoader = std::exchange(tab->htmlLoader, nullptr);
+    setLoadingState(fileLoader || htmlLoader);
+    setWindowTitle(currentFile.isEmpty() ? "KPad+" : QFileInfo(currentFile).fileName() + " - KPad+");
+
+    if (load) {
+        loadTab(tab);
+    } else {
+        const int end = tab->document->characterCount() - 1;
+        QTextCursor cursor(tab->document);
+        cursor.setPosition(qBound(0, tab->cursorAnchor, end));
+        cursor.setPosition(qBound(0, tab->cursorPosition, end), QTextCursor::KeepAnchor);
+        textEdit->setTextCursor(cursor);
+        // The scroll ranges exist once the editor has been laid out
+        const int vertical = tab->verticalScroll;
+        const int horizontal = tab->horizontalScroll;
+        QTimer::singleShot(0, this, [=]() {
+            textEdit->verticalScrollBar()->setValue(vertical);
+            textEdit->horizontalScrollBar()->setValue(horizontal);
+        });
+    }
+
+    if (!tab->largeFilePath.isEmpty())
+        openLargeFile(tab->largeFilePath);
+
+    findMatches.clear();
+    startFind();
+    updateCounts();
+    updateTabTitle();
+    updateCodeGrammar();
+}
+
+// Fills the fresh document of an unloaded tab: from its snapshot when it
+// had changes, otherwise from its file
+void Kpad::loadTab(KpadTab *tab) {
+    resetPieceTable(QString(), true);
+
+    if (!tab->snapshotPath.isEmpty()) {
+        restoreSnapshot(tab->snapshotPath);
+        KpadSessionFile::remove(tab->snapshotPath);
+        tab->snapshotPath.clear();
+        if (tab->modified)
+            textEdit->document()->setModified(true);
+    } else if (!tab->filePath.isEmpty()) {
+        // A large file finishes loading later: the cursor waits for it
+        tab->loadCursor = tab->cursorPosition;
+        loadFile(tab->filePath);
+        if (!fileLoader && !htmlLoader)
+            restoreLoadCursor();
+    } else {
+        startJournal(false);
+    }
+    tab->modified = false;
+}
+
+void Kpad::closeTab(int index) {
+    if (index < 0 || index >= tabs.size())
+        return;
+
+    // Show it while asking about unsaved changes
+    setActiveTab(index);
+    if (!maybeSave())
+        return;
+    journal->stop();
+
+    // Never leave the window without a document
+    const bool last = tabs.size() == 1;
+    if (last)
+        newTab();
+    setActiveTab(index + 1 < tabs.size() ? index + 1 : index - 1);
+    if (last)
+        startJournal(false);
+    removeTab(index);
+}
+
+// Drops an inactive tab without asking
+void Kpad::removeTab(int index) {
+    KpadTab *tab = tabs.takeAt(index);
+    {
+        const QSignalBlocker blocker(tabBar);
+        tabBar->removeTab(index);
+    }
+    if (activeTab > index)
+        --activeTab;
+
+    tab->journal->stop();
+    if (!tab->snapshotPath.isEmpty())
+        KpadSessionFile::remove(tab->snapshotPath);
+    // Deleting a loader cancels it; a running setHtml() is left to finish unseen
+    delete tab->fileLoader;
+    if (tab->htmlLoader)
+        tab->htmlLoader->abandon();
+    delete tab->journal;
+    delete tab->document;
+    delete tab;
+}
+
+// An untitled, untouched, empty document: opening a file may reuse its tab
+bool Kpad::isBlankTab() const {
+    return currentFile.isEmpty() && !largeView->isOpen() && !fileLoader && !htmlLoader
+        && !textEdit->document()->isModified() && textEdit->document()->isEmpty();
+}
+
+KpadTab *Kpad::tabForDocument(const QTextDocument *doc) const {
+    for (KpadTab *tab : tabs) {
+        if (tab->document == doc)
+            return tab;
+    }
+    return nullptr;
+}
+
+// The inactive tab a streaming load or HTML import is still filling
+KpadTab *Kpad::tabForLoader(const QObject *loader) const {
+    for (KpadTab *tab : tabs) {
+        if (loader && (tab->fileLoader == loader || tab->htmlLoader == loader))
+            return tab;
+    }
+    return nullptr;
+}
+
+void Kpad::updateTabTitle() {
+    if (activeTab < 0)
+        return;
+
+    const QString path = largeView->isOpen() ? largeView->filePath() : currentFile;
+    QString title = path.isEmpty() ? QString("Untitled") : QFileInfo(path).fileName();
+    if (hasUnsavedChanges())
+        title.prepend('*');
+    tabBar->setTabText(activeTab, title);
+    tabBar->setTabToolTip(activeTab, path);
+}
+
+// --------------------
+// Unloading Idle Tabs
+// --------------------
+// An unloaded tab keeps no document. One without changes is reopened from
+// its file; one with changes is written to a session snapshot, which is
+// mapped back when the tab is shown again. Undo history does not survive.
+void Kpad::unloadTab(KpadTab *tab) {
+    if (!tab->isLoaded() || !tab->largeFilePath.isEmpty() || tab->fileLoader || tab->htmlLoader)
+        return;
+
+    tab->journal->flush(tab->snapshot());
+
+    const bool modified = tab->document->isModified();
+    if (modified || (tab->filePath.isEmpty() && !tab->document->isEmpty())) {
+        KpadSessionDocument info;
+        info.sourcePath = tab->filePath;
+        info.rich = !tab->pieceTableActive;
+        info.format = tab->format;
+        if (!tab->filePath.isEmpty()) {
+            const QFileInfo source(tab->filePath);
+            info.sourceSize = source.size();
+            info.sourceModified = source.lastModified().toMSecsSinceEpoch();
+        }
+        info.hasText = true;
+        info.cursorAnchor = tab->cursorAnchor;
+        info.cursorPosition = tab->cursorPosition;
+        info.verticalScroll = tab->verticalScroll;
+        info.horizontalScroll = tab->horizontalScroll;
+
+        const QString path = tabSnapshotPath();
+        if (!KpadSessionFile::write(path, info, tab->document, tab->snapshot()))
+            return;     // keep it in memory then
+        tab->snapshotPath = path;
+    }
+
+    tab->modified = modified;
+    delete tab->document;
+    tab->document = nullptr;
+    tab->pieceTable = KpadPieceTable();
+    tab->wordTally.reset();
+}
+
+void Kpad::unloadIdleTabs() {
+    QVector<KpadTab *> loaded;
+    for (int i = 0; i < tabs.size(); ++i) {
+        KpadTab *tab = tabs[i];
+        if (i == activeTab || !tab->isLoaded() || !tab->largeFilePath.isEmpty())
+            continue;
+        if (tab->inactive.elapsed() >= kUnloadAfterMsecs)
+            unloadTab(tab);
+        else
+            loaded.append(tab);
+    }
+
+    // Most recently used first
+    std::sort(loaded.begin(), loaded.end(), [](const KpadTab *a, const KpadTab *b) {
+        return a->inactive.elapsed() < b->inactive.elapsed();
+    });
+    for (int i = kMaxLoadedTabs; i < loaded.size(); ++i)
+        unloadTab(loaded[i]);
+}
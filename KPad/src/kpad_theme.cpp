@@ -0,0 +1,94 @@
+#include "kpad_theme.h"
+
+#include <QApplication>
+#include <QImage>
+#include <QPixmap>
+#include <QStyle>
+#include <QStyleFactory>
+
+// The sizes dark icons are rasterized at: menus, toolbars, high-DPI toolbars
+static const int kIconSizes[] = {16, 24, 32};
+
+void KpadTheme::addActions(const QList<QAction *> &actions) {
+    for (QAction *action : actions) {
+        if (action->icon().isNull())
+            continue;
+        ActionIcons entry;
+        entry.action = action;
+        entry.light = action->icon();
+        icons.append(entry);
+    }
+}
+
+void KpadTheme::prepare() {
+    // Taken before any switch, so it is the application's own
+    if (!prepared) {
+        light = QApplication::palette();
+        dark = darkPalette();
+        prepared = true;
+    }
+
+    for (ActionIcons &entry : icons) {
+        if (!entry.dark.isNull())
+            continue;
+        for (int size : kIconSizes) {
+            QImage image = entry.light.pixmap(QSize(size, size)).toImage();
+            image.invertPixels();
+            entry.dark.addPixmap(QPixmap::fromImage(image));
+        }
+    }
+}
+
+void KpadTheme::apply(bool useDark) {
+    prepare();
+
+    if (useDark && !fusionChecked) {
+        fusionChecked = true;
+        const QString style = QApplication::style()->objectName().toLower();
+        if (style == "windowsvista" || style == "windows11" || style == "macos" || style == "macintosh") {
+            QApplication::setStyle(QStyleFactory::create("Fusion"));
+            light = QApplication::palette();     // Fusion's, under the system colours
+        }
+    }
+
+    QApplication::setPalette(useDark ? dark : light);
+    for (const ActionIcons &entry : icons) {
+        if (entry.action)
+            entry.action->setIcon(useDark ? entry.dark : entry.light);
+    }
+}
+
+QPalette KpadTheme::darkPalette() {
+    const QColor window("#2b2b2b");
+    const QColor base("#1e1e1e");
+    const QColor button("#3c3c3c");
+    const QColor text("#ffffff");
+    const QColor disabled("#808080");
+
+    QPalette palette;
+    palette.setColor(QPalette::Window, window);
+    palette.setColor(QPalette::WindowText, text);
+    palette.setColor(QPalette::Base, base);
+    palette.setColor(QPalette::AlternateBase, QColor("#353535"));
+    palette.setColor(QPalette::Text, text);
+    palette.setColor(QPalette::PlaceholderText, disabled);
+    palette.setColor(QPalette::Button, button);
+    palette.setColor(QPalette::ButtonText, text);
+    palette.setColor(QPalette::BrightText, QColor("#ff5252"));
+    palette.setColor(QPalette::Highlight, QColor("#0078d7"));
+    palette.setColor(QPalette::HighlightedText, text);
+    palette.setColor(QPalette::ToolTipBase, window);
+    palette.setColor(QPalette::ToolTipText, text);
+    palette.setColor(QPalette::Link, QColor("#4ea1f3"));
+    palette.setColor(QPalette::Light, QColor("#555555"));
+    palette.setColor(QPalette::Midlight, QColor("#444444"));
+    palette.setColor(QPalette::Mid, QColor("#353535"));
+    palette.setColor(QPalette::Dark, QColor("#1a1a1a"));
+    palette.setColor(QPalette::Shadow, QColor("#000000"));
+
+    palette.setColor(QPalette::Disabled, QPalette::WindowText, disabled);
+    palette.setColor(QPalette::Disabled, QPalette::Text, disabled);
+    palette.setColor(QPalette::Disabled, QPalette::ButtonText, disabled);
+    palette.setColor(QPalette::Disabled, QPalette::Highlight, QColor("#3e3e3e"));
+    return palette;
+}
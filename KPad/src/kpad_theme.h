@@ -0,0 +1,49 @@
+#ifndef KPAD_THEME_H
+#define KPAD_THEME_H
+
+#include <QAction>
+#include <QIcon>
+#include <QList>
+#include <QPalette>
+#include <QPointer>
+#include <QVector>
+
+// --------------------
+// Light and dark theme
+// --------------------
+// Both looks are built once: a palette for each, and every action icon
+// inverted for dark backgrounds. apply() swaps the application palette
+// and the icons; no style sheet is parsed and no widget re-polished, so
+// a switch costs one repaint.
+//
+// Native Windows and macOS styles draw from the system theme and ignore
+// the palette, so the first switch to dark moves the application to
+// Fusion, which draws everything from it.
+class KpadTheme
+{
+public:
+    // The actions' current icons are the light set
+    void addActions(const QList<QAction *> &actions);
+    // Builds the palettes and the dark icons still missing; apply() does it
+    // first if nobody has
+    void prepare();
+    void apply(bool useDark);
+
+    static QPalette darkPalette();
+
+private:
+    struct ActionIcons
+    {
+        QPointer<QAction> action;
+        QIcon light;
+        QIcon dark;
+    };
+
+    QVector<ActionIcons> icons;
+    QPalette light;
+    QPalette dark;
+    bool prepared = false;
+    bool fusionChecked = false;
+};
+
+#endif // KPAD_THEME_H
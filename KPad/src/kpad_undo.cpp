@@ -0,0 +1,356 @@
+#include "kpad_undo.h"
+
+#include <QDataStream>
+#include <QDir>
+#include <QSettings>
+#include <QSignalBlocker>
+#include <QStandardPaths>
+#include <QTemporaryFile>
+#include <QTextCursor>
+#include <QTextDocument>
+
+// What an entry holds on to in memory
+static qint64 entryBytes(const KpadUndoStack::Entry &entry) {
+    return qint64(sizeof(KpadUndoStack::Entry)) + (entry.removed.size() + entry.inserted.size()) * qint64(sizeof(QChar));
+}
+
+// Sets the modified flag, and has QTextDocument's own stack count it from
+// its current state (setModified() alone does nothing when it is unchanged)
+static void rebaseModified(QTextDocument *document, bool modified) {
+    {
+        const QSignalBlocker blocker(document);
+        document->setModified(!modified);
+    }
+    document->setModified(modified);
+}
+
+static QString settingsPath() {
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/settings.ini";
+}
+
+KpadUndoStack::KpadUndoStack(QTextDocument *document)
+    : QObject(document)
+    , document(document)
+{
+    connect(document, &QTextDocument::modificationChanged, this, &KpadUndoStack::modificationChanged);
+    connect(document, &QTextDocument::undoCommandAdded, this, &KpadUndoStack::qtCommandAdded);
+    connect(document, &QTextDocument::contentsChange, this, [this](int, int removed, int added) {
+        qtContentsChange(removed, added);
+    });
+}
+
+KpadUndoStack *KpadUndoStack::of(QTextDocument *document) {
+    KpadUndoStack *stack = document->findChild<KpadUndoStack *>(QString(), Qt::FindDirectChildrenOnly);
+    return stack ? stack : new KpadUndoStack(document);
+}
+
+// --------------------
+// Recording
+// --------------------
+void KpadUndoStack::record(int position, const QString &removed, const QString &inserted) {
+    if (applying || retired || (removed.isEmpty() && inserted.isEmpty()))
+        return;
+
+    // A new edit ends what could be redone; a save in there is lost with it
+    if (!redoEntries.isEmpty()) {
+        redoEntries.clear();
+        redoBytes = 0;
+        if (cleanCount > undoCount())
+            cleanCount = -1;
+    }
+
+    if (!merge(position, removed, inserted)) {
+        Entry entry;
+        entry.position = position;
+        entry.removed = removed;
+        entry.inserted = inserted;
+        undoBytes += entryBytes(entry);
+        entries.append(entry);
+    }
+    mergeable = true;
+    sinceRecord.restart();
+
+    while (undoBytes > memoryBudget() && !entries.isEmpty())
+        spill();
+}
+
+// Grows the last entry by one typed, backspaced or deleted character
+bool KpadUndoStack::merge(int position, const QString &removed, const QString &inserted) {
+    if (!mergeable || entries.isEmpty() || cleanCount == undoCount() || sinceRecord.elapsed() > kMergeMsecs)
+        return false;
+
+    Entry &last = entries.last();
+    const QChar newline('\n');
+    if (removed.isEmpty() && inserted.size() == 1) {
+        // Typing: the character goes right after the last one
+        if (inserted.at(0) == newline || last.inserted.isEmpty() || last.inserted.endsWith(newline)
+            || position != last.position + last.inserted.size())
+            return false;
+        last.inserted += inserted;
+    } else if (inserted.isEmpty() && removed.size() == 1 && last.inserted.isEmpty()) {
+        if (removed.at(0) == newline)
+            return false;
+        if (position + 1 == last.position) {
+            // Backspace: the character before the last one removed
+            last.position = position;
+            last.removed.prepend(removed);
+        } else if (position == last.position) {
+            // Delete: the character that moved into its place
+            last.removed += removed;
+        } else {
+            return false;
+        }
+    } else {
+        return false;
+    }
+    undoBytes += sizeof(QChar);
+    return true;
+}
+
+// --------------------
+// Undo and redo
+// --------------------
+int KpadUndoStack::undo() {
+    if (entries.isEmpty() && !readBack())
+        return -1;
+
+    const Entry entry = entries.takeLast();
+    undoBytes -= entryBytes(entry);
+    redoEntries.append(entry);
+    redoBytes += entryBytes(entry);
+    return replace(entry.position, entry.inserted.size(), entry.removed);
+}
+
+int KpadUndoStack::redo() {
+    if (redoEntries.isEmpty())
+        return -1;
+
+    const Entry entry = redoEntries.takeLast();
+    redoBytes -= entryBytes(entry);
+    entries.append(entry);
+    undoBytes += entryBytes(entry);
+    return replace(entry.position, entry.removed.size(), entry.inserted);
+}
+
+// Puts text in place of [position, position + length) without recording it.
+// The text takes the format around it, which is the document's only one
+// as long as the stack is not retired; once it is, Qt's stack is empty
+// whenever this runs.
+int KpadUndoStack::replace(int position, int length, const QString &text) {
+    mergeable = false;
+    const int end = document->characterCount() - 1;
+    position = qBound(0, position, end);
+
+    applying = true;
+    QTextCursor cursor(document);
+    cursor.setPosition(position);
+    cursor.setPosition(qBound(position, position + length, end), QTextCursor::KeepAnchor);
+    if (text.isEmpty())
+        cursor.removeSelectedText();
+    else
+        cursor.insertText(text);
+    // A retired stack's edit went on Qt's stack, and would be undone next;
+    // what Qt could redo was on top of the text just changed
+    if (retired)
+        document->clearUndoRedoStacks();
+    applying = false;
+
+    rebaseModified(document, undoCount() != cleanCount);
+    return position + text.size();
+}
+
+void KpadUndoStack::clear() {
+    entries.clear();
+    redoEntries.clear();
+    undoBytes = 0;
+    redoBytes = 0;
+    dropSpilled();
+    cleanCount = document->isModified() ? -1 : 0;
+    mergeable = false;
+    retired = false;
+    qtBytes = 0;
+    qtPendingBytes = 0;
+}
+
+void KpadUndoStack::retire() {
+    if (retired)
+        return;
+    retired = true;
+    mergeable = false;
+    document->setUndoRedoEnabled(true);
+    rebaseModified(document, document->isModified());
+}
+
+// Qt recorded an edit: nothing here can be redone on top of it, and the
+// edit's text counts towards Qt's stack
+void KpadUndoStack::qtCommandAdded() {
+    if (applying)
+        return;
+    if (!redoEntries.isEmpty()) {
+        redoEntries.clear();
+        redoBytes = 0;
+        if (cleanCount > undoCount())
+            cleanCount = -1;
+    }
+
+    // The first command on an empty stack: it was cleared or switched off
+    if (document->availableUndoSteps() <= 1)
+        qtBytes = 0;
+    qtBytes += qtPendingBytes + kQtCommandBytes;
+    qtPendingBytes = 0;
+    if (qtBytes > memoryBudget())
+        trimQtHistory();
+}
+
+// An undo or redo of Qt's own leaves something to redo, and adds nothing
+void KpadUndoStack::qtContentsChange(int removed, int added) {
+    if (!removed && !added)
+        return;
+    ++edits;
+    if (applying || !document->isUndoRedoEnabled() || document->availableRedoSteps() > 0)
+        return;
+    qtPendingBytes += qint64(removed + added) * qint64(sizeof(QChar));
+}
+
+// Qt's stack cannot drop only its oldest commands, so all of it goes. The
+// entries here are older still and no longer fit the text; they go too.
+void KpadUndoStack::trimQtHistory() {
+    document->clearUndoRedoStacks(QTextDocument::UndoStack);
+    qtBytes = 0;
+    if (retired) {
+        dropSpilled();
+        dropOldest(entries.size());
+        entries.clear();
+        undoBytes = 0;
+        mergeable = false;
+    }
+    emit historyTrimmed();
+}
+
+// Saving or loading marks the current state clean, unless it is in the
+// edits Qt's stack holds; an edit that leaves a document modified while it
+// is at the clean state (a recovered journal, say) means the clean state
+// is not in the history
+void KpadUndoStack::modificationChanged(bool modified) {
+    if (!modified)
+        cleanCount = retired && document->isUndoAvailable() ? -1 : undoCount();
+    else if (cleanCount == undoCount())
+        cleanCount = -1;
+}
+
+// --------------------
+// Spill file
+// --------------------
+// The oldest half of the entries in memory becomes one compressed segment
+// at the end of the file
+void KpadUndoStack::spill() {
+    const int count = qMax(1, int(entries.size() / 2));
+
+    QByteArray raw;
+    {
+        QDataStream out(&raw, QIODevice::WriteOnly);
+        out << qint32(count);
+        for (int i = 0; i < count; ++i)
+            out << qint32(entries.at(i).position) << entries.at(i).removed << entries.at(i).inserted;
+    }
+    const QByteArray packed = qCompress(raw);
+
+    if (!spillFile) {
+        spillFile = new QTemporaryFile(QDir::tempPath() + "/kpad-undo-XXXXXX", this);
+        if (!spillFile->open()) {
+            delete spillFile;
+            spillFile = nullptr;
+        }
+    }
+    if (spillFile && spillFile->size() + packed.size() > kMaxSpillBytes)
+        dropSpilled();
+
+    Segment segment;
+    segment.offset = spillFile ? spillFile->size() : 0;
+    segment.size = packed.size();
+    segment.count = count;
+    if (spillFile && spillFile->seek(segment.offset) && spillFile->write(packed) == packed.size()) {
+        segments.append(segment);
+        spilledCount += count;
+    } else {
+        // Nowhere to put them: the history ends at what stays in memory
+        if (spillFile)
+            spillFile->resize(segment.offset);
+        dropSpilled();
+        dropOldest(count);
+    }
+
+    for (int i = 0; i < count; ++i)
+        undoBytes -= entryBytes(entries.at(i));
+    entries.remove(0, count);
+    mergeable = mergeable && !entries.isEmpty();
+}
+
+// Reads the newest segment back into memory and cuts it off the file
+bool KpadUndoStack::readBack() {
+    if (segments.isEmpty() || !spillFile)
+        return false;
+
+    const Segment segment = segments.takeLast();
+    spilledCount -= segment.count;
+    QByteArray packed;
+    if (spillFile->seek(segment.offset))
+        packed = spillFile->read(segment.size);
+    spillFile->resize(segment.offset);
+
+    QVector<Entry> loaded;
+    loaded.reserve(segment.count);
+    QDataStream in(qUncompress(packed));
+    qint32 count = 0;
+    in >> count;
+    for (qint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        Entry entry;
+        qint32 position = 0;
+        in >> position >> entry.removed >> entry.inserted;
+        entry.position = position;
+        loaded.append(entry);
+    }
+    if (in.status() != QDataStream::Ok || loaded.size() != segment.count) {
+        // Unreadable: this segment and everything older is gone
+        dropOldest(segment.count);
+        dropSpilled();
+        return false;
+    }
+
+    for (const Entry &entry : loaded)
+        undoBytes += entryBytes(entry);
+    entries = loaded + entries;
+    return true;
+}
+
+// Forgets every spilled entry and empties the file
+void KpadUndoStack::dropSpilled() {
+    dropOldest(spilledCount);
+    spilledCount = 0;
+    segments.clear();
+    if (spillFile)
+        spillFile->resize(0);
+}
+
+// Keeps cleanCount pointing at the same state once the count oldest
+// entries are no longer in the history
+void KpadUndoStack::dropOldest(int count) {
+    cleanCount = cleanCount >= count ? cleanCount - count : -1;
+}
+
+// --------------------
+// Memory budget
+// --------------------
+qint64 KpadUndoStack::memoryBudget() {
+    if (budget < 0) {
+        const QSettings settings(settingsPath(), QSettings::IniFormat);
+        budget = qMax<qint64>(1, settings.value("undo/memoryBudget", kDefaultBudget).toLongLong());
+    }
+    return budget;
+}
+
+void KpadUndoStack::setMemoryBudget(qint64 bytes) {
+    budget = qMax<qint64>(1, bytes);
+    QSettings settings(settingsPath(), QSettings::IniFormat);
+    settings.setValue("undo/memoryBudget", budget);
+}
@@ -0,0 +1,128 @@
+#ifndef KPAD_UNDO_H
+#define KPAD_UNDO_H
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QString>
+#include <QVector>
+
+class QTemporaryFile;
+class QTextDocument;
+
+// --------------------
+// Undo history
+// --------------------
+// Undo and redo for a plain-text document, in place of QTextDocument's own
+// stack (which is switched off for it): one entry per text change, as the
+// piece table sees it. Typing, and Backspace or Delete held down, merge
+// into one entry until a pause, a newline or a save.
+//
+// Entries hold text only, so they are kept while the document has no
+// formatting of its own. Before the first format change (Bold, a font
+// size, a list, rich text pasted in) Kpad retires the stack: QTextDocument
+// undo is switched on and records everything from there, and undo falls
+// back to this stack only once Qt's is empty.
+//
+// The entries each document keeps in memory are bounded by memoryBudget()
+// (one setting for all of them). Past it, the oldest half is compressed
+// and appended to a temporary spill file as one segment; undoing that far
+// reads the last segment back and cuts it off the file. Once the file
+// would grow past kMaxSpillBytes, the spilled history is dropped. Redo
+// entries stay in memory until the next edit clears them.
+//
+// QTextDocument's stack (rich documents, and plain ones once retired) is
+// held to the same budget by an estimate of what its commands keep: the
+// text they changed plus kQtCommandBytes each. Past it, Qt's undo history
+// is cleared, with everything older here, and historyTrimmed() is emitted.
+class KpadUndoStack : public QObject
+{
+    Q_OBJECT
+
+public:
+    // position's removed text was replaced by inserted
+    struct Entry
+    {
+        int position = 0;
+        QString removed;
+        QString inserted;
+    };
+
+    // The document's stack, created on first use as its child, so it goes
+    // with the document
+    static KpadUndoStack *of(QTextDocument *document);
+
+    // contentsChange, as applied to the piece table; ignored while the
+    // stack is applying an undo or redo itself
+    void record(int position, const QString &removed, const QString &inserted);
+    // Reverts or re-applies one entry and sets the document's modified
+    // flag; returns the cursor position after it, -1 if there was none
+    int undo();
+    int redo();
+    void clear();                   // A new document or a load
+    // Hands later edits to QTextDocument's undo stack, which is switched on
+    void retire();
+    bool isRetired() const { return retired; }
+    bool isApplying() const { return applying; }
+    // Counts every text change, recorded or not; QTextDocument::revision()
+    // only moves while its own undo is on
+    int revision() const { return edits; }
+
+    int undoCount() const { return spilledCount + entries.size(); }
+    int redoCount() const { return redoEntries.size(); }
+    qint64 memoryBytes() const { return undoBytes + redoBytes; }
+
+    // In bytes; kept in the settings file
+    static qint64 memoryBudget();
+    static void setMemoryBudget(qint64 bytes);
+
+    static constexpr qint64 kDefaultBudget = qint64(64) << 20;
+    static constexpr qint64 kMaxSpillBytes = qint64(1) << 30;
+    static constexpr int kMergeMsecs = 1500;   // a longer pause starts a new entry
+    static constexpr qint64 kQtCommandBytes = 64;
+
+signals:
+    void historyTrimmed();          // Qt's undo history went past the budget
+
+private:
+    // A run of entries in the spill file, oldest first
+    struct Segment
+    {
+        qint64 offset = 0;
+        qint64 size = 0;            // compressed
+        int count = 0;
+    };
+
+    explicit KpadUndoStack(QTextDocument *document);
+
+    bool merge(int position, const QString &removed, const QString &inserted);
+    int replace(int position, int length, const QString &text);
+    void spill();
+    bool readBack();
+    void dropSpilled();
+    void dropOldest(int count);
+    void modificationChanged(bool modified);
+    void qtCommandAdded();
+    void qtContentsChange(int removed, int added);
+    void trimQtHistory();
+
+    QTextDocument *document;
+    QVector<Entry> entries;         // newest last; older ones are spilled
+    QVector<Entry> redoEntries;     // next redo last
+    QVector<Segment> segments;
+    QTemporaryFile *spillFile = nullptr;  // opened on the first spill
+    int spilledCount = 0;           // entries in segments
+    int cleanCount = 0;             // undoCount() when saved; -1 if not reachable
+    qint64 undoBytes = 0;           // entries
+    qint64 redoBytes = 0;
+    bool applying = false;
+    bool retired = false;           // QTextDocument's stack records new edits
+    bool mergeable = false;         // the last entry may still grow
+    QElapsedTimer sinceRecord;
+    int edits = 0;                  // revision()
+    qint64 qtBytes = 0;             // estimate of Qt's stack
+    qint64 qtPendingBytes = 0;      // changed since its last command was added
+
+    static inline qint64 budget = -1;  // until read from the settings
+};
+
+#endif // KPAD_UNDO_H
@@ -1,9 +1,19 @@
 #include "kpad.h"
+#include "kpad_batch.h"
 
 #include <QApplication>
+#include <cstring>
 
 int main(int argc, char *argv[])
 {
+    // kpad --batch ...: no window, no GUI; see KpadBatch
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--batch") == 0) {
+            QCoreApplication app(argc, argv);
+            return KpadBatch::run(app.arguments());
+        }
+    }
+
     // Create a QApplication object:
     QApplication app(argc, argv);
     // Create a Kpad object: